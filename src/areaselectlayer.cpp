@@ -134,7 +134,7 @@ void florb::areaselectlayer::notify()
     fire(&e);
 }
 
-bool florb::areaselectlayer::draw(const viewport &viewport, florb::canvas &os)
+bool florb::areaselectlayer::draw(const viewport &viewport, florb::drawable &os)
 {
     if (m_p1.x() < 0)
         return true;
@@ -18,7 +18,7 @@ namespace florb
             bool handle_evt_mouse(const layer::event_mouse* evt);
 
             void clear();
-            bool draw(const florb::viewport &viewport, florb::canvas &os);
+            bool draw(const florb::viewport &viewport, florb::drawable &os);
         private:
 
             bool press(const layer::event_mouse* evt);
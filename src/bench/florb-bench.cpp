@@ -0,0 +1,629 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <stdexcept>
+#include <new>
+#include <cstdlib>
+#include <ctime>
+#include <random>
+#include <chrono>
+#include <yaml-cpp/yaml.h>
+#include "utils.hpp"
+#include "viewport.hpp"
+#include "gfx.hpp"
+#include "event.hpp"
+#include "point.hpp"
+#include "bufferpool.hpp"
+#include "version.hpp"
+
+// Every allocation made through operator new is counted, so the benchmarks
+// can report allocations per operation. Neither operator is inlined, or the
+// compiler warns about malloc()ed memory being released by delete.
+static unsigned long heap_allocs = 0;
+
+__attribute__((noinline)) void* operator new(std::size_t n)
+{
+    heap_allocs++;
+    void *p = std::malloc((n > 0) ? n : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+// Keep the compiler from optimizing away results which are never used
+template <class T>
+static inline void keep(const T& v)
+{
+    asm volatile("" : : "g"(&v) : "memory");
+}
+
+// Number of precomputed inputs per benchmark, must be a power of two
+static const std::size_t NINPUTS = 1024;
+static const std::size_t MASK = NINPUTS-1;
+
+// Zoom level for the pixel conversions
+static const unsigned int ZOOM = 16;
+
+// Inputs are generated from a fixed seed, so every run and every commit
+// measures the same data. The raw mt19937 output is the same on every
+// platform, the standard distributions are not.
+static std::mt19937 rng(0x666c6f72);
+
+static double rnd(double min, double max)
+{
+    return min + ((double)rng() / (double)rng.max()) * (max - min);
+}
+
+static florb::point2d<double> rnd_wsg84()
+{
+    return florb::point2d<double>(rnd(-180.0, 180.0), rnd(-85.0, 85.0));
+}
+
+// Measures the loop of a benchmark, without its setup
+class timer
+{
+    public:
+        timer() :
+            m_ns(0.0),
+            m_allocs(0) {};
+
+        void start()
+        {
+            m_allocs = heap_allocs;
+            m_t = std::chrono::steady_clock::now();
+        };
+        void stop()
+        {
+            m_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - m_t).count();
+            m_allocs = heap_allocs - m_allocs;
+        };
+        double ns() const { return m_ns; };
+        unsigned long allocs() const { return m_allocs; };
+
+    private:
+        std::chrono::steady_clock::time_point m_t;
+        double m_ns;
+        unsigned long m_allocs;
+};
+
+class bench_event : public event_base
+{
+    public:
+        bench_event(int v) : m_v(v) {};
+        int v() const { return m_v; };
+    private:
+        int m_v;
+};
+
+class bench_listener : public event_listener
+{
+    public:
+        bench_listener() :
+            m_sum(0)
+        {
+            register_event_handler<bench_listener, bench_event>(this, &bench_listener::handle_evt);
+        };
+        long sum() { return m_sum; };
+
+    private:
+        bool handle_evt(const bench_event *e)
+        {
+            m_sum += e->v();
+            return true;
+        };
+
+        long m_sum;
+};
+
+class bench_generator : public event_generator
+{
+    public:
+        bool trigger(const event_base *e) { return fire(e); };
+};
+
+static void bench_wsg842merc(unsigned long n, timer& t)
+{
+    std::vector< florb::point2d<double> > in;
+    for (std::size_t i=0;i<NINPUTS;i++)
+        in.push_back(rnd_wsg84());
+
+    t.start();
+    for (unsigned long i=0;i<n;i++)
+        keep(florb::utils::wsg842merc(in[i & MASK]));
+    t.stop();
+}
+
+static void bench_merc2px(unsigned long n, timer& t)
+{
+    std::vector< florb::point2d<double> > in;
+    for (std::size_t i=0;i<NINPUTS;i++)
+        in.push_back(florb::utils::wsg842merc(rnd_wsg84()));
+
+    t.start();
+    for (unsigned long i=0;i<n;i++)
+        keep(florb::utils::merc2px(ZOOM, in[i & MASK]));
+    t.stop();
+}
+
+static void bench_px2merc(unsigned long n, timer& t)
+{
+    std::vector< florb::point2d<unsigned long> > in;
+    double dim = (double)florb::utils::dim(ZOOM);
+    for (std::size_t i=0;i<NINPUTS;i++)
+        in.push_back(florb::point2d<unsigned long>((unsigned long)rnd(0, dim-1), (unsigned long)rnd(0, dim-1)));
+
+    t.start();
+    for (unsigned long i=0;i<n;i++)
+        keep(florb::utils::px2merc(ZOOM, in[i & MASK]));
+    t.stop();
+}
+
+static void bench_dist(unsigned long n, timer& t)
+{
+    std::vector< florb::point2d<double> > in;
+    for (std::size_t i=0;i<NINPUTS;i++)
+        in.push_back(rnd_wsg84());
+
+    t.start();
+    for (unsigned long i=0;i<n;i++)
+        keep(florb::utils::dist(in[i & MASK], in[(i+1) & MASK]));
+    t.stop();
+}
+
+static void bench_dist_merc(unsigned long n, timer& t)
+{
+    std::vector< florb::point2d<double> > in;
+    for (std::size_t i=0;i<NINPUTS;i++)
+        in.push_back(florb::utils::wsg842merc(rnd_wsg84()));
+
+    t.start();
+    for (unsigned long i=0;i<n;i++)
+        keep(florb::utils::dist_merc(in[i & MASK], in[(i+1) & MASK]));
+    t.stop();
+}
+
+static void bench_clipline(unsigned long n, timer& t)
+{
+    // Lines around a viewport sized rectangle, some inside, some crossing
+    // and some entirely outside of it
+    std::vector< florb::point2d<double> > in;
+    for (std::size_t i=0;i<NINPUTS;i++)
+        in.push_back(florb::point2d<double>(rnd(-400.0, 1200.0), rnd(-300.0, 900.0)));
+
+    florb::point2d<double> r1(0.0, 0.0), r2(800.0, 600.0);
+    t.start();
+    for (unsigned long i=0;i<n;i++)
+    {
+        florb::point2d<double> p1(in[i & MASK]), p2(in[(i+1) & MASK]);
+        bool c1, c2;
+        keep(florb::utils::clipline(p1, p2, r1, r2, c1, c2));
+        keep(p1);
+        keep(p2);
+    }
+    t.stop();
+}
+
+static void bench_iso8601_2timet(unsigned long n, timer& t)
+{
+    std::vector<std::string> in;
+    for (std::size_t i=0;i<NINPUTS;i++)
+        in.push_back(florb::utils::timet2iso8601((time_t)rnd(0.0, 2000000000.0)));
+
+    t.start();
+    for (unsigned long i=0;i<n;i++)
+        keep(florb::utils::iso8601_2timet(in[i & MASK]));
+    t.stop();
+}
+
+static void bench_str_split(unsigned long n, timer& t)
+{
+    // Typical inputs: coordinate lists and tile server URLs
+    std::vector<std::string> in;
+    for (std::size_t i=0;i<NINPUTS;i++)
+    {
+        std::ostringstream oss;
+        if (i & 1)
+            oss << rnd(-180.0, 180.0) << "," << rnd(-85.0, 85.0) << "," << rnd(-180.0, 180.0) << "," << rnd(-85.0, 85.0);
+        else
+            oss << "http,//tile.example.org," << (rng() % 19) << "," << (rng() % 65536) << "," << (rng() % 65536) << ".png";
+        in.push_back(oss.str());
+    }
+
+    t.start();
+    for (unsigned long i=0;i<n;i++)
+        keep(florb::utils::str_split(in[i & MASK], ","));
+    t.stop();
+}
+
+static void bench_viewport_move(unsigned long n, timer& t)
+{
+    std::vector< florb::point2d<long> > in;
+    for (std::size_t i=0;i<NINPUTS;i++)
+        in.push_back(florb::point2d<long>((long)rnd(-100.0, 100.0), (long)rnd(-100.0, 100.0)));
+
+    unsigned long dim = florb::utils::dim(ZOOM);
+    florb::viewport vp(dim/2, dim/2, ZOOM, 800, 600);
+    t.start();
+    for (unsigned long i=0;i<n;i++)
+    {
+        vp.move(in[i & MASK].x(), in[i & MASK].y());
+        keep(vp);
+    }
+    t.stop();
+}
+
+static void bench_viewport_z(unsigned long n, timer& t)
+{
+    // Zoom in and out around random positions within the viewport
+    std::vector< florb::point2d<unsigned long> > in;
+    for (std::size_t i=0;i<NINPUTS;i++)
+        in.push_back(florb::point2d<unsigned long>((unsigned long)rnd(0.0, 799.0), (unsigned long)rnd(0.0, 599.0)));
+
+    unsigned long dim = florb::utils::dim(ZOOM);
+    florb::viewport vp(dim/2, dim/2, ZOOM, 800, 600);
+    t.start();
+    for (unsigned long i=0;i<n;i++)
+    {
+        vp.z(ZOOM - (i & 1), in[i & MASK].x(), in[i & MASK].y());
+        keep(vp);
+    }
+    t.stop();
+}
+
+static void bench_image_scale(unsigned long n, timer& t, int filter, int dw)
+{
+    // A quarter of a tile enlarged to a whole one and a whole tile shrunk
+    // to a quarter, the two cases of standing in for missing tiles
+    std::vector<unsigned char> px(256*256*4);
+    for (std::size_t i=0;i<px.size();i++)
+        px[i] = (unsigned char)rnd(0.0, 255.0);
+
+    florb::image src(256, 256, 4, &px[0]);
+    int sw = (dw > 256) ? 128 : 256;
+
+    t.start();
+    for (unsigned long i=0;i<n;i++)
+    {
+        florb::image dst(src, 0, 0, sw, sw, dw, dw, filter);
+        keep(dst.data()[0]);
+    }
+    t.stop();
+}
+
+static void bench_image_up_nearest(unsigned long n, timer& t)
+{
+    bench_image_scale(n, t, florb::image::NEAREST, 512);
+}
+
+static void bench_image_up_smooth(unsigned long n, timer& t)
+{
+    bench_image_scale(n, t, florb::image::SMOOTH, 512);
+}
+
+static void bench_image_down_smooth(unsigned long n, timer& t)
+{
+    bench_image_scale(n, t, florb::image::SMOOTH, 128);
+}
+
+static void bench_fire(unsigned long n, timer& t, std::size_t nlisteners)
+{
+    bench_generator g;
+    std::vector<bench_listener*> l;
+    for (std::size_t i=0;i<nlisteners;i++)
+    {
+        l.push_back(new bench_listener());
+        g.add_event_listener(l.back());
+    }
+
+    t.start();
+    for (unsigned long i=0;i<n;i++)
+    {
+        bench_event e((int)i);
+        keep(g.trigger(&e));
+    }
+    t.stop();
+
+    for (std::size_t i=0;i<nlisteners;i++)
+    {
+        g.remove_event_listener(l[i]);
+        delete l[i];
+    }
+}
+
+static void bench_fire_1(unsigned long n, timer& t)
+{
+    bench_fire(n, t, 1);
+}
+
+static void bench_fire_8(unsigned long n, timer& t)
+{
+    bench_fire(n, t, 8);
+}
+
+// One tile sized download: get a buffer, fill it, hand it back
+static void bench_bufferpool(unsigned long n, timer& t)
+{
+    std::vector<char> data(24*1024, 'x');
+    std::vector<char> buf;
+
+    t.start();
+    for (unsigned long i=0;i<n;i++)
+    {
+        florb::bufferpool::get(buf, 64*1024);
+        buf.insert(buf.end(), data.begin(), data.end());
+        keep(buf.size());
+        florb::bufferpool::put(buf);
+    }
+    t.stop();
+}
+
+struct benchmark
+{
+    const char *name;
+    void (*fn)(unsigned long n, timer& t);
+};
+
+static const benchmark benchmarks[] = {
+    {"utils::wsg842merc",           bench_wsg842merc},
+    {"utils::merc2px",              bench_merc2px},
+    {"utils::px2merc",              bench_px2merc},
+    {"utils::dist",                 bench_dist},
+    {"utils::dist_merc",            bench_dist_merc},
+    {"utils::clipline",             bench_clipline},
+    {"utils::iso8601_2timet",       bench_iso8601_2timet},
+    {"utils::str_split",            bench_str_split},
+    {"viewport::move",              bench_viewport_move},
+    {"viewport::z",                 bench_viewport_z},
+    {"image::scale/up/nearest",     bench_image_up_nearest},
+    {"image::scale/up/smooth",      bench_image_up_smooth},
+    {"image::scale/down/smooth",    bench_image_down_smooth},
+    {"event_generator::fire/1",     bench_fire_1},
+    {"event_generator::fire/8",     bench_fire_8},
+    {"bufferpool::get/put",         bench_bufferpool},
+};
+
+struct result
+{
+    std::string name;
+    unsigned long iterations;
+    double ns;
+    double ns_min;
+    double ns_max;
+    double allocs;
+};
+
+// Run n iterations with the same inputs as every other run
+static void measure(const benchmark& b, unsigned long n, double& ns, unsigned long& nallocs)
+{
+    timer t;
+    rng.seed(0x666c6f72);
+    b.fn(n, t);
+
+    ns = t.ns();
+    nallocs = t.allocs();
+}
+
+static result run(const benchmark& b, unsigned int runs, double mintime)
+{
+    // Double the number of iterations until a single run takes long enough
+    unsigned long n = 1;
+    double ns;
+    unsigned long nallocs;
+    for (;;)
+    {
+        measure(b, n, ns, nallocs);
+        if ((ns >= (mintime * 1e6)) || (n >= (1UL << 34)))
+            break;
+        n *= 2;
+    }
+
+    std::vector<double> v;
+    for (unsigned int i=0;i<runs;i++)
+    {
+        measure(b, n, ns, nallocs);
+        v.push_back(ns / (double)n);
+    }
+
+    std::sort(v.begin(), v.end());
+
+    result r;
+    r.name = b.name;
+    r.iterations = n;
+    r.ns = v[v.size()/2];
+    r.ns_min = v.front();
+    r.ns_max = v.back();
+    r.allocs = (double)nallocs / (double)n;
+
+    return r;
+}
+
+static std::string json_escape(const std::string& s)
+{
+    std::string ret;
+    for (std::size_t i=0;i<s.size();i++)
+    {
+        if ((s[i] == '"') || (s[i] == '\\'))
+            ret += '\\';
+        ret += s[i];
+    }
+
+    return ret;
+}
+
+static void print_json(const std::vector<result>& res, unsigned int runs, double mintime)
+{
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "{\n";
+    std::cout << "  \"version\": \"" << json_escape(FLORB_VERSION) << "\",\n";
+    std::cout << "  \"runs\": " << runs << ",\n";
+    std::cout << "  \"mintime_ms\": " << mintime << ",\n";
+    std::cout << "  \"benchmarks\": [\n";
+
+    for (std::size_t i=0;i<res.size();i++)
+    {
+        std::cout << "    {\"name\": \"" << json_escape(res[i].name) << "\", " <<
+            "\"iterations\": " << res[i].iterations << ", " <<
+            "\"ns_per_op\": " << res[i].ns << ", " <<
+            "\"ns_per_op_min\": " << res[i].ns_min << ", " <<
+            "\"ns_per_op_max\": " << res[i].ns_max << ", " <<
+            "\"allocs_per_op\": " << res[i].allocs << "}" <<
+            (((i+1) < res.size()) ? "," : "") << "\n";
+    }
+
+    std::cout << "  ]\n";
+    std::cout << "}\n";
+}
+
+// JSON is a subset of YAML, so earlier results are read with yaml-cpp
+static std::map<std::string, double> load_baseline(const std::string& path)
+{
+    std::map<std::string, double> ret;
+
+    YAML::Node root;
+    try {
+        root = YAML::LoadFile(path);
+    } catch (YAML::Exception& e) {
+        throw std::runtime_error(std::string(_("Failed to load baseline ")) + path);
+    }
+
+    YAML::Node b = root["benchmarks"];
+    if (!b.IsSequence())
+        throw std::runtime_error(std::string(_("Invalid baseline ")) + path);
+
+    for (std::size_t i=0;i<b.size();i++)
+        ret[b[i]["name"].as<std::string>()] = b[i]["ns_per_op"].as<double>();
+
+    return ret;
+}
+
+static void print_table(const std::vector<result>& res, const std::map<std::string, double>& baseline)
+{
+    std::cout << std::left << std::setw(28) << "benchmark" << std::right <<
+        std::setw(12) << "ns/op" <<
+        std::setw(12) << "min" <<
+        std::setw(12) << "max" <<
+        std::setw(12) << "allocs/op";
+    if (baseline.size() > 0)
+        std::cout << std::setw(12) << "baseline" << std::setw(10) << "delta";
+    std::cout << std::endl;
+
+    std::cout << std::fixed;
+    for (std::size_t i=0;i<res.size();i++)
+    {
+        std::cout << std::left << std::setw(28) << res[i].name << std::right << std::setprecision(2) <<
+            std::setw(12) << res[i].ns <<
+            std::setw(12) << res[i].ns_min <<
+            std::setw(12) << res[i].ns_max <<
+            std::setw(12) << res[i].allocs;
+
+        std::map<std::string, double>::const_iterator it = baseline.find(res[i].name);
+        if ((it != baseline.end()) && (it->second > 0.0))
+        {
+            std::cout << std::setw(12) << it->second <<
+                std::setw(9) << std::showpos << (((res[i].ns / it->second) - 1.0) * 100.0) << std::noshowpos << "%";
+        }
+
+        std::cout << std::endl;
+    }
+}
+
+static void usage()
+{
+    std::cerr <<
+        "Usage: florb-bench [options]\n"
+        "\n"
+        "  -f STRING   Only run benchmarks whose name contains STRING\n"
+        "  -r RUNS     Number of measured runs per benchmark, the median is reported (5)\n"
+        "  -t MS       Minimum duration of a single run in milliseconds (100)\n"
+        "  -j          Print the results as JSON\n"
+        "  -c FILE     Compare with the JSON results of an earlier run\n"
+        "  -l          List the benchmarks\n";
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<std::string> args(argv+1, argv+argc);
+
+    std::string filter, baselinefile;
+    unsigned int runs = 5;
+    double mintime = 100.0;
+    bool json = false, list = false;
+
+    for (std::size_t i=0;i<args.size();i++)
+    {
+        const std::string& a = args[i];
+        bool ok = true;
+
+        if (a == "-j")
+            json = true;
+        else if (a == "-l")
+            list = true;
+        else if ((i+1) >= args.size())
+            ok = false;
+        else if (a == "-f")
+            filter = args[++i];
+        else if (a == "-c")
+            baselinefile = args[++i];
+        else if (a == "-r")
+            ok = florb::utils::fromstr(args[++i], runs) && (runs > 0);
+        else if (a == "-t")
+            ok = florb::utils::fromstr(args[++i], mintime);
+        else
+            ok = false;
+
+        if (!ok)
+        {
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Make the results independent of the local timezone
+    setenv("TZ", "UTC", 1);
+    tzset();
+
+    std::map<std::string, double> baseline;
+    try {
+        if (!baselinefile.empty())
+            baseline = load_baseline(baselinefile);
+    } catch (std::exception& e) {
+        std::cerr << "florb-bench: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<result> res;
+    for (std::size_t i=0;i<(sizeof(benchmarks)/sizeof(benchmarks[0]));i++)
+    {
+        if ((!filter.empty()) && (std::string(benchmarks[i].name).find(filter) == std::string::npos))
+            continue;
+
+        if (list)
+        {
+            std::cout << benchmarks[i].name << std::endl;
+            continue;
+        }
+
+        res.push_back(run(benchmarks[i], runs, mintime));
+    }
+
+    if (list)
+        return EXIT_SUCCESS;
+
+    if (json)
+        print_json(res, runs, mintime);
+    else
+        print_table(res, baseline);
+
+    return EXIT_SUCCESS;
+}
+
@@ -0,0 +1,1006 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <deque>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+#include <random>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <csetjmp>
+#include <ctime>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <png.h>
+#include <jpeglib.h>
+#include <curl/curl.h>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/interprocess/sync/interprocess_mutex.hpp>
+#include <boost/interprocess/sync/interprocess_semaphore.hpp>
+#include "utils.hpp"
+#include "settings.hpp"
+#include "viewport.hpp"
+#include "event.hpp"
+#include "bitmap.hpp"
+#include "osmlayer.hpp"
+#include "markerlayer.hpp"
+#include "scalelayer.hpp"
+#include "tilestats.hpp"
+#include "trace.hpp"
+#include "version.hpp"
+
+// End-to-end benchmark: Replays a scripted sequence of viewport changes
+// against an osmlayer which downloads from a local tile server stand-in and
+// draws the frames the same way wgt_map::draw() does.
+
+static double now_ms()
+{
+    static const boost::posix_time::ptime epoch(boost::posix_time::microsec_clock::universal_time());
+    return (double)(boost::posix_time::microsec_clock::universal_time() - epoch).total_microseconds() / 1000.0;
+}
+
+// HTTP tile server stand-in serving synthetic tiles with a configurable
+// latency and expiry. Every connection is handled by a thread of its own, so
+// the latency of parallel requests overlaps like it does with a real server.
+class tileserver
+{
+    public:
+        tileserver(int type, unsigned int latency, unsigned int jitter, long expires);
+        ~tileserver();
+
+        int port() { return m_port; };
+        unsigned long requests();
+        unsigned long bytes();
+
+    private:
+        static const unsigned int VARIANTS = 16;
+
+        void encode_png(const std::vector<unsigned char>& rgb, std::string& out);
+        void encode_jpg(std::vector<unsigned char>& rgb, std::string& out);
+        void acceptor();
+        void handle(int fd);
+        bool exit();
+
+        std::vector<std::string> m_tiles;
+        std::string m_ctype;
+        unsigned int m_latency;
+        unsigned int m_jitter;
+        long m_expires;
+
+        int m_sock;
+        int m_port;
+        boost::thread *m_thread;
+        boost::interprocess::interprocess_mutex m_mutex;
+        bool m_exit;
+        unsigned long m_requests;
+        unsigned long m_bytes;
+        unsigned long m_seed;
+};
+
+tileserver::tileserver(int type, unsigned int latency, unsigned int jitter, long expires) :
+    m_ctype((type == florb::image::JPG) ? "image/jpeg" : "image/png"),
+    m_latency(latency),
+    m_jitter(jitter),
+    m_expires(expires),
+    m_sock(-1),
+    m_port(0),
+    m_thread(NULL),
+    m_exit(false),
+    m_requests(0),
+    m_bytes(0),
+    m_seed(0)
+{
+    // A couple of different tiles with a random 8x8 pixel block pattern, so
+    // the image data does not compress to nothing
+    std::mt19937 rng(0x74696c65);
+    for (unsigned int v=0;v<VARIANTS;v++)
+    {
+        std::vector<unsigned char> rgb(256*256*3);
+        for (int by=0;by<256;by+=8)
+        {
+            for (int bx=0;bx<256;bx+=8)
+            {
+                unsigned int c = rng();
+                for (int y=by;y<(by+8);y++)
+                {
+                    for (int x=bx;x<(bx+8);x++)
+                    {
+                        unsigned char *p = &rgb[((y*256)+x)*3];
+                        p[0] = (c & 0xff); p[1] = ((c >> 8) & 0xff); p[2] = ((c >> 16) & 0xff);
+                    }
+                }
+            }
+        }
+
+        std::string tile;
+        if (type == florb::image::JPG)
+            encode_jpg(rgb, tile);
+        else
+            encode_png(rgb, tile);
+        m_tiles.push_back(tile);
+    }
+
+    int rc = -1;
+    for (;;)
+    {
+        m_sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (m_sock < 0)
+            break;
+
+        int on = 1;
+        setsockopt(m_sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = 0;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        if (bind(m_sock, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+            break;
+
+        if (::listen(m_sock, 64) != 0)
+            break;
+
+        socklen_t len = sizeof(addr);
+        if (getsockname(m_sock, (struct sockaddr*)&addr, &len) != 0)
+            break;
+
+        m_port = ntohs(addr.sin_port);
+        rc = 0;
+        break;
+    }
+
+    if (rc != 0)
+    {
+        if (m_sock >= 0)
+            close(m_sock);
+        throw std::runtime_error(_("Failed to start the tile server"));
+    }
+
+    m_thread = new boost::thread(boost::bind(&tileserver::acceptor, this));
+}
+
+tileserver::~tileserver()
+{
+    m_mutex.lock();
+    m_exit = true;
+    m_mutex.unlock();
+
+    // Unblock accept()
+    shutdown(m_sock, SHUT_RDWR);
+    close(m_sock);
+
+    m_thread->join();
+    delete m_thread;
+}
+
+unsigned long tileserver::requests()
+{
+    m_mutex.lock();
+    unsigned long ret = m_requests;
+    m_mutex.unlock();
+
+    return ret;
+}
+
+unsigned long tileserver::bytes()
+{
+    m_mutex.lock();
+    unsigned long ret = m_bytes;
+    m_mutex.unlock();
+
+    return ret;
+}
+
+bool tileserver::exit()
+{
+    m_mutex.lock();
+    bool ret = m_exit;
+    m_mutex.unlock();
+
+    return ret;
+}
+
+static void png_write_string(png_structp png, png_bytep data, png_size_t len)
+{
+    std::string *out = static_cast<std::string*>(png_get_io_ptr(png));
+    out->append(reinterpret_cast<const char*>(data), len);
+}
+
+void tileserver::encode_png(const std::vector<unsigned char>& rgb, std::string& out)
+{
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info = png_create_info_struct(png);
+    if ((!png) || (!info) || (setjmp(png_jmpbuf(png))))
+    {
+        png_destroy_write_struct(&png, &info);
+        throw std::runtime_error(_("Failed to create tile image"));
+    }
+
+    png_set_write_fn(png, &out, png_write_string, NULL);
+    png_set_IHDR(png, info, 256, 256, 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png, info);
+    for (int y=0;y<256;y++)
+        png_write_row(png, const_cast<png_bytep>(&rgb[y*256*3]));
+    png_write_end(png, NULL);
+    png_destroy_write_struct(&png, &info);
+}
+
+void tileserver::encode_jpg(std::vector<unsigned char>& rgb, std::string& out)
+{
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr err;
+    unsigned char *buf = NULL;
+    unsigned long size = 0;
+
+    cinfo.err = jpeg_std_error(&err);
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &buf, &size);
+
+    cinfo.image_width = 256;
+    cinfo.image_height = 256;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, 85, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+    while (cinfo.next_scanline < cinfo.image_height)
+    {
+        JSAMPROW row = &rgb[cinfo.next_scanline*256*3];
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+
+    out.assign(reinterpret_cast<const char*>(buf), size);
+    free(buf);
+}
+
+void tileserver::acceptor()
+{
+    std::vector<boost::thread*> threads;
+
+    while (!exit())
+    {
+        int fd = accept(m_sock, NULL, NULL);
+        if (fd < 0)
+            continue;
+
+        threads.push_back(new boost::thread(boost::bind(&tileserver::handle, this, fd)));
+    }
+
+    std::vector<boost::thread*>::iterator it;
+    for (it=threads.begin();it!=threads.end();++it)
+    {
+        (*it)->join();
+        delete (*it);
+    }
+}
+
+void tileserver::handle(int fd)
+{
+    // Read the request header, only the request line is of interest
+    std::string req;
+    char buf[1024];
+    while (req.find("\r\n\r\n") == std::string::npos)
+    {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0)
+            break;
+        req.append(buf, n);
+    }
+
+    // GET /z/x/y.ext HTTP/1.1
+    std::vector<std::string> line(florb::utils::str_split(req.substr(0, req.find("\r\n")), " "));
+    std::vector<std::string> path;
+    if (line.size() >= 2)
+        path = florb::utils::str_split(line[1], "/");
+
+    unsigned long z = 0, x = 0, y = 0;
+    bool ok = (path.size() == 3) &&
+        florb::utils::fromstr(path[0], z) &&
+        florb::utils::fromstr(path[1], x) &&
+        florb::utils::fromstr(path[2].substr(0, path[2].find('.')), y);
+
+    m_mutex.lock();
+    m_requests++;
+    unsigned long seed = m_seed++;
+    m_mutex.unlock();
+
+    // Simulated server and network latency
+    unsigned int latency = m_latency;
+    if (m_jitter > 0)
+        latency += (unsigned int)((seed * 2654435761UL) % (m_jitter + 1));
+    if (latency > 0)
+        boost::this_thread::sleep(boost::posix_time::milliseconds(latency));
+
+    std::ostringstream hdr;
+    const std::string *body = NULL;
+    if (ok)
+    {
+        body = &m_tiles[((z * 31) + (x * 17) + y) % VARIANTS];
+
+        char date[64];
+        time_t t = time(NULL) + m_expires;
+        strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", gmtime(&t));
+
+        hdr << "HTTP/1.1 200 OK\r\n" <<
+            "Content-Type: " << m_ctype << "\r\n" <<
+            "Content-Length: " << body->size() << "\r\n" <<
+            "Expires: " << date << "\r\n" <<
+            "Connection: close\r\n\r\n";
+    }
+    else
+    {
+        hdr << "HTTP/1.1 404 Not Found\r\n" <<
+            "Content-Length: 0\r\n" <<
+            "Connection: close\r\n\r\n";
+    }
+
+    std::string resp(hdr.str());
+    if (body)
+        resp += *body;
+
+    std::size_t sent = 0;
+    while (sent < resp.size())
+    {
+        ssize_t n = send(fd, resp.data()+sent, resp.size()-sent, MSG_NOSIGNAL);
+        if (n <= 0)
+            break;
+        sent += n;
+    }
+
+    m_mutex.lock();
+    m_bytes += sent;
+    m_mutex.unlock();
+
+    close(fd);
+}
+
+// Stands in for the FLTK main loop: Callbacks from worker threads are queued
+// and run by the replay loop, which is what Fl::awake() does in the GUI.
+class mainloop
+{
+    public:
+        static int awake(event_dispatch::callback cb, void *data)
+        {
+            m_mutex.lock();
+            m_queue.push_back(std::make_pair(cb, data));
+            m_mutex.unlock();
+            m_sem.post();
+
+            return 0;
+        };
+
+        // Run all queued callbacks, wait for up to ms if there are none
+        static void run(double ms)
+        {
+            boost::posix_time::ptime deadline =
+                boost::posix_time::microsec_clock::universal_time() +
+                boost::posix_time::microseconds((long)(ms * 1000.0));
+            if (!m_sem.timed_wait(deadline))
+                return;
+
+            for (;;)
+            {
+                m_mutex.lock();
+                if (m_queue.size() == 0)
+                {
+                    m_mutex.unlock();
+                    break;
+                }
+                std::pair<event_dispatch::callback, void*> c = m_queue.front();
+                m_queue.pop_front();
+                m_mutex.unlock();
+
+                c.first(c.second);
+            }
+
+            // Consume the remaining posts, their callbacks have already run
+            while (m_sem.try_wait());
+        };
+
+    private:
+        static std::deque< std::pair<event_dispatch::callback, void*> > m_queue;
+        static boost::interprocess::interprocess_mutex m_mutex;
+        static boost::interprocess::interprocess_semaphore m_sem;
+};
+
+std::deque< std::pair<event_dispatch::callback, void*> > mainloop::m_queue;
+boost::interprocess::interprocess_mutex mainloop::m_mutex;
+boost::interprocess::interprocess_semaphore mainloop::m_sem(0);
+
+// Marks the map dirty whenever the tile layer has new tiles, just like
+// wgt_map::osm_evt_notify()
+class mapstate : public event_listener
+{
+    public:
+        mapstate() :
+            m_dirty(true)
+        {
+            register_event_handler<mapstate, florb::osmlayer::event_notify>(this, &mapstate::osm_evt_notify);
+        };
+
+        bool dirty() { return m_dirty; };
+        void dirty(bool d) { m_dirty = d; };
+
+    private:
+        bool osm_evt_notify(const florb::osmlayer::event_notify *e)
+        {
+            m_dirty = true;
+            return true;
+        };
+
+        bool m_dirty;
+};
+
+// One step of the replay script
+struct step
+{
+    enum { GOTO, MOVE, ZOOM, WAIT };
+
+    std::string text;
+    int cmd;
+    double a, b, c;
+};
+
+static const char *default_script[] = {
+    "goto 8.5417 47.3769 12",
+    "move 128 0",
+    "move 128 0",
+    "move 0 128",
+    "move -256 -64",
+    "zoom 13 400 300",
+    "move 200 150",
+    "zoom 14 400 300",
+    "move -300 0",
+    "move 0 -300",
+    "zoom 12 400 300",
+    "move 512 512",
+    "zoom 15 100 100",
+    "move 640 480",
+    "zoom 13 700 500",
+    NULL
+};
+
+static step parse_step(const std::string& line)
+{
+    std::istringstream iss(line);
+    std::vector<std::string> args;
+    std::string a;
+    while (iss >> a)
+        args.push_back(a);
+
+    step s;
+    s.text = line;
+    s.a = s.b = s.c = 0.0;
+
+    std::size_t nargs = 0;
+    if (args[0] == "goto")
+        { s.cmd = step::GOTO; nargs = 3; }
+    else if (args[0] == "move")
+        { s.cmd = step::MOVE; nargs = 2; }
+    else if (args[0] == "zoom")
+        { s.cmd = step::ZOOM; nargs = 3; }
+    else if (args[0] == "wait")
+        { s.cmd = step::WAIT; nargs = 1; }
+    else
+        throw std::runtime_error(std::string(_("Invalid script command ")) + line);
+
+    bool ok = (args.size() == (nargs+1));
+    if ((ok) && (nargs > 0)) ok = florb::utils::fromstr(args[1], s.a);
+    if ((ok) && (nargs > 1)) ok = florb::utils::fromstr(args[2], s.b);
+    if ((ok) && (nargs > 2)) ok = florb::utils::fromstr(args[3], s.c);
+    if (!ok)
+        throw std::runtime_error(std::string(_("Invalid script command ")) + line);
+
+    return s;
+}
+
+static void load_script(const std::string& path, std::vector<step>& script)
+{
+    if (path.empty())
+    {
+        for (std::size_t i=0;default_script[i]!=NULL;i++)
+            script.push_back(parse_step(default_script[i]));
+        return;
+    }
+
+    std::ifstream f;
+    std::istream *in = &std::cin;
+    if (path != "-")
+    {
+        f.open(path.c_str());
+        if (!f.is_open())
+            throw std::runtime_error(std::string(_("Failed to open script ")) + path);
+        in = &f;
+    }
+
+    std::string line;
+    while (std::getline(*in, line))
+    {
+        std::size_t p = line.find_first_not_of(" \t");
+        if ((p == std::string::npos) || (line[p] == '#'))
+            continue;
+        script.push_back(parse_step(line.substr(p)));
+    }
+
+    if ((script.size() == 0) || (script[0].cmd != step::GOTO))
+        throw std::runtime_error(_("The script has to start with goto"));
+}
+
+struct options
+{
+    options() :
+        type(florb::image::PNG),
+        latency(50),
+        jitter(0),
+        expires(86400),
+        parallel(2),
+        w(800),
+        h(600),
+        timeout(30),
+        passes(2),
+        json(false) {};
+
+    std::string script;
+    std::string cachedir;
+    std::string stats;
+    std::string trace;
+    int type;
+    unsigned int latency;
+    unsigned int jitter;
+    long expires;
+    unsigned int parallel;
+    unsigned int w;
+    unsigned int h;
+    unsigned int timeout;
+    unsigned int passes;
+    bool json;
+};
+
+struct step_result
+{
+    std::string text;
+    double ttff;
+    double ttcv;
+    bool complete;
+    unsigned int frames;
+    unsigned long tiles;
+    unsigned long misses;
+};
+
+struct pass_result
+{
+    std::string name;
+    double duration;
+    std::vector<step_result> steps;
+    std::vector<double> t_osm;
+    std::vector<double> t_scale;
+    std::vector<double> t_marker;
+    std::vector<double> t_frame;
+    unsigned long requests;
+    unsigned long bytes;
+};
+
+static void apply(const step& s, florb::viewport& vp, unsigned int w, unsigned int h)
+{
+    switch (s.cmd)
+    {
+        case step::GOTO:
+            {
+                unsigned int z = (unsigned int)s.c;
+                florb::point2d<unsigned long> px(florb::utils::wsg842px(z, florb::point2d<double>(s.a, s.b)));
+                vp = florb::viewport(0, 0, z, w, h);
+                vp.x((px.x() > (w/2)) ? (px.x() - (w/2)) : 0);
+                vp.y((px.y() > (h/2)) ? (px.y() - (h/2)) : 0);
+                break;
+            }
+        case step::MOVE:
+            vp.move((long)s.a, (long)s.b);
+            break;
+        case step::ZOOM:
+            vp.z((unsigned int)s.a, (unsigned long)s.b, (unsigned long)s.c);
+            break;
+        default:
+            break;
+    }
+}
+
+static pass_result run_pass(const std::string& name, const std::vector<step>& script, const options& opt, tileserver& srv)
+{
+    pass_result res;
+    res.name = name;
+
+    std::ostringstream url;
+    url << "http://127.0.0.1:" << srv.port() << "/{z}/{x}/{y}." << ((opt.type == florb::image::JPG) ? "jpg" : "png");
+
+    // Same layers and drawing order as the map widget
+    florb::osmlayer osm("mapbench", url.str(), 0, 18, opt.parallel, opt.type);
+    florb::scalelayer scale;
+    florb::markerlayer marker;
+    florb::bitmap offscreen(opt.w, opt.h);
+
+    mapstate state;
+    osm.add_event_listener(&state);
+
+    florb::viewport vp;
+    unsigned long req0 = srv.requests(), bytes0 = srv.bytes();
+    double tpass = now_ms();
+
+    std::vector<step>::const_iterator it;
+    for (it=script.begin();it!=script.end();++it)
+    {
+        if ((*it).cmd == step::WAIT)
+        {
+            double tend = now_ms() + (*it).a;
+            while (now_ms() < tend)
+                mainloop::run(tend - now_ms());
+            continue;
+        }
+
+        apply(*it, vp, opt.w, opt.h);
+        if ((*it).cmd == step::GOTO)
+            marker.add(florb::utils::wsg842merc(florb::point2d<double>((*it).a, (*it).b)));
+
+        step_result sr;
+        sr.text = (*it).text;
+        sr.ttff = sr.ttcv = -1.0;
+        sr.complete = false;
+        sr.frames = 0;
+        sr.tiles = sr.misses = 0;
+
+        state.dirty(true);
+        double t0 = now_ms();
+        double deadline = t0 + (opt.timeout * 1000.0);
+
+        while (now_ms() < deadline)
+        {
+            if (!state.dirty())
+            {
+                mainloop::run(deadline - now_ms());
+                continue;
+            }
+
+            state.dirty(false);
+
+            double tf0 = now_ms();
+            offscreen.fgcolor(florb::color(0xc06e6e));
+            offscreen.fillrect(0, 0, offscreen.w(), offscreen.h());
+
+            double tf1 = now_ms();
+            bool complete = osm.draw(vp, offscreen);
+            double tf2 = now_ms();
+            scale.draw(vp, offscreen);
+            double tf3 = now_ms();
+            marker.draw(vp, offscreen);
+            double tf4 = now_ms();
+
+            res.t_osm.push_back(tf2 - tf1);
+            res.t_scale.push_back(tf3 - tf2);
+            res.t_marker.push_back(tf4 - tf3);
+            res.t_frame.push_back(tf4 - tf0);
+
+            if (sr.frames == 0)
+            {
+                sr.ttff = tf4 - t0;
+                sr.tiles = osm.tiles_total();
+                sr.misses = osm.tiles_missing();
+            }
+            sr.frames++;
+
+            if (complete)
+            {
+                sr.ttcv = tf4 - t0;
+                sr.complete = true;
+                break;
+            }
+        }
+
+        res.steps.push_back(sr);
+    }
+
+    osm.remove_event_listener(&state);
+
+    res.duration = now_ms() - tpass;
+    res.requests = srv.requests() - req0;
+    res.bytes = srv.bytes() - bytes0;
+
+    return res;
+}
+
+static double percentile(std::vector<double> v, double p)
+{
+    if (v.size() == 0)
+        return 0.0;
+
+    std::sort(v.begin(), v.end());
+    std::size_t i = (std::size_t)(p * (double)(v.size()-1) + 0.5);
+    return v[i];
+}
+
+static double mean(const std::vector<double>& v)
+{
+    double sum = 0.0;
+    for (std::size_t i=0;i<v.size();i++)
+        sum += v[i];
+
+    return (v.size() > 0) ? (sum / (double)v.size()) : 0.0;
+}
+
+static double hitratio(const pass_result& r)
+{
+    unsigned long tiles = 0, misses = 0;
+    for (std::size_t i=0;i<r.steps.size();i++)
+    {
+        tiles += r.steps[i].tiles;
+        misses += r.steps[i].misses;
+    }
+
+    return (tiles > 0) ? ((double)(tiles - misses) / (double)tiles) : 1.0;
+}
+
+static void print_json_stats(const char *name, const std::vector<double>& v, bool last)
+{
+    std::cout << "      \"" << name << "\": {" <<
+        "\"mean\": " << mean(v) << ", " <<
+        "\"p50\": " << percentile(v, 0.5) << ", " <<
+        "\"p95\": " << percentile(v, 0.95) << ", " <<
+        "\"max\": " << percentile(v, 1.0) << "}" << (last ? "" : ",") << "\n";
+}
+
+static void print_json(const std::vector<pass_result>& res, const options& opt)
+{
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "{\n";
+    std::cout << "  \"version\": \"" << FLORB_VERSION << "\",\n";
+    std::cout << "  \"latency_ms\": " << opt.latency << ",\n";
+    std::cout << "  \"jitter_ms\": " << opt.jitter << ",\n";
+    std::cout << "  \"parallel\": " << opt.parallel << ",\n";
+    std::cout << "  \"passes\": [\n";
+
+    for (std::size_t p=0;p<res.size();p++)
+    {
+        const pass_result& r = res[p];
+        std::cout << "    {\n";
+        std::cout << "      \"name\": \"" << r.name << "\",\n";
+        std::cout << "      \"duration_ms\": " << r.duration << ",\n";
+        std::cout << "      \"requests\": " << r.requests << ",\n";
+        std::cout << "      \"bytes\": " << r.bytes << ",\n";
+        std::cout << "      \"hit_ratio\": " << hitratio(r) << ",\n";
+        print_json_stats("frame_ms", r.t_frame, false);
+        print_json_stats("osmlayer_ms", r.t_osm, false);
+        print_json_stats("scalelayer_ms", r.t_scale, false);
+        print_json_stats("markerlayer_ms", r.t_marker, false);
+        std::cout << "      \"steps\": [\n";
+        for (std::size_t i=0;i<r.steps.size();i++)
+        {
+            const step_result& s = r.steps[i];
+            std::cout << "        {\"step\": \"" << s.text << "\", " <<
+                "\"ttff_ms\": " << s.ttff << ", " <<
+                "\"ttcv_ms\": " << s.ttcv << ", " <<
+                "\"complete\": " << (s.complete ? "true" : "false") << ", " <<
+                "\"frames\": " << s.frames << ", " <<
+                "\"tiles\": " << s.tiles << ", " <<
+                "\"misses\": " << s.misses << "}" <<
+                (((i+1) < r.steps.size()) ? "," : "") << "\n";
+        }
+        std::cout << "      ]\n";
+        std::cout << "    }" << (((p+1) < res.size()) ? "," : "") << "\n";
+    }
+
+    std::cout << "  ]\n";
+    std::cout << "}\n";
+}
+
+static void print_table(const std::vector<pass_result>& res)
+{
+    std::cout << std::fixed << std::setprecision(1);
+
+    for (std::size_t p=0;p<res.size();p++)
+    {
+        const pass_result& r = res[p];
+        std::cout << "Pass: " << r.name << std::endl;
+        std::cout << std::left << std::setw(26) << "  step" << std::right <<
+            std::setw(10) << "ttff ms" <<
+            std::setw(10) << "ttcv ms" <<
+            std::setw(8) << "frames" <<
+            std::setw(8) << "tiles" <<
+            std::setw(8) << "misses" << std::endl;
+
+        for (std::size_t i=0;i<r.steps.size();i++)
+        {
+            const step_result& s = r.steps[i];
+            std::cout << "  " << std::left << std::setw(24) << s.text << std::right <<
+                std::setw(10) << s.ttff;
+            if (s.complete)
+                std::cout << std::setw(10) << s.ttcv;
+            else
+                std::cout << std::setw(10) << "-";
+            std::cout << std::setw(8) << s.frames <<
+                std::setw(8) << s.tiles <<
+                std::setw(8) << s.misses << std::endl;
+        }
+
+        std::cout << "  duration " << r.duration << " ms, " <<
+            r.requests << " requests, " <<
+            r.bytes << " bytes, " <<
+            "hit ratio " << (hitratio(r) * 100.0) << "%" << std::endl;
+        std::cout << std::setprecision(3) <<
+            "  frame ms:       mean " << mean(r.t_frame) << ", p95 " << percentile(r.t_frame, 0.95) << ", max " << percentile(r.t_frame, 1.0) << std::endl <<
+            "  osmlayer ms:    mean " << mean(r.t_osm) << ", p95 " << percentile(r.t_osm, 0.95) << ", max " << percentile(r.t_osm, 1.0) << std::endl <<
+            "  scalelayer ms:  mean " << mean(r.t_scale) << ", p95 " << percentile(r.t_scale, 0.95) << ", max " << percentile(r.t_scale, 1.0) << std::endl <<
+            "  markerlayer ms: mean " << mean(r.t_marker) << ", p95 " << percentile(r.t_marker, 0.95) << ", max " << percentile(r.t_marker, 1.0) << std::endl <<
+            std::setprecision(1) << std::endl;
+    }
+}
+
+static void usage()
+{
+    std::cerr <<
+        "Usage: florb-mapbench [options]\n"
+        "\n"
+        "  -s FILE      Replay script, - for stdin, default: built-in script\n"
+        "  -d DIR       Keep the tile cache in DIR, default: temporary directory\n"
+        "  -i png|jpg   Tile image type (png)\n"
+        "  -l MS        Tile server latency (50)\n"
+        "  -r MS        Additional random latency of up to MS (0)\n"
+        "  -e SECONDS   Expires header of the tiles, relative to now (86400)\n"
+        "  -p N         Number of parallel downloads (2)\n"
+        "  -W PIXELS    Viewport width (800)\n"
+        "  -H PIXELS    Viewport height (600)\n"
+        "  -t SECONDS   Maximum time to wait for a complete viewport per step (30)\n"
+        "  -n N         Number of passes, the first one starts with an empty cache (2)\n"
+        "  -j           Print the results as JSON\n"
+        "  -S FILE      Write the tile pipeline statistics of all passes to FILE\n"
+        "  -T FILE      Record a Chrome trace of all passes to FILE\n"
+        "\n"
+        "Script commands, one per line:\n"
+        "  goto LON LAT ZOOM   Center the viewport, must be the first command\n"
+        "  move DX DY          Pan by pixels\n"
+        "  zoom ZOOM X Y       Zoom around a viewport pixel\n"
+        "  wait MS             Keep processing downloads without redrawing\n";
+}
+
+static bool parse(const std::vector<std::string>& args, options& opt)
+{
+    for (std::size_t i=0;i<args.size();i++)
+    {
+        const std::string& a = args[i];
+        bool ok = true;
+
+        if (a == "-j")
+            opt.json = true;
+        else if ((i+1) >= args.size())
+            ok = false;
+        else if (a == "-s")
+            opt.script = args[++i];
+        else if (a == "-d")
+            opt.cachedir = args[++i];
+        else if (a == "-S")
+            opt.stats = args[++i];
+        else if (a == "-T")
+            opt.trace = args[++i];
+        else if (a == "-i")
+        {
+            std::string t(args[++i]);
+            if (t == "png")
+                opt.type = florb::image::PNG;
+            else if (t == "jpg")
+                opt.type = florb::image::JPG;
+            else
+                ok = false;
+        }
+        else if (a == "-l")
+            ok = florb::utils::fromstr(args[++i], opt.latency);
+        else if (a == "-r")
+            ok = florb::utils::fromstr(args[++i], opt.jitter);
+        else if (a == "-e")
+            ok = florb::utils::fromstr(args[++i], opt.expires);
+        else if (a == "-p")
+            ok = florb::utils::fromstr(args[++i], opt.parallel) && (opt.parallel > 0);
+        else if (a == "-W")
+            ok = florb::utils::fromstr(args[++i], opt.w) && (opt.w > 0);
+        else if (a == "-H")
+            ok = florb::utils::fromstr(args[++i], opt.h) && (opt.h > 0);
+        else if (a == "-t")
+            ok = florb::utils::fromstr(args[++i], opt.timeout);
+        else if (a == "-n")
+            ok = florb::utils::fromstr(args[++i], opt.passes) && (opt.passes > 0);
+        else
+            ok = false;
+
+        if (!ok)
+            return false;
+    }
+
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<std::string> args(argv+1, argv+argc);
+
+    options opt;
+    if (!parse(args, opt))
+    {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    // Use a private configuration and tile cache, so neither the user's
+    // settings nor the user's tiles are touched
+    char tmpl[] = "/tmp/florb-mapbench-XXXXXX";
+    char *tmpdir = mkdtemp(tmpl);
+    if (!tmpdir)
+    {
+        std::cerr << "florb-mapbench: " << _("Failed to create temporary directory") << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    setenv("HOME", tmpdir, 1);
+    std::string cachedir(opt.cachedir.empty() ? (std::string(tmpdir) + "/tiles") : opt.cachedir);
+    {
+        florb::utils::mkdir(florb::utils::appdir());
+        std::ofstream cfg((florb::utils::appdir() + "/config").c_str());
+        cfg << "cache:\n  location: \"" << cachedir << "\"\n";
+    }
+
+    int ret = EXIT_SUCCESS;
+    curl_global_init(CURL_GLOBAL_ALL);
+    event_dispatch::handler(mainloop::awake);
+
+    try {
+        std::vector<step> script;
+        load_script(opt.script, script);
+
+        florb::settings::get_instance();
+        tileserver srv(opt.type, opt.latency, opt.jitter, opt.expires);
+
+        florb::trace::thread_name("mapbench");
+        florb::trace::enable(!opt.trace.empty());
+
+        std::vector<pass_result> res;
+        for (unsigned int p=0;p<opt.passes;p++)
+        {
+            std::ostringstream name;
+            name << ((p == 0) ? "cold" : "warm");
+            if (p > 1)
+                name << p;
+            res.push_back(run_pass(name.str(), script, opt, srv));
+        }
+
+        if (opt.json)
+            print_json(res, opt);
+        else
+            print_table(res);
+
+        if (!opt.stats.empty())
+            florb::tilestats::dump(opt.stats);
+
+        if (!opt.trace.empty())
+        {
+            florb::trace::enable(false);
+            florb::trace::dump(opt.trace);
+        }
+    } catch (std::exception& e) {
+        std::cerr << "florb-mapbench: " << e.what() << std::endl;
+        ret = EXIT_FAILURE;
+    }
+
+    event_dispatch::handler(NULL);
+    curl_global_cleanup();
+    florb::utils::rm(tmpdir);
+
+    return ret;
+}
+
@@ -0,0 +1,311 @@
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
+#include <png.h>
+#include "utils.hpp"
+#include "bitmap.hpp"
+
+// Columns of the printable ASCII characters 0x20 to 0x7e, LSB is the top row
+const unsigned char florb::bitmap::font5x7[][5] = {
+    {0x00,0x00,0x00,0x00,0x00}, {0x00,0x00,0x5f,0x00,0x00}, {0x00,0x07,0x00,0x07,0x00}, {0x14,0x7f,0x14,0x7f,0x14},
+    {0x24,0x2a,0x7f,0x2a,0x12}, {0x23,0x13,0x08,0x64,0x62}, {0x36,0x49,0x55,0x22,0x50}, {0x00,0x05,0x03,0x00,0x00},
+    {0x00,0x1c,0x22,0x41,0x00}, {0x00,0x41,0x22,0x1c,0x00}, {0x08,0x2a,0x1c,0x2a,0x08}, {0x08,0x08,0x3e,0x08,0x08},
+    {0x00,0x50,0x30,0x00,0x00}, {0x08,0x08,0x08,0x08,0x08}, {0x00,0x60,0x60,0x00,0x00}, {0x20,0x10,0x08,0x04,0x02},
+    {0x3e,0x51,0x49,0x45,0x3e}, {0x00,0x42,0x7f,0x40,0x00}, {0x42,0x61,0x51,0x49,0x46}, {0x21,0x41,0x45,0x4b,0x31},
+    {0x18,0x14,0x12,0x7f,0x10}, {0x27,0x45,0x45,0x45,0x39}, {0x3c,0x4a,0x49,0x49,0x30}, {0x01,0x71,0x09,0x05,0x03},
+    {0x36,0x49,0x49,0x49,0x36}, {0x06,0x49,0x49,0x29,0x1e}, {0x00,0x36,0x36,0x00,0x00}, {0x00,0x56,0x36,0x00,0x00},
+    {0x08,0x14,0x22,0x41,0x00}, {0x14,0x14,0x14,0x14,0x14}, {0x00,0x41,0x22,0x14,0x08}, {0x02,0x01,0x51,0x09,0x06},
+    {0x32,0x49,0x79,0x41,0x3e}, {0x7e,0x11,0x11,0x11,0x7e}, {0x7f,0x49,0x49,0x49,0x36}, {0x3e,0x41,0x41,0x41,0x22},
+    {0x7f,0x41,0x41,0x22,0x1c}, {0x7f,0x49,0x49,0x49,0x41}, {0x7f,0x09,0x09,0x09,0x01}, {0x3e,0x41,0x49,0x49,0x7a},
+    {0x7f,0x08,0x08,0x08,0x7f}, {0x00,0x41,0x7f,0x41,0x00}, {0x20,0x40,0x41,0x3f,0x01}, {0x7f,0x08,0x14,0x22,0x41},
+    {0x7f,0x40,0x40,0x40,0x40}, {0x7f,0x02,0x0c,0x02,0x7f}, {0x7f,0x04,0x08,0x10,0x7f}, {0x3e,0x41,0x41,0x41,0x3e},
+    {0x7f,0x09,0x09,0x09,0x06}, {0x3e,0x41,0x51,0x21,0x5e}, {0x7f,0x09,0x19,0x29,0x46}, {0x46,0x49,0x49,0x49,0x31},
+    {0x01,0x01,0x7f,0x01,0x01}, {0x3f,0x40,0x40,0x40,0x3f}, {0x1f,0x20,0x40,0x20,0x1f}, {0x3f,0x40,0x38,0x40,0x3f},
+    {0x63,0x14,0x08,0x14,0x63}, {0x07,0x08,0x70,0x08,0x07}, {0x61,0x51,0x49,0x45,0x43}, {0x00,0x7f,0x41,0x41,0x00},
+    {0x02,0x04,0x08,0x10,0x20}, {0x00,0x41,0x41,0x7f,0x00}, {0x04,0x02,0x01,0x02,0x04}, {0x40,0x40,0x40,0x40,0x40},
+    {0x00,0x01,0x02,0x04,0x00}, {0x20,0x54,0x54,0x54,0x78}, {0x7f,0x48,0x44,0x44,0x38}, {0x38,0x44,0x44,0x44,0x20},
+    {0x38,0x44,0x44,0x48,0x7f}, {0x38,0x54,0x54,0x54,0x18}, {0x08,0x7e,0x09,0x01,0x02}, {0x0c,0x52,0x52,0x52,0x3e},
+    {0x7f,0x08,0x04,0x04,0x78}, {0x00,0x44,0x7d,0x40,0x00}, {0x20,0x40,0x44,0x3d,0x00}, {0x7f,0x10,0x28,0x44,0x00},
+    {0x00,0x41,0x7f,0x40,0x00}, {0x7c,0x04,0x18,0x04,0x78}, {0x7c,0x08,0x04,0x04,0x78}, {0x38,0x44,0x44,0x44,0x38},
+    {0x7c,0x14,0x14,0x14,0x08}, {0x08,0x14,0x14,0x18,0x7c}, {0x7c,0x08,0x04,0x04,0x08}, {0x48,0x54,0x54,0x54,0x20},
+    {0x04,0x3f,0x44,0x40,0x20}, {0x3c,0x40,0x40,0x20,0x7c}, {0x1c,0x20,0x40,0x20,0x1c}, {0x3c,0x40,0x30,0x40,0x3c},
+    {0x44,0x28,0x10,0x28,0x44}, {0x0c,0x50,0x50,0x50,0x3c}, {0x44,0x64,0x54,0x4c,0x44}, {0x00,0x08,0x36,0x41,0x00},
+    {0x00,0x00,0x7f,0x00,0x00}, {0x00,0x41,0x36,0x08,0x00}, {0x08,0x04,0x08,0x10,0x08}
+};
+
+florb::bitmap::bitmap(unsigned int w, unsigned int h) :
+    m_w(w),
+    m_h(h),
+    m_buf(w*h*4, 0xff),
+    m_fontscale(1),
+    m_fgcolor(0xffffff),
+    m_bgcolor(0x000000)
+{
+};
+
+florb::bitmap::~bitmap()
+{
+};
+
+void florb::bitmap::fgcolor(color c)
+{
+    m_fgcolor = c;
+};
+
+void florb::bitmap::bgcolor(color c)
+{
+    m_bgcolor = c;
+};
+
+florb::color florb::bitmap::fgcolor()
+{
+    return m_fgcolor;
+};
+
+florb::color florb::bitmap::bgcolor()
+{
+    return m_bgcolor;
+};
+
+void florb::bitmap::pixel(int x, int y, unsigned char r, unsigned char g, unsigned char b, unsigned char a)
+{
+    if ((x < 0) || (y < 0) || (x >= (int)m_w) || (y >= (int)m_h))
+        return;
+
+    unsigned char *p = &m_buf[((y*m_w)+x)*4];
+
+    // Blend over the existing pixel, the result stays opaque
+    if (a == 0xff)
+    {
+        p[0] = r; p[1] = g; p[2] = b;
+    }
+    else if (a != 0)
+    {
+        p[0] = (unsigned char)(((r*a) + (p[0]*(255-a)) + 127) / 255);
+        p[1] = (unsigned char)(((g*a) + (p[1]*(255-a)) + 127) / 255);
+        p[2] = (unsigned char)(((b*a) + (p[2]*(255-a)) + 127) / 255);
+    }
+
+    p[3] = 0xff;
+}
+
+void florb::bitmap::pixel(int x, int y)
+{
+    pixel(x, y, m_fgcolor.r(), m_fgcolor.g(), m_fgcolor.b(), 0xff);
+}
+
+void florb::bitmap::dot(int x, int y, int size)
+{
+    if (size <= 1)
+    {
+        pixel(x, y);
+        return;
+    }
+
+    // Square brush centered on (x, y)
+    int o = size/2;
+    for (int dy=0;dy<size;dy++)
+        for (int dx=0;dx<size;dx++)
+            pixel(x-o+dx, y-o+dy);
+}
+
+void florb::bitmap::draw(image &src, int dstx, int dsty)
+{
+    const unsigned char *data = src.data();
+    if ((!data) || (src.w() <= 0) || (src.h() <= 0))
+        return;
+
+    int d = src.d();
+    int ld = src.w()*d;
+
+    // Only visit the part of the image that ends up on the bitmap
+    int x0 = (dstx < 0) ? -dstx : 0;
+    int y0 = (dsty < 0) ? -dsty : 0;
+    int x1 = ((dstx + src.w()) > (int)m_w) ? ((int)m_w - dstx) : src.w();
+    int y1 = ((dsty + src.h()) > (int)m_h) ? ((int)m_h - dsty) : src.h();
+
+    for (int y=y0;y<y1;y++)
+    {
+        const unsigned char *row = data + (y*ld);
+        for (int x=x0;x<x1;x++)
+        {
+            const unsigned char *s = row + (x*d);
+            pixel(dstx+x, dsty+y, s[0], s[1], s[2], (d == 4) ? s[3] : 0xff);
+        }
+    }
+}
+
+void florb::bitmap::fillrect(int x, int y, int w, int h)
+{
+    int x1 = (x < 0) ? 0 : x;
+    int y1 = (y < 0) ? 0 : y;
+    int x2 = ((x+w) > (int)m_w) ? (int)m_w : (x+w);
+    int y2 = ((y+h) > (int)m_h) ? (int)m_h : (y+h);
+
+    for (int py=y1;py<y2;py++)
+        for (int px=x1;px<x2;px++)
+            pixel(px, py);
+}
+
+void florb::bitmap::rect(int x, int y, int w, int h)
+{
+    if ((w <= 0) || (h <= 0))
+        return;
+
+    for (int px=x;px<(x+w);px++)
+    {
+        pixel(px, y);
+        pixel(px, y+h-1);
+    }
+
+    for (int py=y;py<(y+h);py++)
+    {
+        pixel(x, py);
+        pixel(x+w-1, py);
+    }
+}
+
+void florb::bitmap::line(int x1, int y1, int x2, int y2, int linewidth)
+{
+    // Bresenham
+    int dx = std::abs(x2-x1), sx = (x1 < x2) ? 1 : -1;
+    int dy = -std::abs(y2-y1), sy = (y1 < y2) ? 1 : -1;
+    int err = dx+dy;
+
+    for (;;)
+    {
+        dot(x1, y1, linewidth);
+
+        if ((x1 == x2) && (y1 == y2))
+            break;
+
+        int e2 = 2*err;
+        if (e2 >= dy)
+        {
+            err += dy;
+            x1 += sx;
+        }
+        if (e2 <= dx)
+        {
+            err += dx;
+            y1 += sy;
+        }
+    }
+}
+
+void florb::bitmap::circle(double x, double y, double r)
+{
+    // Midpoint circle, outline only
+    int cx = (int)floor(x+0.5), cy = (int)floor(y+0.5);
+    int px = (int)floor(r+0.5), py = 0;
+    int err = 1-px;
+
+    while (px >= py)
+    {
+        pixel(cx+px, cy+py); pixel(cx-px, cy+py);
+        pixel(cx+px, cy-py); pixel(cx-px, cy-py);
+        pixel(cx+py, cy+px); pixel(cx-py, cy+px);
+        pixel(cx+py, cy-px); pixel(cx-py, cy-px);
+
+        py++;
+        if (err < 0)
+            err += (2*py)+1;
+        else
+        {
+            px--;
+            err += (2*(py-px))+1;
+        }
+    }
+}
+
+void florb::bitmap::fontsize(int s)
+{
+    // The built-in font is 8 pixels high including spacing
+    m_fontscale = (s+4)/8;
+    if (m_fontscale < 1)
+        m_fontscale = 1;
+}
+
+void florb::bitmap::text(const std::string & txt, int x, int y)
+{
+    int s = m_fontscale;
+
+    for (std::size_t i=0;i<txt.size();i++)
+    {
+        unsigned char c = (unsigned char)txt[i];
+
+        // Skip UTF-8 continuation bytes, anything outside ASCII becomes '?'
+        if ((c & 0xc0) == 0x80)
+            continue;
+        if ((c < 0x20) || (c > 0x7e))
+            c = '?';
+
+        const unsigned char *glyph = font5x7[c-0x20];
+        for (int col=0;col<5;col++)
+        {
+            for (int row=0;row<7;row++)
+            {
+                if ((glyph[col] & (1 << row)) == 0)
+                    continue;
+
+                for (int dy=0;dy<s;dy++)
+                    for (int dx=0;dx<s;dx++)
+                        pixel(x+(col*s)+dx, y+(row*s)+dy);
+            }
+        }
+
+        x += 6*s;
+    }
+}
+
+void florb::bitmap::save_png(const std::string& path)
+{
+    FILE *fp = NULL;
+    png_structp png = NULL;
+    png_infop info = NULL;
+    int rc = -1;
+
+    for (;;)
+    {
+        fp = fopen(path.c_str(), "wb");
+        if (!fp)
+            break;
+
+        png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+        if (!png)
+            break;
+
+        info = png_create_info_struct(png);
+        if (!info)
+            break;
+
+        // libpng error handling
+        if (setjmp(png_jmpbuf(png)))
+            break;
+
+        png_init_io(png, fp);
+        png_set_IHDR(png, info, m_w, m_h, 8,
+                PNG_COLOR_TYPE_RGB_ALPHA,
+                PNG_INTERLACE_NONE,
+                PNG_COMPRESSION_TYPE_DEFAULT,
+                PNG_FILTER_TYPE_DEFAULT);
+        png_write_info(png, info);
+
+        for (unsigned int y=0;y<m_h;y++)
+            png_write_row(png, const_cast<png_bytep>(&m_buf[y*m_w*4]));
+
+        png_write_end(png, NULL);
+        rc = 0;
+
+        break;
+    }
+
+    if (png)
+        png_destroy_write_struct(&png, (info != NULL) ? &info : NULL);
+    if (fp)
+        fclose(fp);
+
+    if (rc != 0)
+        throw std::runtime_error(_("Failed to write PNG image"));
+}
+
@@ -0,0 +1,56 @@
+#ifndef BITMAP_HPP
+#define BITMAP_HPP
+
+#include <string>
+#include <vector>
+#include "gfx.hpp"
+
+namespace florb
+{
+    // A software RGBA drawing buffer. Unlike florb::canvas it does not need a
+    // display connection, so it can be used to render maps on a headless
+    // machine.
+    class bitmap : public drawable
+    {
+        public:
+            bitmap(unsigned int w, unsigned int h);
+            ~bitmap();
+
+            void fgcolor(color fg);
+            void bgcolor(color bg);
+            color fgcolor();
+            color bgcolor();
+            void draw(image &src, int dstx, int dsty);
+            void fillrect(int x, int y, int w, int h);
+            void rect(int x, int y, int w, int h);
+            void line(int x1, int y1, int x2, int y2, int linewidth);
+            void circle(double x, double y, double r);
+            unsigned int w(void) { return m_w; };
+            unsigned int h(void) { return m_h; };
+            void fontsize(int s);
+            void text(const std::string & txt, int x, int y);
+
+            // Raw pixel data, 4 bytes (RGBA) per pixel, row by row
+            const std::vector<unsigned char>& buf() const { return m_buf; };
+            void save_png(const std::string& path);
+
+        private:
+            // Built-in 5x7 pixel font for printable ASCII characters
+            static const unsigned char font5x7[][5];
+
+            void pixel(int x, int y);
+            void pixel(int x, int y, unsigned char r, unsigned char g, unsigned char b, unsigned char a);
+            void dot(int x, int y, int size);
+
+            unsigned int m_w;
+            unsigned int m_h;
+            std::vector<unsigned char> m_buf;
+            int m_fontscale;
+
+            color m_fgcolor;
+            color m_bgcolor;
+    };
+};
+
+#endif // BITMAP_HPP
+
@@ -0,0 +1,68 @@
+#include <boost/interprocess/sync/interprocess_mutex.hpp>
+#include "bufferpool.hpp"
+
+// Buffers kept at most, a few per download thread
+#define POOLSIZE                (64)
+
+// Larger buffers are freed, they would tie up memory for rare big tiles
+#define POOLBUFMAX              (1024*1024)
+
+namespace
+{
+    boost::interprocess::interprocess_mutex s_mutex;
+    std::vector<std::vector<char> > s_pool;
+}
+
+void florb::bufferpool::get(std::vector<char>& buf, std::size_t capacity)
+{
+    std::vector<char> tmp;
+
+    s_mutex.lock();
+    if (!s_pool.empty())
+    {
+        tmp.swap(s_pool.back());
+        s_pool.pop_back();
+    }
+    s_mutex.unlock();
+
+    put(buf);
+
+    buf.swap(tmp);
+    if (buf.capacity() < capacity)
+        buf.reserve(capacity);
+}
+
+void florb::bufferpool::put(std::vector<char>& buf)
+{
+    buf.clear();
+
+    if ((buf.capacity() == 0) || (buf.capacity() > POOLBUFMAX))
+    {
+        std::vector<char>().swap(buf);
+        return;
+    }
+
+    s_mutex.lock();
+    if (s_pool.size() < POOLSIZE)
+    {
+        // Never reallocate the pool itself
+        if (s_pool.capacity() < POOLSIZE)
+            s_pool.reserve(POOLSIZE);
+
+        s_pool.push_back(std::vector<char>());
+        s_pool.back().swap(buf);
+    }
+    s_mutex.unlock();
+
+    // Pool full
+    std::vector<char>().swap(buf);
+}
+
+std::size_t florb::bufferpool::size()
+{
+    s_mutex.lock();
+    std::size_t ret = s_pool.size();
+    s_mutex.unlock();
+
+    return ret;
+}
@@ -0,0 +1,29 @@
+#ifndef BUFFERPOOL_HPP
+#define BUFFERPOOL_HPP
+
+#include <cstddef>
+#include <vector>
+
+namespace florb
+{
+    // Process-wide pool of byte buffers for tile data. Buffers handed back
+    // keep their memory, so a steady stream of tiles of similar size does
+    // not allocate. Buffers which never come back are simply freed.
+    class bufferpool
+    {
+        public:
+            // Replace buf with an empty buffer of at least the given
+            // capacity. The memory buf had goes to the pool.
+            static void get(std::vector<char>& buf, std::size_t capacity);
+
+            // Hand the memory of buf over to the pool, buf is empty
+            // afterwards
+            static void put(std::vector<char>& buf);
+
+            // Buffers currently in the pool
+            static std::size_t size();
+    };
+};
+
+#endif // BUFFERPOOL_HPP
+
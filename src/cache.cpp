@@ -2,16 +2,1287 @@
 #include <cstring>
 #include <iostream>
 #include <fstream>
+#include <cstdio>
+#include <map>
+#include <set>
+#include <atomic>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
+#include <deque>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <boost/thread.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/interprocess/sync/interprocess_mutex.hpp>
+#include <boost/interprocess/sync/interprocess_semaphore.hpp>
 #include "settings.hpp"
 #include "cache.hpp"
 #include "utils.hpp"
+#include "trace.hpp"
+#include "bufferpool.hpp"
 
 const std::string florb::cache::dbextension = ".dat";
 
+// Seconds between two eviction passes
+#define EVICTINTERVAL           (5)
+
+// Files removed between two short pauses, eviction should not compete with
+// tile I/O of the map
+#define EVICTBATCH              (64)
+
+// Eviction goes below the quota by this much so it does not run again
+// right after the next download
+#define LOWWATER                (0.9)
+
+// Tile index journal in every cache directory
+#define JOURNAL                 "journal"
+
+// Records beyond twice the number of tiles before the journal gets rewritten
+#define JOURNALSLACK            (1024)
+
+// Tiles up to this size are stored once per content in the blob directory.
+// Identical tiles (sea, empty land, transparent overlay tiles) are all small.
+#define DEDUPMAX                (4096)
+#define BLOBDIR                 "blobs"
+
+// Tiles written by the writer thread in one go
+#define WRITEBATCH              (64)
+
+// Metadata of every tile in a cache directory. Stores are shared by all cache
+// instances of the same directory. The index is loaded from an append-only
+// journal on first use, directories without a complete journal are indexed
+// by a scan in the eviction thread, which keeps them within the quota
+// afterwards. Other processes using the same directory append to the same
+// journal, their tiles show up in the index with the next commit. Changes
+// are journaled in batches, one per writer batch, scan chunk or eviction
+// pass, so the journal lock is not taken for every single tile.
+//
+// A tile is either a file of its own, a reference to a blob shared by all
+// tiles with the same content, or nothing at all if it is empty. New tiles
+// are pending until the writer thread has stored them, lookups find them
+// in memory until then.
+class florb::cache::store
+{
+    public:
+        struct entry
+        {
+            uint64_t size;
+            time_t expires;
+            time_t atime;
+            time_t modified;
+            uint64_t hash;              // Blob of the tile, 0 for a file of its own
+            std::string etag;
+        };
+
+        struct blob
+        {
+            uint64_t size;
+            uint64_t refs;
+        };
+
+        struct pending
+        {
+            std::shared_ptr<const std::vector<char> > buf;
+            time_t expires;
+            time_t modified;
+            std::string etag;
+            uint64_t seq;
+        };
+
+        store(const std::string& dir, const std::string& ext) :
+            m_dir(dir),
+            m_ext(ext),
+            m_sep(florb::utils::pathsep()),
+            m_refs(1),
+            m_loaded(false),
+            m_scanned(false),
+            m_records(0),
+            m_seq(0),
+            m_queued(0),
+            m_bytes(0),
+            m_saved(0),
+            m_quota(0),
+            m_hits(0),
+            m_misses(0),
+            m_expired(0),
+            m_evictions(0),
+            m_evicted(0),
+            m_fd(-1),
+            m_offset(0) {};
+
+        ~store()
+        {
+            commit();
+            if (m_fd >= 0)
+                close(m_fd);
+        }
+
+        // Read the journal, only the first call does anything
+        void load();
+
+        // Size, expiry and blob of a tile, false if there is none
+        bool lookup(uint64_t key, uint64_t& size, time_t& expires, uint64_t& hash)
+        {
+            bool ret = false;
+
+            m_mutex.lock();
+            std::unordered_map<uint64_t, pending>::iterator pit = m_pending.find(key);
+            std::unordered_map<uint64_t, entry>::iterator it = m_index.find(key);
+            if (pit != m_pending.end())
+            {
+                size = pit->second.buf->size();
+                expires = pit->second.expires;
+                hash = 0;
+                ret = true;
+            }
+            else if (it != m_index.end())
+            {
+                size = it->second.size;
+                expires = it->second.expires;
+                hash = it->second.hash;
+                ret = true;
+            }
+            m_mutex.unlock();
+
+            return ret;
+        }
+
+        // ETag and last modification of a tile as sent by the server
+        bool validators(uint64_t key, std::string& etag, time_t& modified)
+        {
+            bool ret = false;
+
+            m_mutex.lock();
+            std::unordered_map<uint64_t, pending>::iterator pit = m_pending.find(key);
+            std::unordered_map<uint64_t, entry>::iterator it = m_index.find(key);
+            if (pit != m_pending.end())
+            {
+                etag = pit->second.etag;
+                modified = pit->second.modified;
+                ret = (pit->second.buf->size() > 0);
+            }
+            else if ((it != m_index.end()) && (it->second.size > 0))
+            {
+                etag = it->second.etag;
+                modified = it->second.modified;
+                ret = true;
+            }
+            m_mutex.unlock();
+
+            return ret;
+        }
+
+        // A tile was read, the last use is not journaled but survives
+        // replays of the journal
+        void touch(uint64_t key, uint64_t size, time_t atime)
+        {
+            m_mutex.lock();
+            std::unordered_map<uint64_t, entry>::iterator it = m_index.find(key);
+            if (it != m_index.end())
+            {
+                // Blobs never change
+                if (it->second.hash == 0)
+                {
+                    m_bytes -= it->second.size;
+                    m_bytes += size;
+                    it->second.size = size;
+                }
+                it->second.atime = atime;
+            }
+            m_mutex.unlock();
+        }
+
+        // Hand a tile over to the writer thread
+        void queue(uint64_t key, std::vector<char>&& buf, time_t expires, const std::string& etag, time_t modified)
+        {
+            std::shared_ptr<const std::vector<char> > data(
+                    new std::vector<char>(std::move(buf)), recycle);
+
+            m_mutex.lock();
+            pending& p = m_pending[key];
+            p.buf = data;
+            p.expires = expires;
+            p.modified = modified;
+            p.etag = etag;
+            p.seq = ++m_seq;
+            m_mutex.unlock();
+
+            m_queued++;
+        }
+
+        // Deleter of queued buffers, the memory goes back to the buffer
+        // pool once the writer and all readers are done with it
+        static void recycle(const std::vector<char> *buf)
+        {
+            std::vector<char> *b = const_cast<std::vector<char>*>(buf);
+            florb::bufferpool::put(*b);
+            delete b;
+        }
+
+        // A tile not written yet, false if there is none
+        bool unwritten(uint64_t key, pending& p)
+        {
+            bool ret = false;
+
+            m_mutex.lock();
+            std::unordered_map<uint64_t, pending>::iterator it = m_pending.find(key);
+            if (it != m_pending.end())
+            {
+                p = it->second;
+                ret = true;
+            }
+            m_mutex.unlock();
+
+            return ret;
+        }
+
+        // The writer is done with a tile, seq tells whether it was replaced
+        // in the meantime
+        void written(uint64_t key, uint64_t seq)
+        {
+            m_mutex.lock();
+            std::unordered_map<uint64_t, pending>::iterator it = m_pending.find(key);
+            if ((it != m_pending.end()) && (it->second.seq == seq))
+                m_pending.erase(it);
+            m_mutex.unlock();
+        }
+
+        // Whether a blob is in use
+        bool shared(uint64_t hash)
+        {
+            m_mutex.lock();
+            bool ret = (m_blobs.find(hash) != m_blobs.end());
+            m_mutex.unlock();
+
+            return ret;
+        }
+
+        // A tile was written, returns a file which is no longer used by it
+        // or an empty string
+        std::string stored(uint64_t key, uint64_t size, time_t expires, const std::string& etag,
+                time_t modified, uint64_t hash, time_t atime)
+        {
+            std::string ret;
+
+            m_mutex.lock();
+            std::unordered_map<uint64_t, entry>::iterator it = m_index.find(key);
+            if (it != m_index.end())
+            {
+                // A file of its own is replaced in place
+                if (release(it->second) && ((it->second.hash != 0) || (hash != 0) || (size == 0)))
+                    ret = file(key, it->second.hash);
+            }
+
+            entry& e = m_index[key];
+            e.size = size;
+            e.expires = expires;
+            e.atime = atime;
+            e.modified = modified;
+            e.hash = hash;
+            e.etag = etag;
+            acquire(e);
+            append(key, e);
+            m_mutex.unlock();
+
+            // The blob may be the very same one again
+            if ((hash != 0) && (ret == file(key, hash)))
+                ret.clear();
+
+            return ret;
+        }
+
+        // A tile was revalidated, returns false if there is none
+        bool refreshed(uint64_t key, time_t expires, time_t atime)
+        {
+            bool ret = false;
+
+            m_mutex.lock();
+            std::unordered_map<uint64_t, pending>::iterator pit = m_pending.find(key);
+            if (pit != m_pending.end())
+            {
+                pit->second.expires = expires;
+                ret = true;
+            }
+
+            std::unordered_map<uint64_t, entry>::iterator it = m_index.find(key);
+            if (it != m_index.end())
+            {
+                it->second.expires = expires;
+                it->second.atime = atime;
+                append(key, it->second);
+                ret = true;
+            }
+            m_mutex.unlock();
+
+            return ret;
+        }
+
+        // A tile found on disk, entries from stored() are newer
+        void found(uint64_t key, uint64_t size, time_t expires, time_t atime)
+        {
+            m_mutex.lock();
+            if (m_index.find(key) == m_index.end())
+            {
+                entry& e = m_index[key];
+                e.size = size;
+                e.expires = expires;
+                e.atime = atime;
+                e.modified = 0;
+                e.hash = 0;
+                acquire(e);
+                append(key, e);
+            }
+            m_mutex.unlock();
+        }
+
+        // Forget a tile, returns false if it was used after atime. Files
+        // are what the caller has to remove, freed is their size.
+        bool forget(uint64_t key, time_t atime, uint64_t& freed, std::vector<std::string>& files)
+        {
+            bool ret = false;
+            freed = 0;
+
+            m_mutex.lock();
+            std::unordered_map<uint64_t, entry>::iterator it = m_index.find(key);
+            if ((it != m_index.end()) && (it->second.atime <= atime))
+            {
+                if (release(it->second))
+                {
+                    freed = it->second.size;
+                    files.push_back(file(key, it->second.hash));
+
+                    // Sidecar of earlier versions
+                    if (it->second.hash == 0)
+                        files.push_back(files.back() + ".dat");
+                }
+
+                m_index.erase(it);
+                append(key);
+                ret = true;
+            }
+            m_mutex.unlock();
+
+            return ret;
+        }
+
+        // The initial scan has indexed all tiles on disk
+        void complete()
+        {
+            m_mutex.lock();
+            m_journal += "S\n";
+            m_scanned = true;
+            m_mutex.unlock();
+
+            commit();
+        }
+
+        // Journal the changes since the last commit under a single lock
+        void commit();
+
+        std::string path(uint64_t key) const
+        {
+            char tail[64];
+            const char *sep = m_sep.c_str();
+            snprintf(tail, sizeof(tail), "%s%u%s%u%s%u",
+                    sep, (unsigned int)(key >> 58),
+                    sep, (unsigned int)((key >> 29) & ((1ULL << 29) - 1)),
+                    sep, (unsigned int)(key & ((1ULL << 29) - 1)));
+            return m_dir + tail + m_ext;
+        }
+
+        std::string file(uint64_t key, uint64_t hash) const
+        {
+            if (hash == 0)
+                return path(key);
+
+            char tail[32];
+            snprintf(tail, sizeof(tail), "%s%016llx", m_sep.c_str(), (unsigned long long)hash);
+            return m_dir + m_sep + BLOBDIR + tail;
+        }
+
+        static uint64_t key(int z, int x, int y)
+        {
+            return ((uint64_t)z << 58) | ((uint64_t)x << 29) | (uint64_t)y;
+        }
+
+        boost::interprocess::interprocess_mutex m_mutex;
+        std::unordered_map<uint64_t, entry> m_index;
+        std::unordered_map<uint64_t, blob> m_blobs;
+        std::unordered_map<uint64_t, pending> m_pending;
+        std::string m_dir;
+        std::string m_ext;
+        std::string m_sep;
+
+        // Cache instances using this store, guarded by the registry mutex
+        int m_refs;
+
+        std::atomic<bool> m_loaded;
+        std::atomic<bool> m_scanned;
+        uint64_t m_records;
+        uint64_t m_seq;
+
+        // Tiles queued for the writer thread and not handled yet
+        std::atomic<uint64_t> m_queued;
+
+        uint64_t m_bytes;
+        uint64_t m_saved;
+        std::atomic<uint64_t> m_quota;
+        std::atomic<uint64_t> m_hits;
+        std::atomic<uint64_t> m_misses;
+        std::atomic<uint64_t> m_expired;
+        std::atomic<uint64_t> m_evictions;
+        std::atomic<uint64_t> m_evicted;
+
+    private:
+        // Account for a new tile, called with the mutex held
+        void acquire(const entry& e)
+        {
+            if (e.hash == 0)
+            {
+                m_bytes += e.size;
+                return;
+            }
+
+            blob& b = m_blobs[e.hash];
+            if (b.refs++ == 0)
+            {
+                b.size = e.size;
+                m_bytes += e.size;
+            }
+            else
+            {
+                m_saved += e.size;
+            }
+        }
+
+        // Account for a tile which is gone, true if its file is not in use
+        // any more. Called with the mutex held.
+        bool release(const entry& e)
+        {
+            if (e.hash == 0)
+            {
+                m_bytes -= e.size;
+                return true;
+            }
+
+            std::unordered_map<uint64_t, blob>::iterator it = m_blobs.find(e.hash);
+            if (it == m_blobs.end())
+                return false;
+
+            if (--(it->second.refs) > 0)
+            {
+                m_saved -= it->second.size;
+                return false;
+            }
+
+            m_bytes -= it->second.size;
+            m_blobs.erase(it);
+            return true;
+        }
+
+        std::string journal() const
+        {
+            return m_dir + florb::utils::pathsep() + JOURNAL;
+        }
+
+        // Journal records
+        static std::string record(uint64_t key, const entry& e)
+        {
+            char rec[160];
+            snprintf(rec, sizeof(rec), "P %u %u %u %llu %lld %lld %lld %llx ",
+                    (unsigned int)(key >> 58), (unsigned int)((key >> 29) & ((1ULL << 29) - 1)),
+                    (unsigned int)(key & ((1ULL << 29) - 1)), (unsigned long long)e.size,
+                    (long long)e.expires, (long long)e.atime, (long long)e.modified,
+                    (unsigned long long)e.hash);
+            return std::string(rec) + e.etag + '\n';
+        }
+
+        static std::string record(uint64_t key)
+        {
+            char rec[64];
+            snprintf(rec, sizeof(rec), "D %u %u %u\n",
+                    (unsigned int)(key >> 58), (unsigned int)((key >> 29) & ((1ULL << 29) - 1)),
+                    (unsigned int)(key & ((1ULL << 29) - 1)));
+            return rec;
+        }
+
+        // Queue a record for the next commit, called with the mutex held
+        void append(uint64_t key, const entry& e)
+        {
+            m_journal += record(key, e);
+            m_dirty.insert(key);
+        }
+
+        void append(uint64_t key)
+        {
+            m_journal += record(key);
+            m_dirty.insert(key);
+        }
+
+        // Apply journal records to the index. Tiles with uncommitted
+        // changes keep them, our records go to the journal after these.
+        void replay(std::istream& in);
+
+        // The journal is shared with other processes using the same
+        // directory. Appends and compaction happen under an exclusive
+        // flock(), which also brings the index up to date with the records
+        // of the other processes. Called with the mutex held, false if
+        // there is no journal.
+        bool lockjournal();
+        void unlockjournal();
+
+        // Append records, called with the journal locked
+        bool write(const std::string& rec);
+
+        // Rewrite the journal with one record per tile, called with the
+        // journal locked
+        void compact();
+
+        // Journal, opened for appending, and how far it has been read
+        int m_fd;
+        off_t m_offset;
+
+        // Records not journaled yet and the tiles they are about
+        std::string m_journal;
+        std::unordered_set<uint64_t> m_dirty;
+};
+
+void florb::cache::store::load()
+{
+    if (m_loaded)
+        return;
+
+    FLORB_TRACE("cache::load", "cache");
+
+    m_mutex.lock();
+
+    if (!m_loaded)
+    {
+        m_fd = open(journal().c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+
+        // Reads everything other processes have written so far
+        if (lockjournal())
+        {
+            if (m_records > (2 * m_index.size()) + JOURNALSLACK)
+                compact();
+
+            unlockjournal();
+        }
+
+        m_loaded = true;
+    }
+
+    m_mutex.unlock();
+}
+
+void florb::cache::store::replay(std::istream& in)
+{
+    // Records are "P z x y size expires atime modified hash etag",
+    // "D z x y" and "S" once the directory has been scanned completely.
+    // A record cut short by a crash is skipped.
+    std::string line;
+    while (std::getline(in, line))
+    {
+        m_records++;
+
+        unsigned int z, x, y;
+        unsigned long long size, hash;
+        long long expires, atime, modified;
+        int n = 0;
+
+        if (line.compare(0, 2, "P ") == 0)
+        {
+            if ((sscanf(line.c_str(), "P %u %u %u %llu %lld %lld %lld %llx %n",
+                            &z, &x, &y, &size, &expires, &atime, &modified, &hash, &n) < 8) ||
+                (n == 0))
+                continue;
+
+            uint64_t key = florb::cache::store::key(z, x, y);
+            if (m_dirty.find(key) != m_dirty.end())
+                continue;
+
+            // Reads are not journaled, keep the last use known here
+            std::unordered_map<uint64_t, entry>::iterator it = m_index.find(key);
+            if (it != m_index.end())
+            {
+                release(it->second);
+                atime = std::max(atime, (long long)it->second.atime);
+            }
+
+            entry& e = m_index[key];
+            e.size = size;
+            e.expires = expires;
+            e.atime = atime;
+            e.modified = modified;
+            e.hash = hash;
+            e.etag = line.substr(n);
+            acquire(e);
+        }
+        else if (line.compare(0, 2, "D ") == 0)
+        {
+            if (sscanf(line.c_str(), "D %u %u %u", &z, &x, &y) != 3)
+                continue;
+
+            uint64_t key = florb::cache::store::key(z, x, y);
+            if (m_dirty.find(key) != m_dirty.end())
+                continue;
+
+            std::unordered_map<uint64_t, entry>::iterator it = m_index.find(key);
+            if (it != m_index.end())
+            {
+                release(it->second);
+                m_index.erase(it);
+            }
+        }
+        else if (line == "S")
+        {
+            m_scanned = true;
+        }
+    }
+}
+
+bool florb::cache::store::lockjournal()
+{
+    // Last uses of the tiles dropped for a replaced journal
+    std::unordered_map<uint64_t, time_t> atimes;
+
+    while (m_fd >= 0)
+    {
+        if (flock(m_fd, LOCK_EX) != 0)
+            return false;
+
+        struct stat sfd, spath;
+        if (fstat(m_fd, &sfd) != 0)
+            break;
+
+        // Still the journal in the directory, read what other processes
+        // appended since we last looked
+        if ((stat(journal().c_str(), &spath) == 0) &&
+            (spath.st_dev == sfd.st_dev) && (spath.st_ino == sfd.st_ino))
+        {
+            if (sfd.st_size > m_offset)
+            {
+                std::ifstream in(journal().c_str(), std::ios::in);
+                in.seekg(m_offset);
+                replay(in);
+            }
+
+            std::unordered_map<uint64_t, time_t>::iterator ait;
+            for (ait=atimes.begin();ait!=atimes.end();++ait)
+            {
+                std::unordered_map<uint64_t, entry>::iterator it = m_index.find(ait->first);
+                if ((it != m_index.end()) && (it->second.atime < ait->second))
+                    it->second.atime = ait->second;
+            }
+
+            m_offset = sfd.st_size;
+            return true;
+        }
+
+        // Another process compacted the journal and replaced the file, its
+        // new one holds all tiles including our committed ones. Changes
+        // not committed yet are only known here.
+        flock(m_fd, LOCK_UN);
+        close(m_fd);
+        m_fd = open(journal().c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+
+        std::unordered_map<uint64_t, entry>::iterator it = m_index.begin();
+        while (it != m_index.end())
+        {
+            if (m_dirty.find(it->first) != m_dirty.end())
+            {
+                ++it;
+                continue;
+            }
+
+            atimes[it->first] = std::max(atimes[it->first], it->second.atime);
+            release(it->second);
+            it = m_index.erase(it);
+        }
+
+        m_records = 0;
+        m_offset = 0;
+    }
+
+    if (m_fd >= 0)
+        flock(m_fd, LOCK_UN);
+
+    return false;
+}
+
+void florb::cache::store::unlockjournal()
+{
+    if (m_fd >= 0)
+        flock(m_fd, LOCK_UN);
+}
+
+bool florb::cache::store::write(const std::string& rec)
+{
+    const char *p = rec.c_str();
+    size_t len = rec.size();
+    while (len > 0)
+    {
+        ssize_t n = ::write(m_fd, p, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+
+        p += n;
+        len -= n;
+    }
+
+    m_offset += rec.size();
+    m_records += std::count(rec.begin(), rec.end(), '\n');
+
+    return true;
+}
+
+void florb::cache::store::commit()
+{
+    m_mutex.lock();
+
+    if (!m_journal.empty())
+    {
+        if (lockjournal())
+        {
+            write(m_journal);
+            unlockjournal();
+        }
+
+        m_journal.clear();
+        m_dirty.clear();
+    }
+
+    m_mutex.unlock();
+}
+
+void florb::cache::store::compact()
+{
+    FLORB_TRACE("cache::compact", "cache");
+
+    // Called with the journal locked. Other processes find the new file
+    // once they lock their old one and start over with it.
+    std::ostringstream tmp;
+    tmp << journal() << ".tmp" << getpid();
+
+    int fd = open(tmp.str().c_str(), O_WRONLY | O_APPEND | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return;
+
+    // Keep holding the lock on the old journal until the rename is done
+    int old = m_fd;
+    uint64_t records = m_records;
+    m_fd = fd;
+    m_offset = 0;
+    m_records = 0;
+
+    bool ok = true;
+    if (m_scanned)
+        ok = write("S\n");
+
+    std::unordered_map<uint64_t, entry>::iterator it;
+    for (it=m_index.begin();(it!=m_index.end()) && ok;++it)
+        ok = write(record(it->first, it->second));
+
+    if (ok && (flock(fd, LOCK_EX) == 0) && (rename(tmp.str().c_str(), journal().c_str()) == 0))
+    {
+        flock(old, LOCK_UN);
+        close(old);
+
+        // The new journal holds every change
+        m_journal.clear();
+        m_dirty.clear();
+        return;
+    }
+
+    close(fd);
+    std::remove(tmp.str().c_str());
+
+    m_fd = old;
+    m_records = records;
+
+    struct stat st;
+    m_offset = (fstat(old, &st) == 0) ? st.st_size : 0;
+}
+
+namespace
+{
+    // Stores by directory and the eviction thread. Stores nobody uses any
+    // more are only deleted by the eviction thread itself, or after it has
+    // stopped, so it can work on them without holding the registry mutex.
+    boost::interprocess::interprocess_mutex s_mutex;
+    std::map<std::string, florb::cache::store*> s_stores;
+    std::vector<florb::cache::store*> s_orphans;
+    boost::thread *s_evictor = NULL;
+    std::atomic<uint64_t> s_totalquota(0);
+
+    // Write-behind queue, one post of the semaphore per queued tile and one
+    // to stop the writer thread
+    struct queued
+    {
+        florb::cache::store *st;
+        uint64_t key;
+    };
+
+    boost::interprocess::interprocess_mutex s_wmutex;
+    boost::interprocess::interprocess_semaphore s_wsem(0);
+    std::deque<queued> s_writes;
+    boost::thread *s_writer = NULL;
+    bool s_wexit = false;
+    std::atomic<bool> s_sync(false);
+
+    struct candidate
+    {
+        time_t atime;
+        florb::cache::store *st;
+        uint64_t key;
+
+        bool operator < (const candidate& c) const { return atime < c.atime; }
+    };
+
+    // Expiry of a tile from its sidecar file, written by earlier versions
+    time_t sidecar(const std::string& path)
+    {
+        time_t ret = 0;
+
+        std::ifstream tf((path + ".dat").c_str(), std::ios::in);
+        if (tf.is_open())
+            tf >> ret;
+
+        return ret;
+    }
+
+    // Read a whole tile, size is what the index expects. A single read
+    // unless the file has changed in the meantime.
+    bool readtile(const std::string& path, uint64_t size, std::vector<char>& buf)
+    {
+        std::ifstream tf(path.c_str(), std::ios::in | std::ios::binary);
+        if (!tf.is_open())
+            return false;
+
+        buf.resize(size + 1);
+        tf.read(&(buf[0]), size + 1);
+        std::size_t n = tf.gcount();
+
+        // Larger than expected, read the rest
+        while (n == buf.size())
+        {
+            buf.resize(n * 2);
+            tf.read(&(buf[n]), n);
+            n += tf.gcount();
+        }
+
+        buf.resize(n);
+        return true;
+    }
+
+    void scan(florb::cache::store *st)
+    {
+        FLORB_TRACE("cache::scan", "cache");
+
+        // Tiles are stored as <dir>/<z>/<x>/<y><ext>, skip everything else
+        // like sidecar and temporary files
+        namespace fs = boost::filesystem;
+        try {
+            unsigned long n = 0;
+            fs::recursive_directory_iterator it(st->m_dir), end;
+            for (;it!=end;++it)
+            {
+                if ((it.level() != 2) || (!fs::is_regular_file(it->status())))
+                    continue;
+
+                std::string name(it->path().filename().string());
+                if ((st->m_ext.size() > 0) && (it->path().extension().string() != st->m_ext))
+                    continue;
+                name = name.substr(0, name.size() - st->m_ext.size());
+
+                int z, x, y;
+                if ((name.find_first_not_of("0123456789") != std::string::npos) ||
+                    (!florb::utils::fromstr(name, y)) ||
+                    (!florb::utils::fromstr(it->path().parent_path().filename().string(), x)) ||
+                    (!florb::utils::fromstr(it->path().parent_path().parent_path().filename().string(), z)))
+                    continue;
+
+                boost::system::error_code ec;
+                uint64_t size = fs::file_size(it->path(), ec);
+                time_t mtime = fs::last_write_time(it->path(), ec);
+                if (ec)
+                    continue;
+
+                st->found(florb::cache::store::key(z, x, y), size,
+                        sidecar(it->path().string()), mtime);
+
+                // Journal the chunk and give way to the rest of the
+                // application
+                if ((++n % 1024) == 0)
+                {
+                    st->commit();
+                    boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+                }
+            }
+        } catch (fs::filesystem_error&) {
+        }
+
+        st->complete();
+    }
+
+    uint64_t bytes(const std::vector<florb::cache::store*>& stores)
+    {
+        uint64_t ret = 0;
+        for (std::size_t i=0;i<stores.size();i++)
+        {
+            stores[i]->m_mutex.lock();
+            ret += stores[i]->m_bytes;
+            stores[i]->m_mutex.unlock();
+        }
+
+        return ret;
+    }
+
+    // Remove the least recently used tiles of the given stores until they
+    // hold target bytes at most
+    void evict(const std::vector<florb::cache::store*>& stores, uint64_t target)
+    {
+        FLORB_TRACE("cache::evict", "cache");
+
+        uint64_t total = bytes(stores);
+        if (total <= target)
+            return;
+
+        std::vector<candidate> c;
+        for (std::size_t i=0;i<stores.size();i++)
+        {
+            stores[i]->m_mutex.lock();
+            std::unordered_map<uint64_t, florb::cache::store::entry>::iterator it;
+            for (it=stores[i]->m_index.begin();it!=stores[i]->m_index.end();++it)
+            {
+                candidate cd = { it->second.atime, stores[i], it->first };
+                c.push_back(cd);
+            }
+            stores[i]->m_mutex.unlock();
+        }
+
+        std::sort(c.begin(), c.end());
+
+        unsigned int n = 0;
+        for (std::size_t i=0;(i<c.size()) && (total > target);i++)
+        {
+            // Tiles used since the candidates were collected stay
+            uint64_t size;
+            std::vector<std::string> files;
+            if (!c[i].st->forget(c[i].key, c[i].atime, size, files))
+                continue;
+
+            for (std::size_t j=0;j<files.size();j++)
+                std::remove(files[j].c_str());
+
+            c[i].st->m_evictions++;
+            c[i].st->m_evicted += size;
+            total = (size < total) ? total - size : 0;
+
+            if ((++n % EVICTBATCH) == 0)
+                boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+        }
+
+        for (std::size_t i=0;i<stores.size();i++)
+            stores[i]->commit();
+    }
+
+    void evictor()
+    {
+        florb::trace::thread_name("cache");
+
+        try {
+            for (;;)
+            {
+                std::vector<florb::cache::store*> stores;
+
+                s_mutex.lock();
+                for (std::size_t i=0;i<s_orphans.size();i++)
+                    delete s_orphans[i];
+                s_orphans.clear();
+
+                std::map<std::string, florb::cache::store*>::iterator it;
+                for (it=s_stores.begin();it!=s_stores.end();++it)
+                    stores.push_back(it->second);
+                s_mutex.unlock();
+
+                // Learn about tiles from earlier sessions first. Changes
+                // made outside the writer and this thread, like revalidated
+                // tiles, get journaled here.
+                bool scanned = true;
+                for (std::size_t i=0;i<stores.size();i++)
+                {
+                    stores[i]->load();
+                    stores[i]->commit();
+                    if (!stores[i]->m_scanned)
+                        scan(stores[i]);
+                    scanned = scanned && stores[i]->m_scanned;
+                }
+
+                // Per directory quota, then the total one
+                for (std::size_t i=0;i<stores.size();i++)
+                {
+                    std::vector<florb::cache::store*> one(1, stores[i]);
+                    uint64_t quota = stores[i]->m_quota;
+                    if ((quota > 0) && (bytes(one) > quota))
+                        evict(one, (uint64_t)(quota * LOWWATER));
+                }
+
+                uint64_t totalquota = s_totalquota;
+                if ((totalquota > 0) && scanned && (bytes(stores) > totalquota))
+                    evict(stores, (uint64_t)(totalquota * LOWWATER));
+
+                boost::this_thread::sleep(boost::posix_time::seconds(EVICTINTERVAL));
+            }
+        } catch (boost::thread_interrupted&) {
+        }
+    }
+
+    // A tile on its way to disk
+    struct job
+    {
+        florb::cache::store *st;
+        uint64_t key;
+        florb::cache::store::pending p;
+        uint64_t hash;
+        std::string path;
+        std::string tmp;
+        int fd;
+        bool ok;
+    };
+
+    // Open the temporary file of a tile, creating its directory if needed
+    int create(florb::cache::store *st, uint64_t key, uint64_t hash, const std::string& tmp)
+    {
+        int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if ((fd >= 0) || (errno != ENOENT))
+            return fd;
+
+        if (hash != 0)
+        {
+            florb::utils::mkdir(st->m_dir + st->m_sep + BLOBDIR);
+        }
+        else
+        {
+            std::string dir(st->m_dir + st->m_sep + boost::lexical_cast<std::string>(key >> 58));
+            florb::utils::mkdir(dir);
+
+            dir += st->m_sep + boost::lexical_cast<std::string>((key >> 29) & ((1ULL << 29) - 1));
+            florb::utils::mkdir(dir);
+        }
+
+        return open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+
+    // Store a batch of tiles. Several processes may share a cache, so tiles
+    // are written to temporary files first and moved in place, readers never
+    // see a partial tile. All files are written before they are synced and
+    // renamed, so the disk can work on the whole batch at once.
+    void flush(std::vector<job>& jobs)
+    {
+        FLORB_TRACE("cache::flush", "cache");
+
+        char suffix[32];
+        snprintf(suffix, sizeof(suffix), ".tmp%d", (int)getpid());
+
+        // Tiles and blobs in this batch, each one is written only once
+        std::set<std::pair<florb::cache::store*, uint64_t> > tiles;
+        std::map<std::pair<florb::cache::store*, uint64_t>, const std::vector<char>*> blobs;
+
+        for (std::size_t i=0;i<jobs.size();i++)
+        {
+            job& j = jobs[i];
+            j.fd = -1;
+            j.hash = 0;
+            j.ok = false;
+
+            // Already written with an earlier batch or queued twice
+            if (!tiles.insert(std::make_pair(j.st, j.key)).second)
+                continue;
+            if (!j.st->unwritten(j.key, j.p))
+                continue;
+
+            j.ok = true;
+            j.path = j.st->path(j.key);
+
+            // Empty tiles only live in the index
+            const std::vector<char>& buf = *(j.p.buf);
+            if (buf.size() == 0)
+                continue;
+
+            // Small tiles are stored once per content
+            if (buf.size() <= DEDUPMAX)
+            {
+                j.hash = florb::utils::hash(&(buf[0]), buf.size());
+                if (j.hash == 0)
+                    j.hash = 1;
+
+                // Already stored, the hash is not good enough to trust it
+                // blindly
+                std::map<std::pair<florb::cache::store*, uint64_t>, const std::vector<char>*>::iterator it =
+                    blobs.find(std::make_pair(j.st, j.hash));
+                std::vector<char> blob;
+                if (it != blobs.end())
+                {
+                    if (*(it->second) == buf)
+                        continue;
+
+                    j.hash = 0;
+                }
+                else if ((j.st->shared(j.hash)) && (readtile(j.st->file(j.key, j.hash), buf.size(), blob)))
+                {
+                    if (blob == buf)
+                        continue;
+
+                    j.hash = 0;
+                }
+
+                if (j.hash != 0)
+                {
+                    j.path = j.st->file(j.key, j.hash);
+                    blobs[std::make_pair(j.st, j.hash)] = &buf;
+                }
+            }
+
+            j.tmp = j.path + suffix;
+            j.fd = create(j.st, j.key, j.hash, j.tmp);
+
+            std::size_t n = 0;
+            while ((j.fd >= 0) && (n < buf.size()))
+            {
+                ssize_t rc = ::write(j.fd, &(buf[n]), buf.size() - n);
+                if (rc <= 0)
+                    break;
+                n += rc;
+            }
+
+            if ((j.fd < 0) || (n < buf.size()))
+            {
+                if (j.fd >= 0)
+                {
+                    close(j.fd);
+                    std::remove(j.tmp.c_str());
+                }
+
+                j.fd = -1;
+                j.ok = false;
+            }
+        }
+
+        if (s_sync)
+        {
+            for (std::size_t i=0;i<jobs.size();i++)
+            {
+                if (jobs[i].fd >= 0)
+                    fsync(jobs[i].fd);
+            }
+        }
+
+        for (std::size_t i=0;i<jobs.size();i++)
+        {
+            job& j = jobs[i];
+
+            if (j.fd >= 0)
+            {
+                if ((close(j.fd) != 0) || (rename(j.tmp.c_str(), j.path.c_str()) != 0))
+                {
+                    std::remove(j.tmp.c_str());
+                    j.ok = false;
+                }
+            }
+
+            // A tile which could not be written is dropped, it gets
+            // downloaded again
+            if (j.ok)
+            {
+                // Expiry is kept in the index now, a sidecar file from an
+                // earlier version would be stale
+                if (!j.st->m_scanned)
+                    std::remove((j.st->path(j.key) + ".dat").c_str());
+
+                // Remove what the tile used to be stored in
+                std::string stale(j.st->stored(j.key, j.p.buf->size(), j.p.expires,
+                            j.p.etag, j.p.modified, j.hash, time(NULL)));
+                if (!stale.empty())
+                    std::remove(stale.c_str());
+            }
+
+            if (j.p.buf)
+                j.st->written(j.key, j.p.seq);
+        }
+
+        // One journal commit per store for the whole batch
+        std::set<florb::cache::store*> stores;
+        for (std::size_t i=0;i<jobs.size();i++)
+        {
+            if (stores.insert(jobs[i].st).second)
+                jobs[i].st->commit();
+        }
+
+        for (std::size_t i=0;i<jobs.size();i++)
+            jobs[i].st->m_queued--;
+    }
+
+    void writer()
+    {
+        florb::trace::thread_name("cache writer");
+
+        for (;;)
+        {
+            s_wsem.wait();
+
+            // Take everything queued so far, up to the batch size. Every
+            // tile was posted once, the first one by the wait above.
+            std::vector<job> jobs;
+            bool exit = false;
+
+            s_wmutex.lock();
+            if (s_writes.empty())
+            {
+                exit = s_wexit;
+            }
+            else
+            {
+                do {
+                    job j;
+                    j.st = s_writes.front().st;
+                    j.key = s_writes.front().key;
+                    jobs.push_back(j);
+                    s_writes.pop_front();
+                } while ((!s_writes.empty()) && (jobs.size() < WRITEBATCH) && (s_wsem.try_wait()));
+            }
+            s_wmutex.unlock();
+
+            if (exit)
+                break;
+
+            if (jobs.size() > 0)
+                flush(jobs);
+        }
+    }
+}
+
+double florb::cache::usage::hitrate() const
+{
+    uint64_t lookups = hits + misses + expired;
+    return (lookups > 0) ? (double)hits / (double)lookups : 0.0;
+}
+
 florb::cache::cache(const std::string& url, const std::string& session, const std::string& ext) :
     m_url(url),
     m_session(session),
-    m_ext(ext)
+    m_ext(ext),
+    m_store(NULL)
 {
     int rc = 0;
 
@@ -45,177 +1316,318 @@ florb::cache::cache(const std::string& url, const std::string& session, const st
     {
         throw std::runtime_error(_("Failed to open / create cache database"));;
     }
+
+    // Share the store with other instances for the same directory
+    std::string dir(m_url+florb::utils::pathsep()+m_session);
+
+    s_mutex.lock();
+    std::map<std::string, florb::cache::store*>::iterator it = s_stores.find(dir);
+    if (it != s_stores.end())
+    {
+        m_store = it->second;
+        m_store->m_refs++;
+    }
+    else
+    {
+        m_store = new florb::cache::store(dir, m_ext);
+        s_stores[dir] = m_store;
+    }
+
+    if (!s_evictor)
+        s_evictor = new boost::thread(evictor);
+    if (!s_writer)
+        s_writer = new boost::thread(writer);
+    s_mutex.unlock();
 };
 
 florb::cache::~cache()
 {
-};
+    boost::thread *evictor = NULL;
+    boost::thread *writer = NULL;
 
-void florb::cache::put(int z, int x, int y, time_t expires, const std::vector<char> &buf)
-{
-    if ((z < 0) || (x < 0) || (y < 0))
-        return;
+    // Tiles of this cache still waiting to be written
+    while (m_store->m_queued > 0)
+        boost::this_thread::sleep(boost::posix_time::milliseconds(1));
 
-    int rc = 0;
-    for (;;) 
+    s_mutex.lock();
+    if (--m_store->m_refs == 0)
     {
-        // Create the storage directory for the tile if not already present
-        std::ostringstream oss;
-        
-        oss << m_url << florb::utils::pathsep() << m_session; 
-        if (!florb::utils::exists(oss.str()))
-            florb::utils::mkdir(oss.str());
+        s_stores.erase(m_store->m_dir);
+        s_orphans.push_back(m_store);
+    }
 
-        oss << florb::utils::pathsep() << z;
-        if (!florb::utils::exists(oss.str()))
-            florb::utils::mkdir(oss.str());
+    // Last cache gone, stop the eviction and writer threads
+    if (s_stores.empty())
+    {
+        evictor = s_evictor;
+        s_evictor = NULL;
+        writer = s_writer;
+        s_writer = NULL;
+    }
+    s_mutex.unlock();
 
-        oss << florb::utils::pathsep() << x;
-        if (!florb::utils::exists(oss.str()))
-            florb::utils::mkdir(oss.str());
+    if (writer)
+    {
+        s_wmutex.lock();
+        s_wexit = true;
+        s_wmutex.unlock();
+        s_wsem.post();
 
-        oss << florb::utils::pathsep() << y << m_ext;
+        writer->join();
+        delete writer;
 
-        std::ofstream of;
-        of.open(oss.str().c_str(), std::ios::out | std::ios::trunc | std::ios::binary);
-        if (!of.is_open())
-        {
-            rc = -1;
-            break;
-        }
+        s_wmutex.lock();
+        s_wexit = false;
+        s_wmutex.unlock();
+    }
 
-        of.write(&(buf[0]), buf.size());
-        of.close();
+    if (evictor)
+    {
+        evictor->interrupt();
+        evictor->join();
+        delete evictor;
 
-        oss << florb::cache::dbextension;
+        s_mutex.lock();
+        for (std::size_t i=0;i<s_orphans.size();i++)
+            delete s_orphans[i];
+        s_orphans.clear();
+        s_mutex.unlock();
+    }
+};
 
-        of.open(oss.str().c_str(), std::ios::out | std::ios::trunc);
-        if (!of.is_open())
-        {
-            rc = -1;
-            break;
-        }
+florb::cache::usage florb::cache::stats()
+{
+    florb::cache::usage ret;
 
-        of << expires;
-        of.close();
-        
-        break;
-    }
+    m_store->m_mutex.lock();
+    ret.bytes = m_store->m_bytes;
+    ret.tiles = m_store->m_index.size();
+    ret.saved = m_store->m_saved;
+    ret.pending = m_store->m_pending.size();
+    m_store->m_mutex.unlock();
+
+    ret.quota = m_store->m_quota;
+    ret.hits = m_store->m_hits;
+    ret.misses = m_store->m_misses;
+    ret.expired = m_store->m_expired;
+    ret.evictions = m_store->m_evictions;
+    ret.evicted = m_store->m_evicted;
+    ret.complete = m_store->m_scanned;
+
+    return ret;
+}
 
-    if (rc != 0)
+florb::cache::usage florb::cache::total()
+{
+    florb::cache::usage ret;
+    ret.quota = s_totalquota;
+
+    s_mutex.lock();
+    std::map<std::string, florb::cache::store*>::iterator it;
+    for (it=s_stores.begin();it!=s_stores.end();++it)
     {
-        throw std::runtime_error(_("Cache error: PUT"));
+        florb::cache::store *st = it->second;
+
+        st->m_mutex.lock();
+        ret.bytes += st->m_bytes;
+        ret.tiles += st->m_index.size();
+        ret.saved += st->m_saved;
+        ret.pending += st->m_pending.size();
+        st->m_mutex.unlock();
+
+        ret.hits += st->m_hits;
+        ret.misses += st->m_misses;
+        ret.expired += st->m_expired;
+        ret.evictions += st->m_evictions;
+        ret.evicted += st->m_evicted;
+        ret.complete = ret.complete && st->m_scanned;
     }
+    s_mutex.unlock();
+
+    return ret;
 }
 
-int florb::cache::exists(int z, int x, int y)
+void florb::cache::quota(uint64_t bytes)
+{
+    m_store->m_quota = bytes;
+}
+
+void florb::cache::totalquota(uint64_t bytes)
+{
+    s_totalquota = bytes;
+}
+
+void florb::cache::put(int z, int x, int y, time_t expires, const std::vector<char> &buf, const std::string& etag, time_t modified)
 {
+    std::vector<char> tmp;
+    florb::bufferpool::get(tmp, buf.size());
+    tmp.assign(buf.begin(), buf.end());
+
+    put(z, x, y, expires, std::move(tmp), etag, modified);
+}
+
+void florb::cache::put(int z, int x, int y, time_t expires, std::vector<char> &&buf, const std::string& etag, time_t modified)
+{
+    FLORB_TRACE("cache::put", "cache");
+
     if ((z < 0) || (x < 0) || (y < 0))
-        return false;
+        return;
 
-    int rc = -1;
-    for (;;)
-    {
-        std::string sep(florb::utils::pathsep());
-        std::ostringstream oss;
-        oss << m_url << sep << m_session << sep << z << sep << x << sep << y << m_ext; 
+    m_store->load();
 
-        std::ifstream tf;
-        tf.open(oss.str().c_str(), std::ios::in);
+    // Lookups find the tile in memory until the writer thread has stored it
+    queued w = { m_store, florb::cache::store::key(z, x, y) };
+    m_store->queue(w.key, std::move(buf), expires, etag, modified);
 
-        if (!tf.is_open())
-        {
-            rc = NOTFOUND;
-            break;
-        }
-        tf.close();
+    s_wmutex.lock();
+    s_writes.push_back(w);
+    s_wmutex.unlock();
 
-        rc = FOUND;
+    s_wsem.post();
+}
 
-        oss << dbextension;
-        tf.open(oss.str().c_str(), std::ios::in);
-        if (!tf.is_open())
-        {
-            rc = EXPIRED;
-            break;
-        }
+void florb::cache::sync(bool s)
+{
+    s_sync = s;
+}
 
-        time_t expires;
-        tf >> expires;
-        tf.close();
+bool florb::cache::refresh(int z, int x, int y, time_t expires)
+{
+    FLORB_TRACE("cache::refresh", "cache");
 
-        time_t now = time(NULL);
-        if (now > expires)
-            rc = EXPIRED;
+    if ((z < 0) || (x < 0) || (y < 0))
+        return false;
 
-        break;
-    }
+    m_store->load();
 
-    if (rc < 0)
-    {
-        throw std::runtime_error(_("Cache error: EXISTS"));
-    }
+    return m_store->refreshed(florb::cache::store::key(z, x, y), expires, time(NULL));
+}
 
-    return rc;
+bool florb::cache::validators(int z, int x, int y, std::string& etag, time_t& modified)
+{
+    etag.clear();
+    modified = 0;
+
+    if ((z < 0) || (x < 0) || (y < 0))
+        return false;
+
+    m_store->load();
+
+    if (!m_store->validators(florb::cache::store::key(z, x, y), etag, modified))
+        return false;
+
+    return (!etag.empty()) || (modified > 0);
 }
 
-int florb::cache::get(int z, int x, int y, std::vector<char> &buf)
+int florb::cache::exists(int z, int x, int y)
 {
+    FLORB_TRACE("cache::exists", "cache");
+
     if ((z < 0) || (x < 0) || (y < 0))
         return NOTFOUND;
 
-    int rc = -1;
-    for (;;)
-    {
-        // Return the data
-        std::ostringstream oss;
-        std::string sep(florb::utils::pathsep());
-        oss << m_url << sep << m_session << sep << z << sep << x << sep << y << m_ext; 
+    m_store->load();
 
-        std::ifstream tf;
-        tf.open(oss.str().c_str(), std::ios::in | std::ios::binary);
+    uint64_t key = florb::cache::store::key(z, x, y);
+    uint64_t size, hash;
+    time_t expires;
 
-        if (!tf.is_open())
-        {
-            rc = NOTFOUND;
-            break;
-        }
+    if (m_store->lookup(key, size, expires, hash))
+        return (time(NULL) > expires) ? EXPIRED : FOUND;
+
+    // All tiles on disk are indexed
+    if (m_store->m_scanned)
+        return NOTFOUND;
 
-        tf.seekg(0, tf.end);
-        size_t msize = tf.tellg();
-        tf.seekg(0, tf.beg);
-        
-        buf.resize(msize);
-        tf.read(&(buf[0]), msize);
-        tf.close();
+    // Still scanning, look at the file itself
+    std::string path(m_store->path(key));
+    std::ifstream tf(path.c_str(), std::ios::in | std::ios::binary);
+    if (!tf.is_open())
+        return NOTFOUND;
 
-        time_t expires;
-        oss << dbextension;
-        tf.open(oss.str().c_str(), std::ios::in | std::ios::binary);
+    tf.seekg(0, tf.end);
+    size = tf.tellg();
+    tf.close();
 
-        if (!tf.is_open())
+    expires = sidecar(path);
+    m_store->found(key, size, expires, time(NULL));
+
+    return (time(NULL) > expires) ? EXPIRED : FOUND;
+}
+
+int florb::cache::get(int z, int x, int y, std::vector<char> &buf)
+{
+    time_t expires;
+    return get(z, x, y, buf, expires);
+}
+
+int florb::cache::get(int z, int x, int y, std::vector<char> &buf, time_t &expires)
+{
+    FLORB_TRACE("cache::get", "cache");
+
+    expires = 0;
+    if ((z < 0) || (x < 0) || (y < 0))
+        return NOTFOUND;
+
+    m_store->load();
+
+    uint64_t key = florb::cache::store::key(z, x, y);
+    std::string path(m_store->path(key));
+    time_t now = time(NULL);
+    uint64_t size, hash;
+    florb::cache::store::pending p;
+
+    int rc = NOTFOUND;
+    for (;;)
+    {
+        if (m_store->unwritten(key, p))
         {
-            rc = EXPIRED;
-            break;
+            // Not on disk yet
+            buf.assign(p.buf->begin(), p.buf->end());
+            expires = p.expires;
         }
+        else if (m_store->lookup(key, size, expires, hash))
+        {
+            // Empty tiles have no file
+            if (size == 0)
+            {
+                buf.clear();
+            }
+            else if (!readtile(m_store->file(key, hash), size, buf))
+            {
+                // Removed by someone else
+                std::vector<std::string> files;
+                m_store->forget(key, now, size, files);
+                expires = 0;
+                break;
+            }
 
-        rc = FOUND;
+            m_store->touch(key, buf.size(), now);
+        }
+        else
+        {
+            // All tiles on disk are indexed
+            if (m_store->m_scanned)
+                break;
 
-        tf >> expires;
-        tf.close();
+            // Still scanning, read the file and its sidecar
+            if (!readtile(path, 0, buf))
+                break;
 
-        // Check whether this tile has expired
-        time_t now = time(NULL);
-        if (now > expires)
-            rc = EXPIRED;
+            expires = sidecar(path);
+            m_store->found(key, buf.size(), expires, now);
+        }
 
+        rc = (now > expires) ? EXPIRED : FOUND;
         break;
     }
 
-    if (rc < 0)
-    {
-        throw std::runtime_error(_("Cache error: GET"));
-    }
+    if (rc == FOUND)
+        m_store->m_hits++;
+    else if (rc == EXPIRED)
+        m_store->m_expired++;
+    else
+        m_store->m_misses++;
 
     return rc;
 }
@@ -2,6 +2,7 @@
 #define CACHE_HPP
 
 #include <time.h>
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -14,20 +15,86 @@ namespace florb
             ~cache();
 
             int get(int z, int x, int y, std::vector<char> &buf);
+            int get(int z, int x, int y, std::vector<char> &buf, time_t &expires);
             int exists(int z, int x, int y);
-            void put(int z, int x, int y, time_t expires, const std::vector<char> &buf);
+            // Returns right away, the tile is written by a background thread
+            void put(int z, int x, int y, time_t expires, const std::vector<char> &buf,
+                    const std::string& etag = std::string(), time_t modified = 0);
+            // Same without copying the data, buf is empty afterwards
+            void put(int z, int x, int y, time_t expires, std::vector<char> &&buf,
+                    const std::string& etag = std::string(), time_t modified = 0);
 
-            enum 
+            // Extend the life of a tile the server reported as unchanged,
+            // false if the tile is not cached
+            bool refresh(int z, int x, int y, time_t expires);
+
+            // ETag and Last-Modified date the tile was stored with, false if
+            // the server sent neither
+            bool validators(int z, int x, int y, std::string& etag, time_t& modified);
+
+            enum
             {
                 EXPIRED,
                 NOTFOUND,
                 FOUND
             };
 
+            // Disk usage and lookup counters of a cache directory
+            class usage
+            {
+                public:
+                    usage() :
+                        bytes(0), tiles(0), quota(0), hits(0), misses(0),
+                        expired(0), evictions(0), evicted(0), saved(0), pending(0), complete(true) {};
+
+                    // Hits per lookup, 0 without any lookups
+                    double hitrate() const;
+
+                    uint64_t bytes;
+                    uint64_t tiles;
+                    uint64_t quota;
+                    uint64_t hits;
+                    uint64_t misses;
+                    uint64_t expired;
+                    uint64_t evictions;
+                    uint64_t evicted;
+
+                    // Bytes not on disk because identical tiles share a file
+                    uint64_t saved;
+
+                    // Tiles not written to disk yet
+                    uint64_t pending;
+
+                    // False while the initial scan of the directory is
+                    // still running, bytes and tiles are too low until then
+                    bool complete;
+            };
+
+            // Usage of this cache directory, shared with all other cache
+            // instances for the same directory
+            usage stats();
+
+            // Usage of all cache directories in use by this process
+            static usage total();
+
+            // Byte quota of this cache directory and of all of them, 0 for
+            // no limit. Least recently used tiles beyond the quota get
+            // removed by a background thread.
+            void quota(uint64_t bytes);
+            static void totalquota(uint64_t bytes);
+
+            // Sync written tiles to disk before they become visible to other
+            // processes, off by default
+            static void sync(bool s);
+
+            // Per-directory tile index, shared between cache instances
+            class store;
+
         private:
             std::string m_url;
             std::string m_session;
             std::string m_ext;
+            florb::cache::store *m_store;
             static const std::string dbextension;
     };
 };
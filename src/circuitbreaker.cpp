@@ -0,0 +1,144 @@
+#include <map>
+#include <chrono>
+#include "circuitbreaker.hpp"
+
+// Consecutive failures which open the breaker
+#define THRESHOLD               (5)
+
+// First and longest cool-down in microseconds
+#define COOLDOWN                (30*1000000ULL)
+#define COOLDOWNMAX             (300*1000000ULL)
+
+// A probe which neither succeeds nor fails within this time, e.g. because
+// its downloader went away, gets replaced by another one
+#define PROBETIMEOUT            (60*1000000ULL)
+
+namespace
+{
+    // Host breakers, created under the mutex and never removed
+    boost::interprocess::interprocess_mutex s_mutex;
+    std::map<std::string, florb::circuitbreaker*> s_hosts;
+}
+
+florb::circuitbreaker::circuitbreaker() :
+    m_state(CLOSED),
+    m_failures(0),
+    m_cooldown(COOLDOWN),
+    m_until(0)
+{
+}
+
+bool florb::circuitbreaker::allow()
+{
+    bool ret = false;
+    uint64_t t = now();
+
+    m_mutex.lock();
+
+    for (;;)
+    {
+        if (m_state == CLOSED)
+        {
+            ret = true;
+            break;
+        }
+
+        // Still cooling down or waiting for the probe
+        if (t < m_until)
+            break;
+
+        // This one is the probe
+        m_state = HALFOPEN;
+        m_until = t + PROBETIMEOUT;
+        ret = true;
+
+        break;
+    }
+
+    m_mutex.unlock();
+
+    return ret;
+}
+
+void florb::circuitbreaker::success()
+{
+    m_mutex.lock();
+    m_state = CLOSED;
+    m_failures = 0;
+    m_cooldown = COOLDOWN;
+    m_mutex.unlock();
+}
+
+void florb::circuitbreaker::failure()
+{
+    uint64_t t = now();
+
+    m_mutex.lock();
+
+    m_failures++;
+
+    if (m_state == HALFOPEN)
+    {
+        // Probe failed, wait longer this time
+        m_cooldown *= 2;
+        if (m_cooldown > COOLDOWNMAX)
+            m_cooldown = COOLDOWNMAX;
+
+        m_state = OPEN;
+        m_until = t + m_cooldown;
+    }
+    else if ((m_state == CLOSED) && (m_failures >= THRESHOLD))
+    {
+        m_state = OPEN;
+        m_until = t + m_cooldown;
+    }
+
+    m_mutex.unlock();
+}
+
+int florb::circuitbreaker::state()
+{
+    m_mutex.lock();
+    int ret = m_state;
+    m_mutex.unlock();
+
+    return ret;
+}
+
+unsigned int florb::circuitbreaker::cooldown()
+{
+    uint64_t t = now();
+
+    m_mutex.lock();
+    unsigned int ret = ((m_state == OPEN) && (m_until > t)) ? (unsigned int)((m_until - t + 999999) / 1000000) : 0;
+    m_mutex.unlock();
+
+    return ret;
+}
+
+florb::circuitbreaker& florb::circuitbreaker::host(const std::string& name)
+{
+    s_mutex.lock();
+
+    florb::circuitbreaker *ret;
+    std::map<std::string, florb::circuitbreaker*>::iterator it = s_hosts.find(name);
+    if (it != s_hosts.end())
+    {
+        ret = it->second;
+    }
+    else
+    {
+        ret = new florb::circuitbreaker();
+        s_hosts[name] = ret;
+    }
+
+    s_mutex.unlock();
+
+    return *ret;
+}
+
+uint64_t florb::circuitbreaker::now()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,63 @@
+#ifndef CIRCUITBREAKER_HPP
+#define CIRCUITBREAKER_HPP
+
+#include <cstdint>
+#include <string>
+#include <boost/interprocess/sync/interprocess_mutex.hpp>
+
+namespace florb
+{
+    // Stops requests to a tile server which keeps failing. After a number of
+    // consecutive failures the breaker opens and no requests go out for a
+    // cool-down period. Afterwards a single request probes the server, if it
+    // succeeds the breaker closes again, otherwise the next cool-down is
+    // twice as long.
+    class circuitbreaker
+    {
+        public:
+            circuitbreaker();
+
+            enum
+            {
+                CLOSED,
+                OPEN,
+                HALFOPEN
+            };
+
+            // Whether a request may be sent now. Once the cool-down is over
+            // the first caller gets to send the probe, everybody else has to
+            // wait for its outcome.
+            bool allow();
+
+            // Outcome of a request which was allowed
+            void success();
+            void failure();
+
+            int state();
+
+            // Seconds until the next probe, 0 unless the breaker is open
+            unsigned int cooldown();
+
+            // Breaker of the given host, shared by all downloaders of the
+            // process
+            static florb::circuitbreaker& host(const std::string& name);
+
+        private:
+            circuitbreaker(const circuitbreaker&);
+            circuitbreaker& operator=(const circuitbreaker&);
+
+            static uint64_t now();
+
+            boost::interprocess::interprocess_mutex m_mutex;
+            int m_state;
+            unsigned int m_failures;
+            uint64_t m_cooldown;
+
+            // End of the cool-down while open, end of the probe's grace
+            // period while half open
+            uint64_t m_until;
+    };
+};
+
+#endif // CIRCUITBREAKER_HPP
+
@@ -0,0 +1,203 @@
+#include <map>
+#include <cmath>
+#include <chrono>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/interprocess/sync/scoped_lock.hpp>
+#include "concurrency.hpp"
+
+// Length of the window for the lowest latency in microseconds
+#define RTTWINDOW               (30*1000000ULL)
+
+// Limit after a failed request relative to the previous limit
+#define BACKOFF                 (0.5)
+
+namespace
+{
+    // Host controllers, created under the mutex and never removed
+    boost::interprocess::interprocess_mutex s_mutex;
+    std::map<std::string, florb::concurrency*> s_hosts;
+}
+
+florb::concurrency::concurrency() :
+    m_min(0),
+    m_max(0),
+    m_limit(0.0),
+    m_inflight(0),
+    m_rtt(0.0),
+    m_rttmin(0),
+    m_windowmin(0),
+    m_windowstart(0),
+    m_lastdecrease(0)
+{
+}
+
+void florb::concurrency::bounds(unsigned int min, unsigned int max)
+{
+    m_mutex.lock();
+
+    m_max = max;
+    m_min = (min > 0) ? min : 1;
+    if ((m_max > 0) && (m_max < m_min))
+        m_max = m_min;
+
+    if (m_limit < (double)m_min)
+        m_limit = (double)m_min;
+    if ((m_max > 0) && (m_limit > (double)m_max))
+        m_limit = (double)m_max;
+
+    m_mutex.unlock();
+
+    // More slots might be free now
+    m_cond.notify_all();
+}
+
+bool florb::concurrency::acquire(uint64_t timeout)
+{
+    boost::interprocess::scoped_lock<boost::interprocess::interprocess_mutex> lock(m_mutex);
+
+    boost::posix_time::ptime deadline =
+        boost::posix_time::microsec_clock::universal_time() +
+        boost::posix_time::microseconds(timeout);
+
+    while ((m_max > 0) && (m_inflight >= (unsigned int)m_limit))
+    {
+        if (!m_cond.timed_wait(lock, deadline))
+        {
+            if ((m_max > 0) && (m_inflight >= (unsigned int)m_limit))
+                return false;
+        }
+    }
+
+    m_inflight++;
+
+    return true;
+}
+
+void florb::concurrency::release(uint64_t latency, bool ok)
+{
+    uint64_t t = now();
+
+    m_mutex.lock();
+
+    // Only grow while the limit is what holds requests back
+    bool saturated = (m_inflight >= (unsigned int)m_limit);
+    if (m_inflight > 0)
+        m_inflight--;
+
+    if (ok && (latency > 0))
+    {
+        m_rtt = (m_rtt == 0.0) ? (double)latency : (m_rtt + ((double)latency - m_rtt) / 8.0);
+
+        if ((m_windowmin == 0) || (latency < m_windowmin))
+            m_windowmin = latency;
+        if ((m_rttmin == 0) || (latency < m_rttmin))
+            m_rttmin = latency;
+
+        if ((t - m_windowstart) > RTTWINDOW)
+        {
+            m_rttmin = m_windowmin;
+            m_windowmin = latency;
+            m_windowstart = t;
+        }
+    }
+
+    if (m_max > 0)
+    {
+        if (!ok)
+        {
+            // Once per round trip, the other requests of the same round
+            // most likely failed for the same reason
+            if ((double)(t - m_lastdecrease) > m_rtt)
+            {
+                m_limit *= BACKOFF;
+                m_lastdecrease = t;
+            }
+        }
+        else if ((latency > 0) && (m_rttmin > 0))
+        {
+            // Estimated number of requests waiting on the server
+            double queue = m_limit * (1.0 - ((double)m_rttmin / (double)latency));
+
+            double l = std::log10(m_limit);
+            double alpha = std::max(1.0, 1.5 * l);
+            double beta = std::max(2.0, 3.0 * l);
+
+            if ((queue < alpha) && saturated)
+                m_limit += 1.0 / m_limit;
+            else if (queue > beta)
+                m_limit -= 1.0 / m_limit;
+        }
+
+        if (m_limit < (double)m_min)
+            m_limit = (double)m_min;
+        if (m_limit > (double)m_max)
+            m_limit = (double)m_max;
+    }
+
+    m_mutex.unlock();
+
+    m_cond.notify_all();
+}
+
+double florb::concurrency::limit()
+{
+    m_mutex.lock();
+    double ret = (m_max > 0) ? m_limit : 0.0;
+    m_mutex.unlock();
+
+    return ret;
+}
+
+unsigned int florb::concurrency::inflight()
+{
+    m_mutex.lock();
+    unsigned int ret = m_inflight;
+    m_mutex.unlock();
+
+    return ret;
+}
+
+uint64_t florb::concurrency::rtt()
+{
+    m_mutex.lock();
+    uint64_t ret = (uint64_t)m_rtt;
+    m_mutex.unlock();
+
+    return ret;
+}
+
+uint64_t florb::concurrency::rttmin()
+{
+    m_mutex.lock();
+    uint64_t ret = m_rttmin;
+    m_mutex.unlock();
+
+    return ret;
+}
+
+florb::concurrency& florb::concurrency::host(const std::string& name)
+{
+    s_mutex.lock();
+
+    florb::concurrency *ret;
+    std::map<std::string, florb::concurrency*>::iterator it = s_hosts.find(name);
+    if (it != s_hosts.end())
+    {
+        ret = it->second;
+    }
+    else
+    {
+        ret = new florb::concurrency();
+        s_hosts[name] = ret;
+    }
+
+    s_mutex.unlock();
+
+    return *ret;
+}
+
+uint64_t florb::concurrency::now()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
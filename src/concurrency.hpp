@@ -0,0 +1,68 @@
+#ifndef CONCURRENCY_HPP
+#define CONCURRENCY_HPP
+
+#include <cstdint>
+#include <string>
+#include <boost/interprocess/sync/interprocess_mutex.hpp>
+#include <boost/interprocess/sync/interprocess_condition.hpp>
+
+namespace florb
+{
+    // Number of requests in flight to a tile server, adapted at runtime in
+    // the style of TCP Vegas. While the latency stays close to the lowest
+    // one seen the limit grows by one per round of requests, once requests
+    // start queueing on the server it shrinks again. Failed requests halve
+    // the limit.
+    class concurrency
+    {
+        public:
+            concurrency();
+
+            // Bounds of the limit, a max of 0 disables the limit
+            void bounds(unsigned int min, unsigned int max);
+
+            // Wait up to timeout microseconds for a free slot, false if
+            // there was none
+            bool acquire(uint64_t timeout);
+
+            // Give back a slot with the latency of the request in
+            // microseconds and whether the server handled it. Server errors
+            // and timeouts count as failure, 404 and the like do not.
+            void release(uint64_t latency, bool ok);
+
+            // Current state, the limit is 0 without bounds
+            double limit();
+            unsigned int inflight();
+            uint64_t rtt();
+            uint64_t rttmin();
+
+            // Controller of the given host, shared by all downloaders of
+            // the process. Created on first use without a limit.
+            static florb::concurrency& host(const std::string& name);
+
+        private:
+            concurrency(const concurrency&);
+            concurrency& operator=(const concurrency&);
+
+            static uint64_t now();
+
+            boost::interprocess::interprocess_mutex m_mutex;
+            boost::interprocess::interprocess_condition m_cond;
+
+            unsigned int m_min;
+            unsigned int m_max;
+            double m_limit;
+            unsigned int m_inflight;
+
+            // Smoothed latency and the lowest latency seen, which is taken
+            // from the last window only so a changed route is noticed
+            double m_rtt;
+            uint64_t m_rttmin;
+            uint64_t m_windowmin;
+            uint64_t m_windowstart;
+            uint64_t m_lastdecrease;
+    };
+};
+
+#endif // CONCURRENCY_HPP
+
@@ -4,12 +4,13 @@
 #include <algorithm>
 #include "settings.hpp"
 #include "utils.hpp"
+#include "flutils.hpp"
 #include "fluid/dlg_bulkdl.hpp"
 
 void dlg_bulkdl::create_ex()
 {
     // Set the window icon
-    florb::utils::set_window_icon(m_window); 
+    florb::flutils::set_window_icon(m_window); 
 
     // Don't use default window callback
     m_window->callback(cb_window_ex);
@@ -269,6 +270,8 @@ void dlg_bulkdl::startdl_ex()
                 break;
             }
             osml->nice(ms);
+            osml->mirrors(cfgtileserver.mirrors(), cfgtileserver.subdomains());
+            osml->ratelimit(cfgtileserver.rate(), cfgtileserver.burst());
 
             // Start listening to events
             osml->add_event_listener(this);
@@ -1,12 +1,13 @@
 #include <FL/fl_ask.H>
 #include "settings.hpp"
 #include "unit.hpp"
+#include "flutils.hpp"
 #include "fluid/dlg_editselection.hpp"
 
 void dlg_editselection::create_ex()
 {
     // Set the window icon
-    florb::utils::set_window_icon(m_window); 
+    florb::flutils::set_window_icon(m_window); 
 }
 
 void dlg_editselection::show_ex()
@@ -1,4 +1,5 @@
 #include "utils.hpp"
+#include "flutils.hpp"
 #include "unit.hpp"
 #include "fluid/dlg_eleprofile.hpp"
 
@@ -8,7 +9,7 @@ void dlg_eleprofile::create_ex()
     m_profile->add_event_listener(this);
 
     // Set the window icon
-    florb::utils::set_window_icon(m_window); 
+    florb::flutils::set_window_icon(m_window); 
 }
 
 void dlg_eleprofile::destroy_ex()
@@ -2,6 +2,7 @@
 #include <sstream>
 #include <iostream>
 #include "utils.hpp"
+#include "flutils.hpp"
 #include "shell.hpp"
 #include "fluid/dlg_garmindl.hpp"
 
@@ -10,7 +11,7 @@ void dlg_garmindl::create_ex()
     m_dlstatus = false;
 
     // Set the window icon
-    florb::utils::set_window_icon(m_window); 
+    florb::flutils::set_window_icon(m_window); 
 
     m_progress_status->minimum(0);
     m_progress_status->maximum(99);
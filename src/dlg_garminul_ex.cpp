@@ -2,13 +2,14 @@
 #include <sstream>
 #include <iostream>
 #include "utils.hpp"
+#include "flutils.hpp"
 #include "shell.hpp"
 #include "fluid/dlg_garminul.hpp"
 
 void dlg_garminul::create_ex()
 {
     // Set the window icon
-    florb::utils::set_window_icon(m_window); 
+    florb::flutils::set_window_icon(m_window); 
 }
 
 void dlg_garminul::show_ex()
@@ -4,6 +4,7 @@
 #include <clocale>
 #include <limits>
 #include "utils.hpp"
+#include "flutils.hpp"
 #include "fluid/dlg_search.hpp"
 
 void dlg_search::create_ex()
@@ -11,7 +12,7 @@ void dlg_search::create_ex()
     m_markerid = std::numeric_limits<size_t>::max();
 
     // Set the window icon
-    florb::utils::set_window_icon(m_window);
+    florb::flutils::set_window_icon(m_window);
 
     try {
         m_downloader = new florb::downloader(1);
@@ -4,14 +4,16 @@
 #include <FL/Fl_File_Chooser.H>
 #include "settings.hpp"
 #include "utils.hpp"
+#include "flutils.hpp"
 #include "unit.hpp"
+#include "cache.hpp"
 #include "fluid/dlg_settings.hpp"
 #include "fluid/dlg_tileserver.hpp"
 
 void dlg_settings::create_ex()
 {
     // Set the window icon
-    florb::utils::set_window_icon(m_window); 
+    florb::flutils::set_window_icon(m_window); 
 
     m_cfgui = florb::settings::get_instance()["ui"].as<florb::cfg_ui>();
     m_cfggpsd = florb::settings::get_instance()["gpsd"].as<florb::cfg_gpsd>();
@@ -91,6 +93,31 @@ void dlg_settings::cb_inp_trackwidth_ex(Fl_Widget *widget)
     m_cfgui.tracklinewidth(tw);
 }
 
+void dlg_settings::cb_inp_quota_ex(Fl_Widget *widget)
+{
+    Fl_Input *inp = static_cast<Fl_Input*>(widget);
+
+    /* Nothing entered, nothing to save */
+    if (strlen(inp->value()) <= 0)
+        return;
+
+    /* Disallow negative numbers */
+    if (inp->value()[0] == '-')
+    {
+        std::string s(inp->value());
+        inp->value(s.substr(1,s.length()-1).c_str());
+        inp->position(0);
+    }
+
+    /* Save new value */
+    unsigned int q = 0;
+    florb::utils::fromstr(inp->value(), q);
+    if (widget == m_input_quota)
+        m_cfgcache.quota(q);
+    else
+        m_cfgcache.totalquota(q);
+}
+
 void dlg_settings::cb_btn_location_ex(Fl_Widget *widget)
 {
     // Create a file chooser instance
@@ -200,6 +227,16 @@ void dlg_settings::tab_ui_setup_ex()
 void dlg_settings::tab_cache_setup_ex()
 {
     m_output_location->value(m_cfgcache.location().c_str());
+    m_input_quota->value(static_cast<std::ostringstream*>( &(std::ostringstream() << m_cfgcache.quota()) )->str().c_str());
+    m_input_totalquota->value(static_cast<std::ostringstream*>( &(std::ostringstream() << m_cfgcache.totalquota()) )->str().c_str());
+
+    // Disk usage of the maps opened so far
+    florb::cache::usage u(florb::cache::total());
+    std::ostringstream oss;
+    oss << (u.bytes / (1024*1024)) << (u.complete ? " MB, " : "+ MB, ") << 
+        u.tiles << _(" tiles, ") << (int)(u.hitrate() * 100.0) << _("% hits, ") << 
+        u.evictions << _(" evicted");
+    m_output_usage->value(oss.str().c_str());
 }
 
 void dlg_settings::tab_units_setup_ex()
@@ -1,12 +1,13 @@
 #include "settings.hpp"
 #include "utils.hpp"
+#include "flutils.hpp"
 #include "fluid/dlg_tileserver.hpp"
 #include <FL/fl_ask.H>
 
 void dlg_tileserver::create_ex()
 {
     // Set the window icon
-    florb::utils::set_window_icon(m_window); 
+    florb::flutils::set_window_icon(m_window); 
     m_window->label(m_title.c_str());
 }
 
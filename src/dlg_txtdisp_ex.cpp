@@ -3,12 +3,13 @@
 #include <iostream>
 #include <fstream>
 #include "utils.hpp"
+#include "flutils.hpp"
 #include "fluid/dlg_txtdisp.hpp"
 
 void dlg_txtdisp::create_ex()
 {
     // Set the window icon
-    florb::utils::set_window_icon(m_window); 
+    florb::flutils::set_window_icon(m_window); 
 
     m_buf = new Fl_Text_Buffer();
     m_display->buffer(m_buf);
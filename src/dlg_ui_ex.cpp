@@ -9,7 +9,11 @@
 #include "settings.hpp"
 #include "gpsdclient.hpp"
 #include "utils.hpp"
+#include "flutils.hpp"
 #include "unit.hpp"
+#include "cache.hpp"
+#include "tilestats.hpp"
+#include "trace.hpp"
 #include "fluid/dlg_ui.hpp"
 #include "version.hpp"
 
@@ -43,11 +47,20 @@ int main_ex(int argc, char* argv[])
 
     // Start the application
     Fl::lock();
+    florb::flutils::init();
+    florb::trace::thread_name("FLTK");
     ui = new dlg_ui();
     ui->show(argc, argv);
 
+    // Periodically dump the tile pipeline statistics if requested
+    florb::cfg_stats cfgstats = florb::settings::get_instance()["stats"].as<florb::cfg_stats>();
+    if (!cfgstats.file().empty())
+        florb::tilestats::dump_start(cfgstats.file(), cfgstats.interval());
+
     int ret = Fl::run();
 
+    florb::tilestats::dump_stop();
+
     // delete the dialog, it is hidden already
     delete ui;
 
@@ -161,7 +174,7 @@ void dlg_ui::create_ex(void)
     m_dlg_eleprofile = NULL;
 	
     // Set the window icon
-    florb::utils::set_window_icon(m_window);
+    florb::flutils::set_window_icon(m_window);
 
     // Fluid 1.3 does not gettext the menuitems, do it manually here
     // File
@@ -242,13 +255,7 @@ void dlg_ui::update_choice_map_ex(void)
    
         // Try to create a basemap
         try {
-            m_wgtmap->basemap(
-                ts.name(), 
-                ts.url(), 
-                ts.zmin(), 
-                ts.zmax(), 
-                ts.parallel(),
-                ts.type()); 
+            m_wgtmap->basemap(ts); 
         } catch (std::runtime_error& e) {
             fl_alert("%s", e.what()); 
         }
@@ -259,13 +266,7 @@ void dlg_ui::update_choice_map_ex(void)
 
             // Try to create a basemap
             try {
-                m_wgtmap->overlay(
-                        ts.name(), 
-                        ts.url(), 
-                        ts.zmin(), 
-                        ts.zmax(), 
-                        ts.parallel(),
-                        ts.type()); 
+                m_wgtmap->overlay(ts); 
             } catch (std::runtime_error& e) {
                 fl_alert("%s", e.what()); 
             }
@@ -466,15 +467,35 @@ void dlg_ui::settings_ex()
         
         // Connect / reconnect / disconnect GPSd
         florb::cfg_gpsd cfggpsd = s["gpsd"].as<florb::cfg_gpsd>();
-        if (cfggpsd.enabled())
-        {
-            m_wgtmap->gpsd_connect(cfggpsd.host(), cfggpsd.port());
-        }
-        else
-        {
-            m_wgtmap->gpsd_disconnect();
+        try {
+            if ((cfggpsd.enabled()) && (cfggpsd.replay().empty()))
+            {
+                m_wgtmap->gpsd_connect(cfggpsd.host(), cfggpsd.port());
+            }
+            else if (cfggpsd.enabled())
+            {
+                m_wgtmap->gpsd_replay(cfggpsd.replay(), cfggpsd.replayspeed(), cfggpsd.replayport());
+            }
+            else
+            {
+                m_wgtmap->gpsd_disconnect();
+            }
+        } catch (std::runtime_error& e) {
+            fl_alert("%s", e.what());
         }
 
+        // GPS cursor frame rate
+        m_wgtmap->gpsd_cursorfps(s["ui"].as<florb::cfg_ui>().gpscursorfps());
+
+        // Map redraw rate
+        m_wgtmap->maxfps(s["ui"].as<florb::cfg_ui>().maxfps());
+        m_wgtmap->overscan(s["ui"].as<florb::cfg_ui>().overscan());
+        m_wgtmap->zoomtime(s["ui"].as<florb::cfg_ui>().zoomtime());
+
+        // Disk quota of all maps, the per map quota applies to maps opened
+        // from now on
+        florb::cache::totalquota((uint64_t)s["cache"].as<florb::cfg_cache>().totalquota() * 1024 * 1024);
+
         // Update the list of tileservers
         update_choice_map_ex();
         
@@ -593,13 +614,7 @@ void dlg_ui::cb_choice_basemap_ex(Fl_Widget *widget)
 
     // Try to create a basemap using the selected tile server configuration
     try {
-        m_wgtmap->basemap(
-                tileservers[idx].name(), 
-                tileservers[idx].url(), 
-                tileservers[idx].zmin(), 
-                tileservers[idx].zmax(), 
-                tileservers[idx].parallel(),
-                tileservers[idx].type());
+        m_wgtmap->basemap(tileservers[idx]);
     } catch (std::runtime_error& e) {
         fl_alert("%s", e.what());        
     }
@@ -620,13 +635,7 @@ void dlg_ui::cb_choice_overlay_ex(Fl_Widget *widget)
 
         // Try to create a basemap using the selected tile server configuration
         try {
-            m_wgtmap->overlay(
-                    tileservers[idx-1].name(), 
-                    tileservers[idx-1].url(), 
-                    tileservers[idx-1].zmin(), 
-                    tileservers[idx-1].zmax(), 
-                    tileservers[idx-1].parallel(),
-                    tileservers[idx-1].type());
+            m_wgtmap->overlay(tileservers[idx-1]);
         } catch (std::runtime_error& e) {
             fl_alert("%s", e.what());        
         }
@@ -1,16 +1,107 @@
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <random>
+#include <strings.h>
 #include <curl/curl.h>
 #include <curl/easy.h>
 #include <boost/bind.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
-#include <FL/Fl.H>
 
 #include "utils.hpp"
 #include "version.hpp"
 #include "downloader.hpp"
+#include "tilestats.hpp"
+#include "trace.hpp"
+#include "bufferpool.hpp"
+
+// Initial capacity of a download buffer, enough for most tiles
+#define DLBUFSIZE               (64*1024)
+
+// Upper limit for preallocating from the Content-Length header
+#define DLRESERVEMAX            (16*1024*1024)
+
+// Pause of a host after a 429 response without Retry-After, and the longest
+// pause a server can ask for, in seconds
+#define RETRYAFTERDEFAULT       (10)
+#define RETRYAFTERMAX           (3600)
+
+// Longest single sleep while waiting for the rate limit, so shutting down
+// does not hang on a long pause
+#define DELAYSLICE              (100000)
+
+// Retries of failed transfers and server errors, and the backoff before the
+// first retry in microseconds, doubled with every further one
+#define RETRYMAX                (3)
+#define RETRYBACKOFF            (1000000ULL)
+
+// Interval for checking whether the probe of a server considered down has
+// succeeded
+#define PROBEWAIT               (250000ULL)
+
+// Response time assumed for servers without one and the advantage of the
+// preferred server over the others when picking one for a download
+#define RTTFLOOR                (10000.0)
+#define AFFINITY                (2.0)
+
+// Connections kept open per worker thread, to several servers at a time
+#define MAXCONNECTS             (16L)
+
+namespace
+{
+    // Case insensitive comparison of a header name
+    bool hdrname(const char *name, size_t len, const char *expected)
+    {
+        return (strlen(expected) == len) && (strncasecmp(name, expected, len) == 0);
+    }
+
+    // Random delay between half and all of the given one, so retries of
+    // requests which failed together do not go out together again
+    uint64_t jitter(uint64_t us)
+    {
+        thread_local std::mt19937_64 rng(std::random_device{}());
+        return (us / 2) + (rng() % ((us / 2) + 1));
+    }
+
+    // DNS lookups and TLS sessions are shared by all transfers. Connections
+    // are not, libcurl cannot share them between threads, every worker keeps
+    // its own.
+    boost::interprocess::interprocess_mutex s_sharelocks[CURL_LOCK_DATA_LAST];
+
+    void share_lock(CURL*, curl_lock_data data, curl_lock_access, void*)
+    {
+        s_sharelocks[data].lock();
+    }
+
+    void share_unlock(CURL*, curl_lock_data data, void*)
+    {
+        s_sharelocks[data].unlock();
+    }
+
+    CURLSH* share_create()
+    {
+        CURLSH *sh = curl_share_init();
+        if (!sh)
+            return NULL;
+
+        curl_share_setopt(sh, CURLSHOPT_LOCKFUNC, share_lock);
+        curl_share_setopt(sh, CURLSHOPT_UNLOCKFUNC, share_unlock);
+        curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+
+        return sh;
+    }
+
+    // Created on first use and never freed, like the per-host state
+    CURLSH* share()
+    {
+        static CURLSH *sh = share_create();
+        return sh;
+    }
+}
 
 florb::downloader::downloader(int nthreads) : 
     m_timeout(10),
-    m_nice(0),
     m_stat(0),
     m_threadblock(0),
     m_exit(false)
@@ -58,22 +149,26 @@ florb::downloader::~downloader()
     }
 }
 
-void florb::downloader::nice(long ms)
+void florb::downloader::threads(unsigned int nthreads)
 {
-    m_mutex.lock();
-    m_nice = ms;
-    m_mutex.unlock();
-}
-
-long florb::downloader::nice()
-{   
-    long ret;
+    while (m_workers.size() < nthreads)
+    {
+        florb::downloader::workerinfo *ti;
+        try {
+            ti = new florb::downloader::workerinfo(
+                new boost::thread(boost::bind(&florb::downloader::worker, this)));
+        } catch (...) {
+            // Keep going with the threads we have
+            break;
+        }
 
-    m_mutex.lock();
-    ret = m_nice;
-    m_mutex.unlock();
+        m_workers.push_back(ti);
+    }
+}
 
-    return ret;
+void florb::downloader::rate(double r, unsigned int burst)
+{
+    m_limit.rate(r, burst);
 }
 
 std::size_t florb::downloader::stat()
@@ -110,40 +205,56 @@ size_t florb::downloader::timeout()
     return ret;
 }
 
-bool florb::downloader::queue(const std::string& url, void* userdata)
+bool florb::downloader::queue(const std::string& url, void* userdata, const std::string& etag, time_t modified)
+{
+    return queue(std::vector<std::string>(1, url), userdata, etag, modified);
+}
+
+bool florb::downloader::queue(const std::vector<std::string>& urls, void* userdata, const std::string& etag, time_t modified)
 {   
-    if (do_exit())
+    if (do_exit() || urls.empty())
         return false;
 
     // Very basic URL encoding
-    std::string urle(url);
-    size_t pos;
-    while((pos = urle.find(" ")) != std::string::npos)
-        urle.replace(pos, 1, "%20"); 
+    std::vector<std::string> urlse(urls);
+    std::vector<std::string>::iterator uit;
+    for (uit=urlse.begin();uit!=urlse.end();++uit)
+    {
+        size_t pos;
+        while((pos = (*uit).find(" ")) != std::string::npos)
+            (*uit).replace(pos, 1, "%20"); 
+    }
 
     m_mutex.lock();
 
-    // Find an existing item in the list
+    // Find an existing item in the list, the first URL identifies it
     bool newitem = false;
-    florb::downloader::download_internal d(this, urle, userdata);
+    florb::downloader::download_internal d(this, urlse, userdata, etag, modified);
     std::vector<florb::downloader::download_internal>::iterator it;
     for (it=m_queue.begin(); it!=m_queue.end(); ++it)
     {
-        if ((*it) == d)
+        if ((*it).urls().front() == urlse.front())
+            break;
+    }
+
+    std::vector<florb::downloader::download_internal>::iterator rit;
+    for (rit=m_retry.begin(); rit!=m_retry.end(); ++rit)
+    {
+        if ((*rit).urls().front() == urlse.front())
             break;
     }
     
     // Existing item, boost priority
     if (it != m_queue.end())
     {
-        florb::downloader::download_internal dtmp = (*it);
-        m_queue.erase(it);
-        m_queue.push_back(dtmp);
+        std::rotate(it, it+1, m_queue.end());
     }
-    // New item, add to queue with max. priority
-    else
+    // New item, add to queue with max. priority, unless it failed before
+    // and waits for a retry
+    else if (rit == m_retry.end())
     {
-        m_queue.push_back(d);
+        d.tqueued(florb::tilestats::now());
+        m_queue.push_back(std::move(d));
         newitem = true;
     }
 
@@ -158,11 +269,75 @@ bool florb::downloader::queue(const std::string& url, void* userdata)
     return newitem;
 }
 
+int florb::downloader::state(void* userdata)
+{
+    int ret = UNKNOWN;
+
+    m_mutex.lock();
+
+    for (;;)
+    {
+        if (std::find(m_active.begin(), m_active.end(), userdata) != m_active.end())
+        {
+            ret = ACTIVE;
+            break;
+        }
+
+        std::vector<florb::downloader::download_internal>::iterator it;
+        for (it=m_queue.begin();it!=m_queue.end();++it)
+        {
+            if ((*it).userdata() == userdata)
+            {
+                ret = QUEUED;
+                break;
+            }
+        }
+        if (ret != UNKNOWN)
+            break;
+
+        for (it=m_retry.begin();it!=m_retry.end();++it)
+        {
+            if ((*it).userdata() == userdata)
+            {
+                ret = QUEUED;
+                break;
+            }
+        }
+        if (ret != UNKNOWN)
+            break;
+
+        for (it=m_done.begin();it!=m_done.end();++it)
+        {
+            if ((*it).userdata() == userdata)
+            {
+                ret = DONE;
+                break;
+            }
+        }
+
+        break;
+    }
+
+    m_mutex.unlock();
+
+    return ret;
+}
+
+size_t florb::downloader::active()
+{
+    size_t ret;
+    m_mutex.lock();
+    ret = m_active.size();
+    m_mutex.unlock();
+
+    return ret;
+}
+
 size_t florb::downloader::qsize()
 {
     size_t ret;
     m_mutex.lock();
-    ret = m_queue.size();
+    ret = m_queue.size() + m_retry.size();
     m_mutex.unlock();
 
     return ret;
@@ -179,8 +354,8 @@ bool florb::downloader::get(florb::downloader::download& dl)
         if (m_done.size() == 0)
             break;
 
-        dl = *(m_done.end()-1);
-        m_done.erase(m_done.end()-1);
+        dl = std::move(m_done.back());
+        m_done.pop_back();
         ret = true;
 
         break;
@@ -209,8 +384,109 @@ bool florb::downloader::do_exit(void)
     return ret;
 }
 
+void florb::downloader::requeue()
+{
+    uint64_t t = florb::tilestats::now();
+    size_t n = 0;
+
+    m_mutex.lock();
+    std::vector<florb::downloader::download_internal>::iterator it = m_retry.begin();
+    while (it != m_retry.end())
+    {
+        if ((*it).due() <= t)
+        {
+            m_queue.push_back(std::move(*it));
+            it = m_retry.erase(it);
+            n++;
+        }
+        else
+        {
+            ++it;
+        }
+    }
+    m_mutex.unlock();
+
+    // One post per item, just like queue()
+    for (size_t i=0;i<n;i++)
+        m_threadblock.post();
+}
+
+void florb::downloader::finish(florb::downloader::download_internal& dl)
+{
+    m_mutex.lock();
+    std::vector<void*>::iterator it = std::find(m_active.begin(), m_active.end(), dl.userdata());
+    if (it != m_active.end())
+        m_active.erase(it);
+    m_done.push_back(std::move(dl));
+    m_stat++;
+    m_mutex.unlock();
+
+    event_complete ce(this);
+    fire(&ce);
+}
+
+std::size_t florb::downloader::select(florb::downloader::download_internal& dl)
+{
+    const std::vector<std::string>& urls = dl.urls();
+
+    // Retries start with the next server
+    std::size_t preferred = dl.attempts() % urls.size();
+
+    // Servers which are up go first, then those due for a probe. Among
+    // them the one with the fewest requests in flight relative to its
+    // response time wins.
+    std::size_t ret = preferred;
+    int besttier = 2;
+    double bestscore = 0.0;
+    for (std::size_t i=0;i<urls.size();i++)
+    {
+        std::string host(florb::utils::urlhost(urls[i]));
+
+        florb::circuitbreaker& breaker = florb::circuitbreaker::host(host);
+        int tier = 0;
+        if (breaker.state() != florb::circuitbreaker::CLOSED)
+        {
+            if (breaker.cooldown() > 0)
+                continue;
+            tier = 1;
+        }
+
+        florb::concurrency& c = florb::concurrency::host(host);
+        double rtt = (c.rtt() > RTTFLOOR) ? (double)c.rtt() : RTTFLOOR;
+        double score = (double)(c.inflight() + 1) * rtt;
+        if (i == preferred)
+            score /= AFFINITY;
+
+        if ((tier < besttier) || ((tier == besttier) && (score < bestscore)))
+        {
+            ret = i;
+            besttier = tier;
+            bestscore = score;
+        }
+    }
+
+    return ret;
+}
+
+bool florb::downloader::delay(uint64_t us)
+{
+    while (us > 0)
+    {
+        if (do_exit())
+            return false;
+
+        uint64_t slice = (us > DELAYSLICE) ? DELAYSLICE : us;
+        boost::this_thread::sleep(boost::posix_time::microseconds(slice));
+        us -= slice;
+    }
+
+    return !do_exit();
+}
+
 void florb::downloader::worker()
 {
+    florb::trace::thread_name("downloader");
+
     CURL *curl_handle = curl_easy_init();
 
     curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, this);
@@ -221,7 +497,11 @@ void florb::downloader::worker()
     curl_easy_setopt(curl_handle, CURLOPT_HEADERFUNCTION, cb_header);
 
     curl_easy_setopt(curl_handle, CURLOPT_NOSIGNAL, 1);
-    curl_easy_setopt(curl_handle, CURLOPT_DNS_USE_GLOBAL_CACHE, 0);
+    curl_easy_setopt(curl_handle, CURLOPT_SHARE, share());
+
+    // Keep connections to all servers open between tiles
+    curl_easy_setopt(curl_handle, CURLOPT_MAXCONNECTS, MAXCONNECTS);
+    curl_easy_setopt(curl_handle, CURLOPT_TCP_KEEPALIVE, 1L);
 
     curl_easy_setopt(curl_handle, CURLOPT_TIMEOUT, timeout());
     curl_easy_setopt(curl_handle, CURLOPT_CONNECTTIMEOUT, timeout()); 
@@ -229,51 +509,186 @@ void florb::downloader::worker()
 
     for (;;)
     {
-        // Wait for request
-        m_threadblock.wait();
+        // Wait for request, waking up regularly for retries which are due
+        bool request = m_threadblock.timed_wait(
+                boost::posix_time::microsec_clock::universal_time() +
+                boost::posix_time::microseconds(DELAYSLICE));
 
         // Exit?
         if (do_exit())
             break;
 
-        // Get a download item from the list
+        requeue();
+        if (!request)
+            continue;
+
+        // Get a download item from the list, everything below applies to
+        // the host it goes to
         m_mutex.lock();
-        florb::downloader::download_internal dl = *(m_queue.end()-1);
-        m_queue.erase(m_queue.end()-1);
+        florb::downloader::download_internal dl(std::move(m_queue.back()));
+        m_queue.pop_back();
+        m_active.push_back(dl.userdata());
+        dl.url(dl.urls()[select(dl)]);
         m_mutex.unlock();
 
-        // Clear the buffer
-        dl.buf().resize(0);
+        std::string host(florb::utils::urlhost(dl.url()));
+
+        // Wait for a free slot on the host. While it is busy another
+        // server of the tile may have become the better choice.
+        florb::concurrency *slots = &florb::concurrency::host(host);
+        bool slot = false;
+        {
+            FLORB_TRACE("downloader::concurrency", "net");
+            while (!(slot = slots->acquire(DELAYSLICE)) && !do_exit())
+            {
+                if (dl.urls().size() < 2)
+                    continue;
+
+                dl.url(dl.urls()[select(dl)]);
+                host = florb::utils::urlhost(dl.url());
+                slots = &florb::concurrency::host(host);
+            }
+        }
+        if (!slot)
+            break;
+
+        florb::concurrency& hostslots = *slots;
+
+        // Fail right away while all servers are considered down, the tile
+        // stays in the cache as it is. While the probe is out, wait for
+        // its outcome.
+        florb::circuitbreaker& breaker = florb::circuitbreaker::host(host);
+        if (!breaker.allow())
+        {
+            hostslots.release(0, true);
+
+            // The host went down in the meantime, another server of the
+            // tile may still be up
+            bool other = (florb::utils::urlhost(dl.urls()[select(dl)]) != host);
+            if (other || (breaker.state() == florb::circuitbreaker::HALFOPEN))
+            {
+                dl.due(florb::tilestats::now() + (other ? 0 : PROBEWAIT));
+
+                m_mutex.lock();
+                m_active.erase(std::find(m_active.begin(), m_active.end(), dl.userdata()));
+                m_retry.push_back(std::move(dl));
+                m_mutex.unlock();
+                continue;
+            }
+
+            dl.blocked(true);
+            dl.buf().clear();
+            finish(dl);
+            continue;
+        }
+
+        // Wait for the rate limits of the host
+        florb::ratelimit& hostlimit = florb::ratelimit::host(host);
+        uint64_t wait = std::max(m_limit.take(), hostlimit.take());
+        if (wait > 0)
+        {
+            FLORB_TRACE("downloader::ratelimit", "net");
+            if (!delay(wait))
+            {
+                hostslots.release(0, true);
+                break;
+            }
+        }
+
+        // Recycled buffer, grown from Content-Length if the tile is larger
+        florb::bufferpool::get(dl.buf(), DLBUFSIZE);
         
         curl_easy_setopt(curl_handle, CURLOPT_URL, dl.url().c_str());
         curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, &dl);
         curl_easy_setopt(curl_handle, CURLOPT_WRITEHEADER, &dl);
 
+        // Revalidate instead of downloading again if we have a copy
+        struct curl_slist *hdrs = NULL;
+        if (!dl.ifetag().empty())
+            hdrs = curl_slist_append(hdrs, ("If-None-Match: " + dl.ifetag()).c_str());
+        curl_easy_setopt(curl_handle, CURLOPT_HTTPHEADER, hdrs);
+
+        if (dl.ifmodified() > 0)
+        {
+            curl_easy_setopt(curl_handle, CURLOPT_TIMECONDITION, (long)CURL_TIMECOND_IFMODSINCE);
+            curl_easy_setopt(curl_handle, CURLOPT_TIMEVALUE, (long)dl.ifmodified());
+        }
+        else
+        {
+            curl_easy_setopt(curl_handle, CURLOPT_TIMECONDITION, (long)CURL_TIMECOND_NONE);
+        }
+
         // Start download
-        if (curl_easy_perform(curl_handle) != 0)
+        dl.tstart(florb::tilestats::now());
+        bool ok = true;
         {
-            // Download failed return an empty buffer
-            dl.buf().resize(0);
+            FLORB_TRACE("downloader::transfer", "net");
+            if (curl_easy_perform(curl_handle) != 0)
+            {
+                ok = false;
+
+                // Download failed return an empty buffer
+                dl.buf().clear();
+            }
         }
+        dl.tdone(florb::tilestats::now());
+
+        curl_easy_setopt(curl_handle, CURLOPT_HTTPHEADER, NULL);
+        curl_slist_free_all(hdrs);
+
+        // Cache-Control: max-age takes precedence over Expires
+        if (dl.maxage() >= 0)
+            dl.expires() = time(NULL) + dl.maxage();
 
         // Check http status code
         long httprc = 0;
         curl_easy_getinfo(curl_handle, CURLINFO_RESPONSE_CODE, &httprc);
         dl.httprc(httprc);
 
-        // Finish download and update statistics
-        m_mutex.lock();
-        m_done.push_back(dl);
-        m_stat++;
-        m_mutex.unlock();
+        // Overload and server errors make the host get fewer requests at a
+        // time, missing tiles do not. The time to the first byte tells
+        // how long the request waited on the server, regardless of the
+        // tile size.
+        if ((httprc == 429) || (httprc >= 500))
+            ok = false;
+        double ttfb = 0.0;
+        curl_easy_getinfo(curl_handle, CURLINFO_STARTTRANSFER_TIME, &ttfb);
+        hostslots.release((uint64_t)(ttfb * 1e6), ok);
+
+        // Back off if the server is overloaded or we were too fast
+        if ((httprc == 429) || ((httprc == 503) && (dl.retryafter() > 0)))
+        {
+            long sec = (dl.retryafter() > 0) ? dl.retryafter() : RETRYAFTERDEFAULT;
+            hostlimit.pause((uint64_t)sec * 1000000);
+        }
 
-        // Fire event
-        event_complete ce(this);
-        fire(&ce);
+        // A server which answers is up, even if it asks us to slow down
+        if ((httprc == 0) || (httprc >= 500))
+            breaker.failure();
+        else
+            breaker.success();
+
+        // Try again later unless the server is considered down now and
+        // there is no other one
+        dl.attempts()++;
+        if (!ok && (dl.attempts() <= RETRYMAX) &&
+                ((breaker.state() == florb::circuitbreaker::CLOSED) || (dl.urls().size() > 1)))
+        {
+            uint64_t backoff = jitter(RETRYBACKOFF << (dl.attempts() - 1));
+            if ((uint64_t)dl.retryafter() * 1000000 > backoff)
+                backoff = (uint64_t)dl.retryafter() * 1000000;
+            dl.due(florb::tilestats::now() + backoff);
 
-        // Sleep
-        if (nice() > 0)
-            boost::this_thread::sleep(boost::posix_time::milliseconds(nice()));
+            m_mutex.lock();
+            m_active.erase(std::find(m_active.begin(), m_active.end(), dl.userdata()));
+            m_retry.push_back(std::move(dl));
+            m_mutex.unlock();
+
+            continue;
+        }
+
+        // Finish download and update statistics
+        finish(dl);
     }
 
     curl_easy_cleanup(curl_handle);
@@ -292,39 +707,100 @@ size_t florb::downloader::cb_header(void *ptr, size_t size, size_t nmemb, void *
     florb::downloader::download_internal *d = 
         reinterpret_cast<florb::downloader::download_internal*>(data);
 
-    return d->dldr()->handle_header(ptr, size, nmemb, d->expires());
+    return d->dldr()->handle_header(ptr, size, nmemb, *d);
 }
 
 size_t florb::downloader::handle_data(void *ptr, size_t size, size_t nmemb, std::vector<char>& buf)
 {
     size_t realsize = size * nmemb;
-    size_t currentsize = buf.size();
+    const char *data = reinterpret_cast<const char*>(ptr);
 
-    buf.resize(currentsize + realsize);
-    memcpy(reinterpret_cast<void*>(&(buf[currentsize])), ptr, realsize);
+    buf.insert(buf.end(), data, data + realsize);
 
     return realsize;
 }
 
-size_t florb::downloader::handle_header(void *ptr, size_t size, size_t nmemb, time_t& expires) 
+size_t florb::downloader::handle_header(void *ptr, size_t size, size_t nmemb, florb::downloader::download_internal& dl) 
 {
     size_t realsize = size * nmemb;
-    std::string line;
+    const char *line = reinterpret_cast<const char*>(ptr);
 
-    // Construct the whole line
-    for (size_t i=0;i<realsize;i++)
-        line += reinterpret_cast<char*>(ptr)[i];
-    
-    // Not an expires header
-    if (line.find("Expires: ") == std::string::npos)
+    // Strip the line end
+    size_t len = realsize;
+    while ((len > 0) && ((line[len-1] == '\r') || (line[len-1] == '\n')))
+        len--;
+
+    // Status line of a new response, e.g. after a redirect. The headers of
+    // the previous one do not apply.
+    if ((len >= 5) && (strncmp(line, "HTTP/", 5) == 0))
+    {
+        dl.expires() = 0;
+        dl.etag().clear();
+        dl.modified() = 0;
+        dl.maxage() = -1;
+        dl.retryafter() = 0;
+        return realsize;
+    }
+
+    const char *colon = reinterpret_cast<const char*>(memchr(line, ':', len));
+    if (!colon)
         return realsize;
 
-    // Extract the date string from the expires header
-    line = line.substr(strlen("Expires: "), line.size()-strlen("Expires: ")-1);    
+    size_t namelen = colon - line;
+    const char *value = colon + 1;
+    const char *end = line + len;
+    while ((value < end) && ((*value == ' ') || (*value == '\t')))
+        value++;
+
+    if (hdrname(line, namelen, "Content-Length"))
+    {
+        // Size the buffer once instead of growing it chunk by chunk
+        unsigned long long n = strtoull(std::string(value, end).c_str(), NULL, 10);
+        if ((n > dl.buf().capacity()) && (n <= DLRESERVEMAX))
+            dl.buf().reserve(dl.buf().size() + n);
+    }
+    else if (hdrname(line, namelen, "Retry-After"))
+    {
+        // Either a number of seconds or a date
+        std::string ra(value, end);
+        char *num_end;
+        long sec = strtol(ra.c_str(), &num_end, 10);
+        if ((num_end == ra.c_str()) || (*num_end != '\0'))
+        {
+            time_t t = curl_getdate(ra.c_str(), NULL);
+            sec = (t > 0) ? (long)(t - time(NULL)) : 0;
+        }
 
-    // Convert string to time_t
-    expires = curl_getdate(line.c_str(), NULL);
+        if (sec < 0)
+            sec = 0;
+        dl.retryafter() = (sec > RETRYAFTERMAX) ? RETRYAFTERMAX : sec;
+    }
+    else if (hdrname(line, namelen, "Expires"))
+    {
+        // An invalid date like "0" means already expired
+        time_t t = curl_getdate(std::string(value, end).c_str(), NULL);
+        dl.expires() = (t > 0) ? t : 1;
+    }
+    else if (hdrname(line, namelen, "ETag"))
+    {
+        dl.etag().assign(value, end);
+    }
+    else if (hdrname(line, namelen, "Last-Modified"))
+    {
+        time_t t = curl_getdate(std::string(value, end).c_str(), NULL);
+        dl.modified() = (t > 0) ? t : 0;
+    }
+    else if (hdrname(line, namelen, "Cache-Control"))
+    {
+        std::string cc(value, end);
+        std::transform(cc.begin(), cc.end(), cc.begin(), ::tolower);
+
+        std::size_t pos = cc.find("max-age=");
+        if (pos != std::string::npos)
+            dl.maxage() = strtol(cc.c_str() + pos + strlen("max-age="), NULL, 10);
+        else if ((cc.find("no-cache") != std::string::npos) || (cc.find("no-store") != std::string::npos))
+            dl.maxage() = 0;
+    }
 
     return realsize;
 }
-
@@ -4,10 +4,14 @@
 #include <string>
 #include <vector>
 #include <set>
+#include <cstdint>
 #include <boost/thread.hpp>
 #include <boost/interprocess/sync/interprocess_mutex.hpp>
 #include <boost/interprocess/sync/interprocess_semaphore.hpp>
 #include "event.hpp"
+#include "ratelimit.hpp"
+#include "concurrency.hpp"
+#include "circuitbreaker.hpp"
 
 namespace florb
 {
@@ -17,15 +21,39 @@ namespace florb
             downloader(int nthreads);
             ~downloader();
 
+            // Start more worker threads, the number of requests actually in
+            // flight is up to florb::concurrency::host()
+            void threads(unsigned int nthreads);
+
             void timeout(size_t sec);
             size_t timeout();
-            bool queue(const std::string& url, void* userdata);
+            // Requests are conditional if an ETag or a modification date is
+            // given, the server answers 304 if the resource is unchanged
+            bool queue(const std::string& url, void* userdata,
+                    const std::string& etag = std::string(), time_t modified = 0);
+            // Same resource on several servers, the first one is preferred.
+            // The request goes to another one if the preferred server is
+            // busy, slow or down, retries go to the next one.
+            bool queue(const std::vector<std::string>& urls, void* userdata,
+                    const std::string& etag = std::string(), time_t modified = 0);
             size_t qsize();
-            void nice(long ms);
-            long nice();
+            size_t active();
+            // Limit of this downloader on top of the per-host limits of
+            // florb::ratelimit::host(), which all downloaders share
+            void rate(double r, unsigned int burst);
             std::size_t stat();
             void stat(std::size_t s);
 
+            // Where the download with the given userdata currently is
+            enum
+            {
+                UNKNOWN,
+                QUEUED,
+                ACTIVE,
+                DONE
+            };
+            int state(void* userdata);
+
             class event_complete;
             class download;
 
@@ -40,17 +68,32 @@ namespace florb
             static size_t cb_data(void *ptr, size_t size, size_t nmemb, void *data);
             static size_t cb_header(void *ptr, size_t size, size_t nmemb, void *data);
             size_t handle_data(void *ptr, size_t size, size_t nmemb, std::vector<char>& buf);
-            size_t handle_header(void *ptr, size_t size, size_t nmemb, time_t& expires);
+            size_t handle_header(void *ptr, size_t size, size_t nmemb, florb::downloader::download_internal& dl);
 
             bool do_exit(void);
             void do_exit(bool i);
 
+            // Sleep for the given number of microseconds, false if the
+            // downloader is shut down in the meantime
+            bool delay(uint64_t us);
+
+            // Move retries which are due back into the queue
+            void requeue();
+
+            // Hand a finished download over to the event listeners
+            void finish(florb::downloader::download_internal& dl);
+
+            // Index of the URL the download should be sent to next
+            std::size_t select(florb::downloader::download_internal& dl);
+
             std::vector<florb::downloader::download_internal> m_queue;
             std::vector<florb::downloader::download_internal> m_done;
+            std::vector<florb::downloader::download_internal> m_retry;
+            std::vector<void*> m_active;
 
             std::vector<florb::downloader::workerinfo*> m_workers;
             size_t m_timeout;
-            long m_nice;
+            florb::ratelimit m_limit;
             std::size_t m_stat;
 
             boost::interprocess::interprocess_semaphore m_threadblock;
@@ -63,19 +106,64 @@ namespace florb
     {
         public:
             download() :
+                m_expires(0),
+                m_modified(0),
+                m_maxage(-1),
+                m_retryafter(0),
+                m_httprc(0),
+                m_attempts(0),
+                m_blocked(false),
+                m_tqueued(0),
+                m_tstart(0),
+                m_tdone(0),
                 m_userdata(NULL) {};
             download(const std::string& url, void *userdata) :
                 m_expires(0),
+                m_modified(0),
+                m_maxage(-1),
+                m_retryafter(0),
+                m_httprc(0),
+                m_attempts(0),
+                m_blocked(false),
+                m_tqueued(0),
+                m_tstart(0),
+                m_tdone(0),
                 m_url(url),
                 m_userdata(userdata) {};
             virtual ~download() {};
 
+            // Downloads own their data buffer, they get moved around but
+            // never copied
+            download(download&&) = default;
+            download& operator=(download&&) = default;
+
             const std::string& url() const { return m_url; };
             void *userdata() const { return m_userdata; };
             std::vector<char>& buf() { return m_buf; };
+            // Expiry date from Expires or Cache-Control: max-age, 0 if the
+            // server sent neither. A date in the past means the response
+            // must be revalidated before it is used again.
             const time_t& expires() const { return m_expires; };
             long httprc() const { return m_httprc; }
 
+            // Validators sent by the server, empty and 0 if there were none
+            const std::string& etag() const { return m_etag; };
+            time_t modified() const { return m_modified; };
+
+            // Seconds the server asked us to wait with a 429 or 503
+            // response, 0 if it did not say
+            long retryafter() const { return m_retryafter; };
+
+            // Number of requests sent, more than one if it was retried
+            unsigned int attempts() const { return m_attempts; };
+
+            // Not sent at all because the server is considered down
+            bool blocked() const { return m_blocked; };
+
+            // Time spent in the queue and on the transfer in microseconds
+            uint64_t qwait() const { return m_tstart - m_tqueued; };
+            uint64_t transfer() const { return m_tdone - m_tstart; };
+
             bool operator==(const download& d) const
             {
                 return (m_url == d.m_url);
@@ -92,28 +180,69 @@ namespace florb
         protected:
             std::vector<char> m_buf;
             time_t m_expires;
+            std::string m_etag;
+            time_t m_modified;
+            long m_maxage;
+            long m_retryafter;
             long m_httprc;
+            unsigned int m_attempts;
+            bool m_blocked;
+            uint64_t m_tqueued;
+            uint64_t m_tstart;
+            uint64_t m_tdone;
+            std::string m_url;
 
         private:
-            std::string m_url;
+            download(const download&) = delete;
+            download& operator=(const download&) = delete;
+
             void* m_userdata;
     };
 
     class downloader::download_internal : public download
     {
         public:
-            download_internal(downloader* dldr, const std::string& url, void *userdata) :
-                download(url, userdata),
-                m_dldr(dldr) {};
-            ~download_internal() {};
+            download_internal(downloader* dldr, const std::vector<std::string>& urls, void *userdata,
+                    const std::string& ifetag, time_t ifmodified) :
+                download(urls.front(), userdata),
+                m_dldr(dldr),
+                m_urls(urls),
+                m_ifetag(ifetag),
+                m_ifmodified(ifmodified),
+                m_due(0) {};
+            download_internal(download_internal&&) = default;
+            download_internal& operator=(download_internal&&) = default;
             void httprc(long rc) { m_httprc = rc; }
 
             downloader* dldr() const { return m_dldr; };
+            // All URLs of the resource, url() is the one last sent to
+            const std::vector<std::string>& urls() const { return m_urls; };
+            const std::string& url() const { return m_url; };
+            void url(const std::string& u) { m_url = u; };
             std::vector<char>& buf() { return m_buf; };
             time_t& expires() { return m_expires; };
+            std::string& etag() { return m_etag; };
+            time_t& modified() { return m_modified; };
+            long& maxage() { return m_maxage; };
+            long& retryafter() { return m_retryafter; };
+            const std::string& ifetag() const { return m_ifetag; };
+            time_t ifmodified() const { return m_ifmodified; };
+            void tqueued(uint64_t t) { m_tqueued = t; };
+            void tstart(uint64_t t) { m_tstart = t; };
+            void tdone(uint64_t t) { m_tdone = t; };
+            unsigned int& attempts() { return m_attempts; };
+            void blocked(bool b) { m_blocked = b; };
+
+            // When a retry may be sent
+            uint64_t due() const { return m_due; };
+            void due(uint64_t t) { m_due = t; };
 
         private:
             downloader* m_dldr;
+            std::vector<std::string> m_urls;
+            std::string m_ifetag;
+            time_t m_ifmodified;
+            uint64_t m_due;
     };
 
     class downloader::workerinfo
@@ -1,4 +1,3 @@
-#include <FL/Fl.H>
 #include <boost/interprocess/sync/interprocess_semaphore.hpp>
 #include "event.hpp"
 
@@ -48,7 +47,7 @@ bool event_listener::handle_safe(const event_base* evt)
     }
 
     exec_info execinfo(it->second, evt);
-    if (Fl::awake(event_listener::mt_callback, (void*)&execinfo) != 0)
+    if (event_dispatch::awake(event_listener::mt_callback, (void*)&execinfo) != 0)
     {
         return false;
     }
@@ -65,6 +64,16 @@ void event_listener::mt_callback(void *data)
     execinfo->unlock();
 }
 
+event_dispatch::awake_handler event_dispatch::m_handler = NULL;
+
+int event_dispatch::awake(callback cb, void *data)
+{
+    if (!m_handler)
+        return -1;
+
+    return m_handler(cb, data);
+}
+
 void event_generator::add_event_listener(event_listener *l)
 {
     m_listeners.insert(l);
@@ -97,6 +97,22 @@ class event_listener
         };
 };
 
+// Runs callbacks on the thread which owns the event listeners. A GUI installs
+// its toolkit's wakeup function (e.g. Fl::awake) here. Without a handler the
+// callbacks are dropped and the program has to poll instead.
+class event_dispatch
+{
+    public:
+        typedef void (*callback)(void *data);
+        typedef int (*awake_handler)(callback cb, void *data);
+
+        static void handler(awake_handler h) { m_handler = h; };
+        static int awake(callback cb, void *data);
+
+    private:
+        static awake_handler m_handler;
+};
+
 class event_generator
 {
     public:
@@ -0,0 +1,89 @@
+#ifndef FLGFX_HPP
+#define FLGFX_HPP
+
+#include <FL/x.H>
+#include <FL/Fl.H>
+#include <FL/fl_draw.H>
+#include <FL/Fl_Image.H>
+#include <string>
+#include "gfx.hpp"
+
+// FLTK implementations of florb::drawable, the core library itself does not
+// depend on FLTK.
+namespace florb
+{
+    typedef Fl_Offscreen canvas_storage;
+
+    // An in-memory drawing buffer 
+    class canvas : public drawable
+    {
+        public:
+            canvas(unsigned int w, unsigned int h);
+            ~canvas();
+
+            void fgcolor(color fg);
+            void bgcolor(color bg);
+            color fgcolor();
+            color bgcolor();
+            void resize(unsigned int w, unsigned int h);
+            void draw(canvas& src, int srcx, int srcy, int srcw, int srch, int dstx, int dsty);
+            void draw(image &src, int dstx, int dsty);
+            void fillrect(int x, int y, int w, int h);
+            void rect(int x, int y, int w, int h); 
+            void line(int x1, int y1, int x2, int y2, int linewidth);
+            void circle(double x, double y, double r);
+            canvas_storage buf(void) { trycreate(); return m_buf; };
+            void buf(canvas_storage bufs) { m_buf = bufs; };
+            unsigned int w(void) { return m_w; };
+            unsigned int h(void) { return m_h; };
+            void w(unsigned int ws) { m_w = ws; };
+            void h(unsigned int hs) { m_h = hs; };
+            void fontsize(int s);
+            void text(const std::string & txt, int x, int y);
+
+        private:
+            bool m_init;
+            unsigned int m_w;
+            unsigned int m_h;
+            canvas_storage m_buf;
+
+            color m_fgcolor;
+            color m_bgcolor;
+
+            void trycreate(void);
+    };
+
+    // Draws straight into the window of the widget currently being drawn,
+    // with (x, y) as the origin. Only valid inside Fl_Widget::draw().
+    class screen : public drawable
+    {
+        public:
+            screen(int x, int y, unsigned int w, unsigned int h);
+            ~screen();
+
+            void fgcolor(color fg);
+            void bgcolor(color bg);
+            void fillrect(int x, int y, int w, int h);
+            void rect(int x, int y, int w, int h); 
+            void line(int x1, int y1, int x2, int y2, int linewidth);
+            void circle(double x, double y, double r);
+            void draw(image &src, int dstx, int dsty);
+            unsigned int w(void) { return m_w; };
+            unsigned int h(void) { return m_h; };
+            void fontsize(int s);
+            void text(const std::string & txt, int x, int y);
+
+        private:
+            int m_x;
+            int m_y;
+            unsigned int m_w;
+            unsigned int m_h;
+
+            color m_fgcolor;
+            color m_bgcolor;
+    };
+
+};
+
+#endif // FLGFX_HPP
+
@@ -0,0 +1,25 @@
+#include <X11/xpm.h>
+#include <FL/Fl.H>
+#include <FL/x.H>
+#include "event.hpp"
+#include "flutils.hpp"
+#include "florb.xpm"
+
+void florb::flutils::init()
+{
+    event_dispatch::handler(awake);
+}
+
+int florb::flutils::awake(void (*cb)(void*), void *data)
+{
+    return Fl::awake(cb, data);
+}
+
+void florb::flutils::set_window_icon(Fl_Window *w)
+{
+    fl_open_display();
+    Pixmap p, mask;
+    XpmCreatePixmapFromData(fl_display, DefaultRootWindow(fl_display), const_cast<char**>(florb_xpm), &p, &mask, NULL);
+    w->icon((char *)p);
+}
+
@@ -0,0 +1,23 @@
+#ifndef FLUTILS_HPP
+#define FLUTILS_HPP
+
+#include <FL/Fl_Window.H>
+
+namespace florb
+{
+    // FLTK specific helpers, kept apart from florb::utils which is part of
+    // the GUI independent core library
+    class flutils
+    {
+        public:
+            // Route florb::event_dispatch callbacks to the FLTK main loop
+            static void init();
+            static void set_window_icon(Fl_Window *w);
+
+        private:
+            static int awake(void (*cb)(void*), void *data);
+    };
+};
+
+#endif // FLUTILS_HPP
+
@@ -0,0 +1,60 @@
+#include "framescheduler.hpp"
+
+florb::framescheduler::framescheduler(unsigned int maxfps) :
+    m_maxfps(maxfps),
+    m_pending(0),
+    m_last(0.0),
+    m_frames(0),
+    m_invalidations(0)
+{
+}
+
+florb::framescheduler::~framescheduler()
+{
+}
+
+unsigned int florb::framescheduler::maxfps() const
+{
+    return m_maxfps;
+}
+
+void florb::framescheduler::maxfps(unsigned int fps)
+{
+    m_maxfps = fps;
+}
+
+bool florb::framescheduler::invalidate(unsigned int what)
+{
+    bool ret = (m_pending == 0);
+
+    m_pending |= what;
+    m_invalidations++;
+
+    return ret;
+}
+
+double florb::framescheduler::wait(double now) const
+{
+    // No limit or no frame yet
+    if ((m_maxfps == 0) || (m_frames == 0))
+        return 0.0;
+
+    double next = m_last + (1.0 / (double)m_maxfps);
+    return (next > now) ? (next - now) : 0.0;
+}
+
+unsigned int florb::framescheduler::frame(double now)
+{
+    unsigned int ret = m_pending;
+
+    m_pending = 0;
+    m_last = now;
+    m_frames++;
+
+    return ret;
+}
+
+bool florb::framescheduler::pending() const
+{
+    return (m_pending != 0);
+}
@@ -0,0 +1,56 @@
+#ifndef FRAMESCHEDULER_HPP
+#define FRAMESCHEDULER_HPP
+
+namespace florb
+{
+    // Collects invalidations of the map and paces the resulting frames.
+    // Invalidations arriving while a frame is pending are merged into it,
+    // and frames are never started more often than the configured rate. Time
+    // is passed in seconds so the scheduler works with any clock.
+    class framescheduler
+    {
+        public:
+            // What needs to be redrawn
+            enum
+            {
+                VIEWPORT    = (1 << 0),     // Viewport moved, map image is reused
+                TILES       = (1 << 1),     // Tile layers
+                TRACKS      = (1 << 2),     // GPX layer
+                MARKERS     = (1 << 3),     // Marker layer
+                SELECTION   = (1 << 4),     // Area selection layer
+                DEBUG       = (1 << 5),     // Tile debug overlay and HUD
+                LAYERS      = (TILES | TRACKS | MARKERS | SELECTION | DEBUG)
+            };
+
+            framescheduler(unsigned int maxfps);
+            ~framescheduler();
+
+            unsigned int maxfps() const;
+            void maxfps(unsigned int fps);
+
+            // Add an invalidation. Returns true if this starts a new pending
+            // frame, which the caller then schedules after wait() seconds.
+            bool invalidate(unsigned int what);
+
+            // Seconds until the pending frame may be started
+            double wait(double now) const;
+
+            // Start the pending frame and return what it has to redraw
+            unsigned int frame(double now);
+
+            bool pending() const;
+
+            // Number of frames started and invalidations merged into them
+            unsigned long frames() const { return m_frames; };
+            unsigned long invalidations() const { return m_invalidations; };
+
+        private:
+            unsigned int m_maxfps;
+            unsigned int m_pending;
+            double m_last;
+            unsigned long m_frames;
+            unsigned long m_invalidations;
+    };
+};
+
+#endif // FRAMESCHEDULER_HPP
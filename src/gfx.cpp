@@ -1,203 +1,361 @@
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <cmath>
+#include <csetjmp>
+#include <png.h>
+#include <jpeglib.h>
 #include "gfx.hpp"
-#include <iostream>
 
 namespace florb
 {
-    canvas::canvas(unsigned int w, unsigned int h) :
-        m_init(false), 
-        m_w(w), 
-        m_h(h),
-        m_fgcolor(0xffffff),
-        m_bgcolor(0x000000)
+    image::image(int type, void const * const buffer, int bufsize) :
+        m_type(type),
+        m_w(0),
+        m_h(0),
+        m_d(0)
     {
-    };
+        const unsigned char *b = static_cast<const unsigned char*>(buffer);
+        bool ok = false;
 
-    canvas::~canvas()
-    {
-        if (m_init)
+        switch (type)
+        {
+            case PNG:
+                {
+                    ok = decode_png(b, bufsize);
+                    break;
+                }
+            case JPG:
+                {
+                    ok = decode_jpg(b, bufsize);
+                    break;
+                }
+            default:
+                break;
+        }
+
+        // Broken image data results in an empty image
+        if (!ok)
         {
-            fl_delete_offscreen(m_buf);
+            m_w = m_h = m_d = 0;
+            m_data.clear();
         }
     };
 
-    void canvas::fgcolor(color c)
+    image::image(int w, int h, int d, const unsigned char *pixels) :
+        m_type(PNG),
+        m_w(w),
+        m_h(h),
+        m_d(d)
     {
-        m_fgcolor = c;
-    };
+        if ((w <= 0) || (h <= 0) || (d <= 0) || (pixels == NULL))
+        {
+            m_w = m_h = m_d = 0;
+            return;
+        }
 
-    void canvas::bgcolor(color c)
-    {
-        m_bgcolor = c;
+        m_data.assign(pixels, pixels + (w*h*d));
     };
 
-    color canvas::bgcolor()
+    image::image(image &src, int x, int y, int w, int h, int dw, int dh, int filter) :
+        m_type(src.type()),
+        m_w(0),
+        m_h(0),
+        m_d(src.d())
     {
-        return m_bgcolor;
+        // Clip the region to the source image
+        if ((x < 0) || (y < 0) || (w <= 0) || (h <= 0) || (dw <= 0) || (dh <= 0) ||
+            ((x+w) > src.w()) || ((y+h) > src.h()))
+        {
+            m_d = 0;
+            return;
+        }
+
+        m_w = dw;
+        m_h = dh;
+        m_data.resize(m_w*m_h*m_d);
+
+        if (filter == SMOOTH)
+            scale_smooth(src, x, y, w, h);
+        else
+            scale_nearest(src, x, y, w, h);
     };
 
-    color canvas::fgcolor()
+    void image::scale_nearest(image &src, int x, int y, int w, int h)
     {
-        return m_fgcolor;
-    }
+        // The source column offsets are the same for each row
+        std::vector<int> cols(m_w);
+        for (int dx=0;dx<m_w;dx++)
+            cols[dx] = (x + ((dx*w)/m_w))*m_d;
 
-    void canvas::resize(unsigned int w, unsigned int h)
-    {
-        m_w = (w > m_w) ? w : m_w;
-        m_h = (h > m_h) ? h : m_h;
+        const unsigned char *s = src.data();
+        int stride = m_w * m_d;
+        int lastrow = -1;
 
-        if (m_init) 
+        for (int dy=0;dy<m_h;dy++)
         {
-            fl_delete_offscreen(m_buf);
-            m_init = false;
-        }
+            unsigned char *d = &m_data[dy * stride];
 
-        trycreate();
+            // Enlarged images repeat source rows, copy the row above
+            int row = y + ((dy*h)/m_h);
+            if (row == lastrow)
+            {
+                memcpy(d, d - stride, stride);
+                continue;
+            }
+            lastrow = row;
+
+            const unsigned char *srow = s + (row*src.w()*m_d);
+            if (m_d == 4)
+            {
+                for (int dx=0;dx<m_w;dx++, d+=4)
+                    memcpy(d, srow+cols[dx], 4);
+            }
+            else
+            {
+                for (int dx=0;dx<m_w;dx++, d+=m_d)
+                    memcpy(d, srow+cols[dx], 3);
+            }
+        }
     };
 
-    void canvas::draw(canvas& src, int srcx, int srcy, int srcw, int srch, int dstx, int dsty)
+    namespace
     {
-        trycreate();
+        // Fixed point weights of one output pixel along one axis
+        const int WSHIFT = 14;
 
-        fl_begin_offscreen(m_buf);
-        fl_copy_offscreen(dstx, dsty, srcw, srch, src.buf(), srcx, srcy);
-        fl_end_offscreen();
-    };
+        struct taps
+        {
+            std::vector<int> first;
+            std::vector<int> count;
+            std::vector<int> offset;
+            std::vector<int> weights;
+        };
+
+        // Source pixels and weights for each of the dn output pixels covering
+        // n source pixels starting at s0. Two neighbours (bilinear) when
+        // enlarging, all covered pixels weighted by coverage (box) when
+        // shrinking.
+        void mktaps(int s0, int n, int dn, taps& t)
+        {
+            t.first.resize(dn);
+            t.count.resize(dn);
+            t.offset.resize(dn);
+            t.weights.clear();
 
-    void canvas::draw(image &src, int dstx, int dsty)
+            double scale = (double)n / (double)dn;
+            t.weights.reserve(dn * ((dn >= n) ? 2 : ((int)scale + 2)));
+            for (int i=0;i<dn;i++)
+            {
+                t.offset[i] = (int)t.weights.size();
+
+                if (dn >= n)
+                {
+                    double c = ((i + 0.5) * scale) - 0.5;
+                    c = (c < 0.0) ? 0.0 : ((c > (n-1)) ? (double)(n-1) : c);
+
+                    int i0 = (int)c;
+                    int i1 = (i0+1 < n) ? i0+1 : i0;
+                    int w1 = (int)((c - i0) * (1 << WSHIFT) + 0.5);
+
+                    t.first[i] = s0 + i0;
+                    t.count[i] = (i1 > i0) ? 2 : 1;
+                    t.weights.push_back((i1 > i0) ? (1 << WSHIFT) - w1 : (1 << WSHIFT));
+                    if (i1 > i0)
+                        t.weights.push_back(w1);
+                }
+                else
+                {
+                    double a = i * scale;
+                    double b = a + scale;
+                    int i0 = (int)a;
+                    int i1 = (int)std::ceil(b);
+                    i1 = (i1 > n) ? n : i1;
+
+                    // Weights by coverage, the remainder of the rounding goes
+                    // to the first pixel so they always sum up to one
+                    int sum = 0;
+                    for (int k=i0;k<i1;k++)
+                    {
+                        double lo = (k > a) ? (double)k : a;
+                        double hi = ((k+1) < b) ? (double)(k+1) : b;
+                        int wk = (int)(((hi - lo) / scale) * (1 << WSHIFT) + 0.5);
+                        t.weights.push_back(wk);
+                        sum += wk;
+                    }
+                    t.weights[t.offset[i]] += (1 << WSHIFT) - sum;
+
+                    t.first[i] = s0 + i0;
+                    t.count[i] = i1 - i0;
+                }
+            }
+        }
+    }
+
+    void image::scale_smooth(image &src, int x, int y, int w, int h)
     {
-        trycreate();
+        // Separable, rows first into a temporary image of dw x h, then the
+        // columns of that
+        taps tx, ty;
+        mktaps(x, w, m_w, tx);
+        mktaps(0, h, m_h, ty);
 
-        fl_begin_offscreen(m_buf);
+        const int rounding = 1 << (WSHIFT-1);
+        const unsigned char *s = src.data();
+        int sstride = src.w() * m_d;
+        int stride = m_w * m_d;
 
-        // PNG alpha blending does not work with negative offsets and automatic
-        // clipping so we need to calculate offset and bounding box ourselves
-        int offsx = 0, offsy = 0;
-        int dw = (w()-dstx), dh = (h()-dsty);
-        if (dstx < 0)
+        std::vector<unsigned char> tmp(stride * h);
+        for (int row=0;row<h;row++)
         {
-            offsx = -dstx;
-            dw = src.w() - offsx;
-            dstx = 0;
+            const unsigned char *srow = s + ((y + row) * sstride);
+            unsigned char *d = &tmp[row * stride];
+
+            for (int dx=0;dx<m_w;dx++)
+            {
+                const unsigned char *p = srow + (tx.first[dx] * m_d);
+                const int *wt = &tx.weights[tx.offset[dx]];
+                int n = tx.count[dx];
+
+                // Two neighbours is the common case when enlarging
+                if (n == 2)
+                {
+                    for (int c=0;c<m_d;c++)
+                        *d++ = (unsigned char)((rounding + (p[c] * wt[0]) + (p[m_d+c] * wt[1])) >> WSHIFT);
+                    continue;
+                }
+
+                for (int c=0;c<m_d;c++)
+                {
+                    int acc = rounding;
+                    for (int k=0;k<n;k++)
+                        acc += p[(k*m_d)+c] * wt[k];
+                    *d++ = (unsigned char)(acc >> WSHIFT);
+                }
+            }
         }
-        if (dsty < 0)
+
+        std::vector<int> acc(stride);
+        for (int dy=0;dy<m_h;dy++)
         {
-            offsy = -dsty;
-            dh = src.h() - offsy;
-            dsty = 0;
-        }
+            const int *wt = &ty.weights[ty.offset[dy]];
+            unsigned char *d = &m_data[dy * stride];
 
-        src.buf()->draw(dstx, dsty, dw, dh, offsx, offsy);
-        fl_end_offscreen();
-    };
+            if (ty.count[dy] == 1)
+            {
+                memcpy(d, &tmp[ty.first[dy] * stride], stride);
+                continue;
+            }
 
-    void canvas::fillrect(int x, int y, int w, int h)
-    {
-        fl_color(m_fgcolor.r(), m_fgcolor.g(), m_fgcolor.b());
-        fl_begin_offscreen(m_buf);
-        fl_rectf(x, y, w, h, m_fgcolor.r(), m_fgcolor.g(), m_fgcolor.b());
-        fl_end_offscreen();
-    };
+            if (ty.count[dy] == 2)
+            {
+                const unsigned char *p0 = &tmp[ty.first[dy] * stride];
+                const unsigned char *p1 = p0 + stride;
+                for (int i=0;i<stride;i++)
+                    d[i] = (unsigned char)((rounding + (p0[i] * wt[0]) + (p1[i] * wt[1])) >> WSHIFT);
+                continue;
+            }
 
-    void canvas::rect(int x, int y, int w, int h)
-    {
-        fl_color(m_fgcolor.r(), m_fgcolor.g(), m_fgcolor.b());
-        fl_begin_offscreen(m_buf);
-        fl_rect(x, y, w, h); 
-        fl_end_offscreen();
+            std::fill(acc.begin(), acc.end(), rounding);
+            for (int k=0;k<ty.count[dy];k++)
+            {
+                const unsigned char *p = &tmp[(ty.first[dy] + k) * stride];
+                for (int i=0;i<stride;i++)
+                    acc[i] += p[i] * wt[k];
+            }
+
+            for (int i=0;i<stride;i++)
+                d[i] = (unsigned char)(acc[i] >> WSHIFT);
+        }
     }
 
-    void canvas::line(int x1, int y1, int x2, int y2, int linewidth)
+    image::~image()
     {
-        fl_color(m_fgcolor.r(), m_fgcolor.g(), m_fgcolor.b());
-        fl_line_style(FL_SOLID, linewidth, NULL);
-        fl_begin_offscreen(m_buf);
-        fl_line(x1, y1, x2, y2);
-        fl_line_style(0);
-        fl_end_offscreen();
     };
 
-    void canvas::circle(double x, double y, double r)
+    bool image::decode_png(const unsigned char *buffer, int bufsize)
     {
-        fl_color(m_fgcolor.r(), m_fgcolor.g(), m_fgcolor.b());
-        fl_begin_offscreen(m_buf);
-        fl_circle(x, y, r);
-        fl_end_offscreen();
-    };
+        png_image png;
+        memset(&png, 0, sizeof(png));
+        png.version = PNG_IMAGE_VERSION;
 
-    void canvas::fontsize(int s)
-    {
-        fl_begin_offscreen(m_buf);
-        fl_font(FL_HELVETICA, s);
-        fl_end_offscreen();
-    };
+        if (png_image_begin_read_from_memory(&png, buffer, bufsize) == 0)
+            return false;
 
-    void canvas::text(const std::string & txt, int x, int y)
-    {
-        fl_begin_offscreen(m_buf);
-        fl_draw(txt.c_str(), x, y-fl_descent()+fl_height());
-        fl_end_offscreen();
-    };
+        // Keep the alpha channel only if there is one
+        png.format = (png.format & PNG_FORMAT_FLAG_ALPHA) ? PNG_FORMAT_RGBA : PNG_FORMAT_RGB;
 
-    void canvas::trycreate(void)
-    {
-        if (m_init)
-            return;
+        m_w = png.width;
+        m_h = png.height;
+        m_d = PNG_IMAGE_PIXEL_SIZE(png.format);
+        m_data.resize(PNG_IMAGE_SIZE(png));
+
+        if (png_image_finish_read(&png, NULL, &m_data[0], 0, NULL) == 0)
+        {
+            png_image_free(&png);
+            return false;
+        }
 
-        m_buf = fl_create_offscreen(m_w, m_h);
-        m_init = true;
+        return true;
     };
 
-    image::image(int type, void const * const buffer, int bufsize) :
-        m_type(type),
-        m_init(false),
-        m_buf(NULL)
+    namespace
     {
-        switch (type)
+        // libjpeg calls exit() on errors and prints warnings to stderr unless
+        // told otherwise
+        struct jpg_error
         {
-            case PNG:
-                {
-                    m_buf = new Fl_PNG_Image(NULL, static_cast<const unsigned char*>(buffer), bufsize);
-                    m_init = true;
-                    break;
-                }
-            case JPG:
-                {
-                    m_buf = new Fl_JPEG_Image(NULL, static_cast<const unsigned char*>(buffer));
-                    m_init = true;
-                    break;
-                }
-            default:
-                break;
+            struct jpeg_error_mgr mgr;
+            jmp_buf env;
+        };
+
+        void jpg_error_exit(j_common_ptr cinfo)
+        {
+            jpg_error *err = reinterpret_cast<jpg_error*>(cinfo->err);
+            longjmp(err->env, 1);
         }
-    };
 
-    image::~image()
-    {
-        if (m_init)
+        void jpg_output_message(j_common_ptr cinfo)
         {
-            delete m_buf;
         }
-    };
+    }
 
-    int image::w()
+    bool image::decode_jpg(const unsigned char *buffer, int bufsize)
     {
-        if (m_init)
+        struct jpeg_decompress_struct cinfo;
+        jpg_error err;
+
+        cinfo.err = jpeg_std_error(&err.mgr);
+        err.mgr.error_exit = jpg_error_exit;
+        err.mgr.output_message = jpg_output_message;
+
+        if (setjmp(err.env))
         {
-            return m_buf->w();
+            jpeg_destroy_decompress(&cinfo);
+            return false;
         }
 
-        return 0;
-    };
+        jpeg_create_decompress(&cinfo);
+        jpeg_mem_src(&cinfo, const_cast<unsigned char*>(buffer), bufsize);
+        jpeg_read_header(&cinfo, TRUE);
+        cinfo.out_color_space = JCS_RGB;
+        jpeg_start_decompress(&cinfo);
 
-    int image::h()
-    {
-        if (m_init)
+        m_w = cinfo.output_width;
+        m_h = cinfo.output_height;
+        m_d = 3;
+        m_data.resize(m_w*m_h*m_d);
+
+        while (cinfo.output_scanline < cinfo.output_height)
         {
-            return m_buf->h();
+            JSAMPROW row = &m_data[cinfo.output_scanline*m_w*m_d];
+            jpeg_read_scanlines(&cinfo, &row, 1);
         }
 
-        return 0;
-    };
+        jpeg_finish_decompress(&cinfo);
+        jpeg_destroy_decompress(&cinfo);
 
+        return true;
+    };
 }
 
@@ -1,19 +1,13 @@
 #ifndef GFX_HPP
 #define GFX_HPP
 
-#include <FL/x.H>
-#include <FL/Fl.H>
-#include <FL/fl_draw.H>
-#include <FL/Fl_PNG_Image.H>
-#include <FL/Fl_JPEG_Image.H>
 #include <string>
+#include <vector>
 
 namespace florb
 {
-    typedef Fl_Offscreen canvas_storage;
-    typedef Fl_Image* image_storage;
-
     class color;
+    class image;
 
     // Represents any kind of surface that can be drawn on
     class drawable
@@ -29,6 +23,7 @@ namespace florb
             virtual void bgcolor(color bg) = 0;
             virtual void fontsize(int s) = 0;
             virtual void text(const std::string & txt, int x, int y) = 0;
+            virtual void draw(image &src, int dstx, int dsty) = 0;
             
         private: 
     };
@@ -71,68 +66,53 @@ namespace florb
             unsigned char m_b;
     };
 
+    // A decoded PNG or JPG image, 3 (RGB) or 4 (RGBA) bytes per pixel row by
+    // row. Images which fail to decode are empty (0x0).
     class image
     {
         public:
             image(int type, void const * const buffer, int bufsize);
+
+            // Raw pixels, d bytes each
+            image(int w, int h, int d, const unsigned char *pixels);
+
+            // The region (x, y, w, h) of src scaled to dw x dh
+            image(image &src, int x, int y, int w, int h, int dw, int dh, int filter = NEAREST);
             ~image();
 
-            image_storage buf(void) { return m_buf; };
             int type() { return m_type; };
-            void buf(image_storage bufs) { m_buf = bufs; };
-            int w();
-            int h();
+            int w() { return m_w; };
+            int h() { return m_h; };
+            int d() { return m_d; };
+            const unsigned char* data() { return (m_data.size() > 0) ? &m_data[0] : NULL; };
+            std::size_t bytes() { return m_data.size(); };
 
             enum {
                 PNG,
                 JPG
             };
 
-        private:
-            int m_type;
-            bool m_init;
-            image_storage m_buf;
-    };
-
-    // An in-memory drawing buffer 
-    class canvas : public drawable
-    {
-        public:
-            canvas(unsigned int w, unsigned int h);
-            ~canvas();
-
-            void fgcolor(color fg);
-            void bgcolor(color bg);
-            color fgcolor();
-            color bgcolor();
-            void resize(unsigned int w, unsigned int h);
-            void draw(canvas& src, int srcx, int srcy, int srcw, int srch, int dstx, int dsty);
-            void draw(image &src, int dstx, int dsty);
-            void fillrect(int x, int y, int w, int h);
-            void rect(int x, int y, int w, int h); 
-            void line(int x1, int y1, int x2, int y2, int linewidth);
-            void circle(double x, double y, double r);
-            canvas_storage buf(void) { trycreate(); return m_buf; };
-            void buf(canvas_storage bufs) { m_buf = bufs; };
-            unsigned int w(void) { return m_w; };
-            unsigned int h(void) { return m_h; };
-            void w(unsigned int ws) { m_w = ws; };
-            void h(unsigned int hs) { m_h = hs; };
-            void fontsize(int s);
-            void text(const std::string & txt, int x, int y);
+            // Scaling filters. SMOOTH interpolates bilinear when enlarging
+            // and averages (box) when shrinking, in both cases about ten
+            // times the cost of NEAREST.
+            enum {
+                NEAREST,
+                SMOOTH
+            };
 
         private:
-            bool m_init;
-            unsigned int m_w;
-            unsigned int m_h;
-            canvas_storage m_buf;
+            void scale_nearest(image &src, int x, int y, int w, int h);
+            void scale_smooth(image &src, int x, int y, int w, int h);
 
-            color m_fgcolor;
-            color m_bgcolor;
+            bool decode_png(const unsigned char *buffer, int bufsize);
+            bool decode_jpg(const unsigned char *buffer, int bufsize);
 
-            void trycreate(void);
+            int m_type;
+            int m_w;
+            int m_h;
+            int m_d;
+            std::vector<unsigned char> m_data;
     };
-
 };
 
 #endif // GFX_HPP
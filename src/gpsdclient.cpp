@@ -1,16 +1,22 @@
+#include <cmath>
 #include "gpsdclient.hpp"
 #include "utils.hpp"
+#include "trace.hpp"
 
 florb::gpsdclient::gpsdclient(const std::string host, const std::string port) : 
     m_host(host),
     m_port(port),
     m_thread(NULL),
-    m_exit(false),
-    m_connected(false),
-    m_mode(FIX_NONE),
-    m_pos(0.0, 0.0),
-    m_track(0.0)
+    m_exit(false)
 {
+    m_state.connected = false;
+    m_state.mode = FIX_NONE;
+    m_state.lon = 0.0;
+    m_state.lat = 0.0;
+    m_state.track = 0.0;
+    m_state.speed = -1.0;
+    m_snapshot.store(m_state);
+
     m_thread = new boost::thread(boost::bind(&florb::gpsdclient::worker, this));
     if (!m_thread)
         throw std::runtime_error(_("GPSd error"));
@@ -43,104 +49,34 @@ void florb::gpsdclient::exit(bool e)
 
 void florb::gpsdclient::connected(bool c)
 {
-    m_mutex.lock();
-
     if (!c)
     {
-        m_mode = FIX_NONE;
-        m_track = 0.0;
-        m_pos.x(0.0);
-        m_pos.y(0.0);
-    }
-
-    m_connected = c;
-
-    m_mutex.unlock();
-}
-
-bool florb::gpsdclient::connected(void)
-{
-    m_mutex.lock();
-    bool ret = m_connected;
-    m_mutex.unlock();
-
-    return ret;   
-}
-
-void florb::gpsdclient::mode(int m)
-{
-    m_mutex.lock();
-
-    if (m == FIX_NONE)
-    {
-        m_track = 0.0;
-        m_pos.x(0.0);
-        m_pos.y(0.0);
+        m_state.mode = FIX_NONE;
+        m_state.track = 0.0;
+        m_state.speed = -1.0;
+        m_state.lon = 0.0;
+        m_state.lat = 0.0;
     }
 
-    m_mode = m;
-
-    m_mutex.unlock();
-}
-
-int florb::gpsdclient::mode(void)
-{
-    m_mutex.lock();
-    int ret = m_mode;
-    m_mutex.unlock();
-
-    return ret;   
+    m_state.connected = c;
+    m_snapshot.store(m_state);
 }
 
-void florb::gpsdclient::track(double t)
+florb::gpsdclient::state florb::gpsdclient::snapshot()
 {
-    m_mutex.lock();
-    m_track = t;
-    m_mutex.unlock();
-}
-
-double florb::gpsdclient::track(void)
-{
-    m_mutex.lock();
-    double ret = m_track;
-    m_mutex.unlock();
-
-    return ret;   
-}
-
-void florb::gpsdclient::pos(const florb::point2d<double>& p)
-{
-    m_mutex.lock();
-    m_pos = p;
-    m_mutex.unlock();
-}
-
-void florb::gpsdclient::pos(double lon, double lat)
-{
-    m_mutex.lock();
-    m_pos.x(lon);
-    m_pos.y(lat);
-    m_mutex.unlock();
-}
-
-
-florb::point2d<double> florb::gpsdclient::pos(void)
-{
-    m_mutex.lock();
-    florb::point2d<double> ret(m_pos);
-    m_mutex.unlock();
-
-    return ret;   
+    return m_snapshot.load();
 }
 
 void florb::gpsdclient::fire_event_gpsd(void)
 {
-    florb::gpsdclient::event_gpsd ge(m_connected, m_mode, m_pos, m_track);
+    florb::gpsdclient::event_gpsd ge(m_state.connected, m_state.mode, m_state.pos(), m_state.track, m_state.speed);
     fire(&ge);
 }
 
 void florb::gpsdclient::worker(void)
 {
+    florb::trace::thread_name("gpsd");
+
     int rc;
     for (;;)
     {
@@ -181,6 +117,7 @@ void florb::gpsdclient::worker(void)
         }
 
         // Read data
+        FLORB_TRACE("gpsdclient::read", "gpsd");
 #if GPSD_API_MAJOR_VERSION >= 7
         if (gps_read(&m_gpsdata, NULL, 0) == -1) {
 #else
@@ -221,20 +158,29 @@ bool florb::gpsdclient::handle_set()
             else if (m_gpsdata.fix.mode == MODE_3D) 
                 m = FIX_3D;
 
-            if (m_mode != m)
+            if (m_state.mode != m)
             {
                 ret = true;
-                mode(m);
+                m_state.mode = m;
+
+                if (m == FIX_NONE)
+                {
+                    m_state.track = 0.0;
+                    m_state.speed = -1.0;
+                    m_state.lon = 0.0;
+                    m_state.lat = 0.0;
+                }
             }
 
             // Handle latitude / longitude set
             if (m_gpsdata.set & LATLON_SET)
             {
                 // Handle latitude / longitude
-                if ((m_gpsdata.fix.latitude != m_pos.y()) ||
-                    (m_gpsdata.fix.longitude != m_pos.x())) 
+                if ((m_gpsdata.fix.latitude != m_state.lat) ||
+                    (m_gpsdata.fix.longitude != m_state.lon)) 
                 {
-                    pos(m_gpsdata.fix.longitude, m_gpsdata.fix.latitude);
+                    m_state.lon = m_gpsdata.fix.longitude;
+                    m_state.lat = m_gpsdata.fix.latitude;
                     ret = true;
                 }
             }
@@ -243,15 +189,29 @@ bool florb::gpsdclient::handle_set()
         // Handle track / course over ground info
         if (m_gpsdata.set & TRACK_SET)
         {
-            if (m_track != m_gpsdata.fix.track) {
-                track(m_gpsdata.fix.track);
+            if (m_state.track != m_gpsdata.fix.track) {
+                m_state.track = m_gpsdata.fix.track;
                 ret = true;
             }
         }
 
-        // FIre notification event if necessary.
+        // Handle speed over ground, NaN if unknown
+        if (m_gpsdata.set & SPEED_SET)
+        {
+            double v = std::isnan(m_gpsdata.fix.speed) ? -1.0 : m_gpsdata.fix.speed;
+            if (m_state.speed != v) {
+                m_state.speed = v;
+                ret = true;
+            }
+        }
+
+        // Publish the new state in one go and fire notification event if
+        // necessary.
         if (ret)
+        {
+            m_snapshot.store(m_state);
             fire_event_gpsd();
+        }
 
         break;
     }
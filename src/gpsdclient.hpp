@@ -7,6 +7,7 @@
 #include <gps.h>
 #include "event.hpp"
 #include "point.hpp"
+#include "seqlock.hpp"
 
 namespace florb
 {
@@ -16,25 +17,32 @@ namespace florb
             gpsdclient(const std::string host, const std::string port);
             ~gpsdclient();
 
-            bool connected(void);
-            int mode(void);
-            florb::point2d<double> pos(void);
-            double track(void);
-
             enum {
                 FIX_NONE, 
                 FIX_2D,
                 FIX_3D,
             };
 
+            // Consistent view of the receiver state. Plain data so it can be
+            // read lock-free through a seqlock.
+            struct state
+            {
+                bool connected;
+                int mode;
+                double lon;
+                double lat;
+                double track;
+                double speed;
+
+                florb::point2d<double> pos() const { return florb::point2d<double>(lon, lat); };
+            };
+
             class event_gpsd;
 
+            florb::gpsdclient::state snapshot();
+
         private:
             void connected(bool c);
-            void mode(int m);
-            void pos(const florb::point2d<double>& p);
-            void pos(double lon, double lat);
-            void track(double t);
 
             bool exit();
             void exit(bool e);
@@ -51,25 +59,29 @@ namespace florb
             boost::thread *m_thread;
 
             bool m_exit;
-            bool m_connected;
-            int m_mode;
-            florb::point2d<double> m_pos;
-            double m_track;
+
+            // Owned by the worker thread, published to readers through
+            // m_snapshot whenever it changes
+            florb::gpsdclient::state m_state;
+            florb::seqlock<florb::gpsdclient::state> m_snapshot;
     };
 
     class gpsdclient::event_gpsd : public event_base
     {
         public:
-            event_gpsd(bool c, int mode, const florb::point2d<double>& pos, double track) :
+            event_gpsd(bool c, int mode, const florb::point2d<double>& pos, double track, double speed) :
                 m_connected(c),
                 m_mode(mode),
                 m_pos(pos),
-                m_track(track) {};
+                m_track(track),
+                m_speed(speed) {};
             ~event_gpsd() {};
 
             int mode() const { return m_mode; };
             const florb::point2d<double>& pos() const { return m_pos; };
             double track() const { return m_track; };
+            // Speed over ground in m/s, negative if unknown
+            double speed() const { return m_speed; };
             bool connected() const { return m_connected; };
 
         private:
@@ -77,6 +89,7 @@ namespace florb
             int m_mode;
             florb::point2d<double> m_pos;
             double m_track;
+            double m_speed;
     };
 };
 
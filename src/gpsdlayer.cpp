@@ -1,19 +1,23 @@
 #include <cmath>
 #include <sstream>
+#include <boost/date_time/posix_time/posix_time.hpp>
 #include "gfx.hpp"
 #include "utils.hpp"
 #include "settings.hpp"
 #include "point.hpp"
 #include "gpsdlayer.hpp"
 
+const double florb::gpsdlayer::HORIZON = 2.0;
+const double florb::gpsdlayer::ALPHA = 0.6;
+const double florb::gpsdlayer::BETA = 0.3;
+const double florb::gpsdlayer::TURN = 0.5;
+
 florb::gpsdlayer::gpsdlayer() :
     layer(),
-    m_pos(0.0, 0.0),
-    m_track(0.0),
-    m_mode(gpsdclient::FIX_NONE),
-    m_valid(false),
-    m_connected(false),
-    m_gpsdclient(NULL)
+    m_gpsdclient(NULL),
+    m_gpsreplay(NULL),
+    m_interpolate(true),
+    m_timescale(1.0)
 {
     name(std::string("GPSD"));
     register_event_handler<gpsdlayer, florb::gpsdclient::event_gpsd>(this, &florb::gpsdlayer::handle_evt_gpsd);
@@ -23,102 +27,103 @@ florb::gpsdlayer::~gpsdlayer()
 {
     if (m_gpsdclient != NULL)
         delete m_gpsdclient;
-};
-
-const florb::point2d<double> florb::gpsdlayer::pos()
-{
-    m_mutex.lock();
-    florb::point2d<double> ptmp(m_pos);
-    m_mutex.unlock();
 
-    return ptmp;
-}
+    if (m_gpsreplay != NULL)
+        delete m_gpsreplay;
+};
 
-void florb::gpsdlayer::pos(florb::point2d<double> p) 
+florb::gpsdlayer::state florb::gpsdlayer::snapshot()
 {
-    m_mutex.lock();
-    m_pos = p;
-    m_mutex.unlock();
+    return m_state.load();
 }
 
-double florb::gpsdlayer::track()
+bool florb::gpsdlayer::interpolate() const
 {
-    m_mutex.lock();
-    double ret = m_track;
-    m_mutex.unlock();
-
-    return ret;
+    return m_interpolate;
 }
 
-void florb::gpsdlayer::track(double t) 
+void florb::gpsdlayer::interpolate(bool i)
 {
-    m_mutex.lock();
-    m_track = t;
-    m_mutex.unlock();
+    m_interpolate = i;
 }
 
-double florb::gpsdlayer::mode()
+double florb::gpsdlayer::now()
 {
-    m_mutex.lock();
-    int ret = m_mode;
-    m_mutex.unlock();
-
-    return ret;
+    static const boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+    return (double)(boost::posix_time::microsec_clock::universal_time() - epoch).total_microseconds() / 1e6;
 }
 
-void florb::gpsdlayer::mode(int m) 
+double florb::gpsdlayer::heading(const florb::gpsdlayer::state& s, double t)
 {
-    m_mutex.lock();
-    m_mode = m;
-    m_mutex.unlock();
+    // Turn from heading0 towards track along the shorter way
+    double d = fmod(s.track - s.heading0 + 540.0, 360.0) - 180.0;
+    double f = (t - s.t) / TURN;
+    if (f < 0.0)
+        f = 0.0;
+    if (f > 1.0)
+        f = 1.0;
+
+    return fmod(s.heading0 + (d*f) + 360.0, 360.0);
 }
 
-bool florb::gpsdlayer::valid(void)
+void florb::gpsdlayer::connect(const std::string& host, const std::string& port)
 {
-    m_mutex.lock();
-    bool ret = m_valid;
-    m_mutex.unlock();
+    // Disconnect first if necessary
+    disconnect();
 
-    return ret;
-}
+    try {
+    m_gpsdclient = new florb::gpsdclient(host, port);
+    } catch (std::runtime_error& e) {
+        throw e;
+    } 
 
-void florb::gpsdlayer::valid(bool v)
-{
-    m_mutex.lock();
-    m_valid = v;
-    m_mutex.unlock();
+    m_gpsdclient->add_event_listener(this);
 }
 
-bool florb::gpsdlayer::connected(void)
+void florb::gpsdlayer::replay(const std::string& path, double speed, const std::string& port)
 {
-    m_mutex.lock();
-    bool ret = m_connected;
-    m_mutex.unlock();
+    // Disconnect first if necessary
+    disconnect();
 
-    return ret;
-}
+    // Fixes come in faster or slower than in real time, as fast as
+    // possible there is no time base at all
+    m_timescale = (speed <= florb::gpsreplay::SPEED_MAX) ? 0.0 : speed;
 
-void florb::gpsdlayer::connected(bool c)
-{
-    m_mutex.lock();
-    m_connected = c;
-    m_mutex.unlock();
-}
+    // Replay events directly
+    if (port.empty())
+    {
+        m_gpsreplay = new florb::gpsreplay(path, speed);
+        m_gpsreplay->add_event_listener(this);
+        m_gpsreplay->start();
+        return;
+    }
 
-void florb::gpsdlayer::connect(const std::string& host, const std::string& port)
-{
-    // Disconnect first if necessary
-    disconnect();
+    // Act as a local gpsd and connect a regular client to it
+    m_gpsreplay = new florb::gpsreplay(path, speed, port);
+    m_gpsreplay->start();
 
     try {
-    m_gpsdclient = new florb::gpsdclient(host, port);
+        m_gpsdclient = new florb::gpsdclient("localhost", port);
     } catch (std::runtime_error& e) {
+        delete m_gpsreplay;
+        m_gpsreplay = NULL;
         throw e;
-    } 
+    }
 
     m_gpsdclient->add_event_listener(this);
 }
 
+bool florb::gpsdlayer::replaystats(std::size_t& fixes, double& rate)
+{
+    if (m_gpsreplay == NULL)
+        return false;
+
+    fixes = m_gpsreplay->fixes();
+    rate = m_gpsreplay->rate();
+
+    return true;
+}
+
 void florb::gpsdlayer::disconnect()
 {
     if (m_gpsdclient != NULL)
@@ -127,11 +132,15 @@ void florb::gpsdlayer::disconnect()
         m_gpsdclient = NULL;
     }
 
-    pos(florb::point2d<double>(0.0,0.0));
-    track(0.0);
-    mode(florb::gpsdclient::FIX_NONE);
-    valid(false);
-    connected(false);
+    if (m_gpsreplay != NULL)
+    {
+        delete m_gpsreplay;
+        m_gpsreplay = NULL;
+    }
+
+    // No more gpsd events after this point, so there is no concurrent writer
+    m_state.store(florb::gpsdlayer::state());
+    m_timescale = 1.0;
 
     fire_event_status();
 }
@@ -168,61 +177,195 @@ void florb::gpsdlayer::cb_fire_event_status(void* userdata)
 
 void florb::gpsdlayer::fire_event_motion()
 {
-    event_motion e(connected(), mode(), pos(), track());
+    florb::gpsdlayer::state s(m_state.load());
+    event_motion e(s.connected, s.mode, s.pos(), s.track);
     fire(&e);
 }
 
 void florb::gpsdlayer::fire_event_status()
 {
-    event_status e(connected(), mode());
+    florb::gpsdlayer::state s(m_state.load());
+    event_status e(s.connected, s.mode);
     fire(&e);
 }
 
 bool florb::gpsdlayer::handle_evt_gpsd(const florb::gpsdclient::event_gpsd *e)
 {
+    // Only the gpsd source thread writes the state, so reading it back here
+    // is not racy
+    florb::gpsdlayer::state s(m_state.load());
     bool motion = false;
 
+    // Update the motion model before the fix is overwritten
+    filter(s, e, now());
+
     // Found first fix or better quality fix
-    if (e->mode() > mode()) 
+    if (e->mode() > s.mode) 
         motion = true;
     // Motion >= 2m compared to the previous update
     else if (
-        (valid()) &&
+        (s.valid) &&
         ((e->mode() != florb::gpsdclient::FIX_NONE)) && 
-        (florb::utils::dist(pos(), e->pos()) >= 0.002))
+        (florb::utils::dist(s.pos(), e->pos()) >= 0.002))
         motion = true;
     
-    connected(e->connected());
-    mode(e->mode());
-    track(e->track());
+    s.connected = e->connected();
+    s.mode = e->mode();
+    s.track = e->track();
 
     if (motion) 
     {
-        valid(true);
-        pos(e->pos());
-        Fl::awake(cb_fire_event_motion, this);
+        s.valid = true;
+        s.lon = e->pos().x();
+        s.lat = e->pos().y();
     }
+
+    // Publish all changes at once
+    m_state.store(s);
+
+    if (motion)
+        event_dispatch::awake(cb_fire_event_motion, this);
     else
-    {
-        Fl::awake(cb_fire_event_status, this);
-    }
+        event_dispatch::awake(cb_fire_event_status, this);
 
     return true;
 };
 
-bool florb::gpsdlayer::draw(const viewport &viewport, florb::canvas &os)
+void florb::gpsdlayer::filter(florb::gpsdlayer::state& s, const florb::gpsdclient::event_gpsd *e, double t)
+{
+    // Lost the fix, stop predicting
+    if (e->mode() == florb::gpsdclient::FIX_NONE)
+    {
+        s.t = 0.0;
+        return;
+    }
+
+    double d2r = (M_PI/180.0);
+    double zlon = e->pos().x();
+    double zlat = e->pos().y();
+
+    // Velocity from speed over ground and track, if the receiver reports it.
+    // The filter runs on the wall clock, a replay moves m_timescale times as
+    // fast.
+    bool haveveloc = (e->speed() >= 0.0) && (m_timescale > 0.0);
+    double mvlon = 0.0, mvlat = 0.0;
+    if (haveveloc)
+    {
+        // Metres per degree latitude
+        double mpd = 111320.0;
+        double clat = cos(zlat*d2r);
+        double sog = e->speed() * m_timescale;
+
+        mvlat = (sog * cos(e->track()*d2r)) / mpd;
+        mvlon = (clat > 0.01) ? ((sog * sin(e->track()*d2r)) / (mpd*clat)) : 0.0;
+    }
+
+    double dt = t - s.t;
+
+    // First fix or the previous one is too old: restart at the measurement
+    if ((s.t <= 0.0) || (dt > (4.0*HORIZON)))
+    {
+        s.flon = zlon;
+        s.flat = zlat;
+        s.vlon = mvlon;
+        s.vlat = mvlat;
+        s.heading0 = e->track();
+        s.t = t;
+        return;
+    }
+
+    // Continue the turn from wherever the cursor is pointing right now
+    s.heading0 = heading(s, t);
+
+    // Several reports for the same epoch, just take the latest position
+    if (dt < 0.001)
+    {
+        s.flon = zlon;
+        s.flat = zlat;
+        return;
+    }
+
+    // Alpha-beta filter: predict, then correct by the residual
+    double plon = s.flon + (s.vlon*dt);
+    double plat = s.flat + (s.vlat*dt);
+    double rlon = zlon - plon;
+    double rlat = zlat - plat;
+
+    s.flon = plon + (ALPHA*rlon);
+    s.flat = plat + (ALPHA*rlat);
+
+    if (haveveloc)
+    {
+        s.vlon += ALPHA*(mvlon - s.vlon);
+        s.vlat += ALPHA*(mvlat - s.vlat);
+    }
+    else
+    {
+        s.vlon += (BETA*rlon)/dt;
+        s.vlat += (BETA*rlat)/dt;
+    }
+
+    s.t = t;
+}
+
+bool florb::gpsdlayer::predict(double t, florb::point2d<double>& pos, double& track)
 {
-    if (!m_gpsdclient)
+    if ((!m_gpsdclient) && (!m_gpsreplay))
+        return false;
+
+    florb::gpsdlayer::state s(m_state.load());
+    if (!s.valid)
+        return false;
+
+    // No motion model, stick to the last reported position
+    if ((!m_interpolate) || (s.t <= 0.0))
+    {
+        pos = s.pos();
+        track = s.track;
         return true;
+    }
 
-    if (!valid())
+    double dt = t - s.t;
+    if (dt < 0.0)
+        dt = 0.0;
+    if (dt > HORIZON)
+        dt = HORIZON;
+
+    double lon = s.flon + (s.vlon*dt);
+    double lat = s.flat + (s.vlat*dt);
+
+    // Stay inside the mercator projection
+    if (lon > 180.0)
+        lon -= 360.0;
+    if (lon < -180.0)
+        lon += 360.0;
+    if (lat > 85.0511)
+        lat = 85.0511;
+    if (lat < -85.0511)
+        lat = -85.0511;
+
+    pos = florb::point2d<double>(lon, lat);
+    track = heading(s, t);
+
+    return true;
+}
+
+bool florb::gpsdlayer::draw(const viewport &viewport, florb::drawable &os)
+{
+    return draw_cursor(viewport, os, now());
+}
+
+bool florb::gpsdlayer::draw_cursor(const viewport &viewport, florb::drawable &os, double when)
+{
+    florb::point2d<double> pos;
+    double t;
+    if (!predict(when, pos, t))
         return true;
 
     // TODO: Performance killer!!
     florb::cfg_ui cfgui = florb::settings::get_instance()["ui"].as<florb::cfg_ui>(); 
     florb::color color_cursor(cfgui.gpscursorcolor());
 
-    double t = track();
     double d2r = (M_PI/180.0);
     double csize = 17.0;
 
@@ -232,9 +375,8 @@ bool florb::gpsdlayer::draw(const viewport &viewport, florb::canvas &os)
     florb::point2d<int> p3((int)((cos((310.0+t)*d2r)*csize)), (int)(sin((310.0+t)*d2r)*csize));
 
     // Calculate current pixel position on the map
-    florb::point2d<unsigned long> pxpos(florb::utils::wsg842px(viewport.z(), pos()));
-    pxpos[0] -= viewport.x();
-    pxpos[1] -= viewport.y();
+    florb::point2d<unsigned long> pxabs(florb::utils::wsg842px(viewport.z(), pos));
+    florb::point2d<long> pxpos((long)pxabs.x() - (long)viewport.x(), (long)pxabs.y() - (long)viewport.y());
 
     // Draw cursor
     os.fgcolor(color_cursor);
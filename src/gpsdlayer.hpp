@@ -1,11 +1,12 @@
 #ifndef GPSDLAYER_HPP
 #define GPSDLAYER_HPP
 
-#include <boost/interprocess/sync/interprocess_mutex.hpp>
 #include "point.hpp"
+#include "seqlock.hpp"
 #include "layer.hpp"
 #include "viewport.hpp"
 #include "gpsdclient.hpp"
+#include "gpsreplay.hpp"
 
 namespace florb
 {
@@ -16,40 +17,76 @@ namespace florb
             gpsdlayer();
             ~gpsdlayer();
 
-            bool draw(const florb::viewport &viewport, florb::canvas &os);
-
-            const florb::point2d<double> pos();
-            double track(); 
-            double mode();
-            bool valid();
-            bool connected();
+            bool draw(const florb::viewport &viewport, florb::drawable &os);
+            bool draw_cursor(const florb::viewport &viewport, florb::drawable &os, double t);
+
+            // Everything draw() and the event handlers need to know about
+            // the current fix, read in one consistent, lock-free step
+            struct state
+            {
+                bool connected;
+                int mode;
+                bool valid;
+                double lon;
+                double lat;
+                double track;
+
+                // Constant velocity motion model, estimated position and
+                // velocity (deg/s) at time t, heading turning from heading0
+                // towards track
+                double t;
+                double flon;
+                double flat;
+                double vlon;
+                double vlat;
+                double heading0;
+
+                florb::point2d<double> pos() const { return florb::point2d<double>(lon, lat); };
+            };
+
+            florb::gpsdlayer::state snapshot();
+
+            // Cursor position and heading predicted for time t, false if
+            // there is no valid fix
+            bool predict(double t, florb::point2d<double>& pos, double& track);
+            bool interpolate() const;
+            void interpolate(bool i);
+            static double now();
+
+            // Time after which the prediction stops
+            static const double HORIZON;
             void connect(const std::string& host, const std::string& port);
+            void replay(const std::string& path, double speed, const std::string& port);
             void disconnect();
 
+            // Fixes delivered by the running replay and their rate per
+            // second, false if no replay is running
+            bool replaystats(std::size_t& fixes, double& rate);
+
             class event_status;
             class event_motion;
         private:
-            void pos(florb::point2d<double> p);
-            void track(double t); 
-            void mode(int m);
-            void valid(bool v);
-            void connected(bool c);
-
             static void cb_fire_event_motion(void* userdata);
             static void cb_fire_event_status(void* userdata);
             void fire_event_motion();
             void fire_event_status();
+            void filter(florb::gpsdlayer::state& s, const florb::gpsdclient::event_gpsd *e, double t);
+            static double heading(const florb::gpsdlayer::state& s, double t);
 
-            florb::point2d<double> m_pos;
-            double m_track;
-            int m_mode;
-            bool m_valid;
-            bool m_connected;
+            static const double ALPHA;
+            static const double BETA;
+            static const double TURN;
+
+            florb::seqlock<florb::gpsdlayer::state> m_state;
 
             bool handle_evt_gpsd(const florb::gpsdclient::event_gpsd *e);
             florb::gpsdclient *m_gpsdclient;
+            florb::gpsreplay *m_gpsreplay;
+            bool m_interpolate;
 
-            boost::interprocess::interprocess_mutex m_mutex;
+            // Fix time per wall clock second, 1 for a live receiver, 0 for
+            // a replay as fast as possible
+            double m_timescale;
     };
 
     class gpsdlayer::event_status : public event_base
@@ -0,0 +1,655 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "utils.hpp"
+#include "gpsreplay.hpp"
+
+const double florb::gpsreplay::SPEED_MAX = 0.0;
+
+// Split a comma separated NMEA sentence. Other than utils::str_split empty
+// fields are preserved because NMEA field positions are significant.
+static std::vector<std::string> nmea_fields(const std::string& s)
+{
+    std::vector<std::string> ret;
+    std::size_t p1 = 0, p2;
+    while ((p2 = s.find(',', p1)) != std::string::npos)
+    {
+        ret.push_back(s.substr(p1, p2-p1));
+        p1 = p2 + 1;
+    }
+    ret.push_back(s.substr(p1));
+
+    return ret;
+}
+
+// NMEA (d)ddmm.mmmm to decimal degrees
+static bool nmea_deg(const std::string& v, const std::string& hemi, double& out)
+{
+    double raw;
+    if ((v.length() == 0) || (!florb::utils::fromstr(v, raw)))
+        return false;
+
+    out = floor(raw/100.0) + (fmod(raw, 100.0)/60.0);
+    if ((hemi == "S") || (hemi == "W"))
+        out = -out;
+
+    return true;
+}
+
+// NMEA hhmmss.sss to seconds of the day
+static bool nmea_time(const std::string& v, double& out)
+{
+    double raw;
+    if ((v.length() < 6) || (!florb::utils::fromstr(v, raw)))
+        return false;
+
+    int hms = (int)raw;
+    out = (hms/10000)*3600.0 + ((hms/100)%100)*60.0 + (hms%100) + (raw-(double)hms);
+
+    return true;
+}
+
+// Extract a top level value from a single line gpsd JSON object. Good enough
+// for the flat TPV reports, no general purpose JSON parser.
+static bool json_value(const std::string& line, const std::string& key, std::string& val)
+{
+    std::size_t p = line.find("\"" + key + "\":");
+    if (p == std::string::npos)
+        return false;
+
+    p += key.length() + 3;
+    while ((p < line.length()) && (line[p] == ' '))
+        p++;
+
+    if (p >= line.length())
+        return false;
+
+    std::size_t e;
+    if (line[p] == '"')
+    {
+        p++;
+        e = line.find('"', p);
+    }
+    else
+    {
+        e = line.find_first_of(",}", p);
+    }
+
+    if (e == std::string::npos)
+        return false;
+
+    val = line.substr(p, e-p);
+    return true;
+}
+
+florb::gpsreplay::gpsreplay(const std::string& path, double speed) :
+    m_thread(NULL),
+    m_speed(speed),
+    m_sock(-1),
+    m_exit(false),
+    m_done(false),
+    m_fixes(0),
+    m_connected(false),
+    m_mode(florb::gpsdclient::FIX_NONE),
+    m_pos(0.0, 0.0),
+    m_track(0.0),
+    m_sog(-1.0)
+{
+    load(path);
+}
+
+florb::gpsreplay::gpsreplay(const std::string& path, double speed, const std::string& port) :
+    m_thread(NULL),
+    m_speed(speed),
+    m_sock(-1),
+    m_exit(false),
+    m_done(false),
+    m_fixes(0),
+    m_connected(false),
+    m_mode(florb::gpsdclient::FIX_NONE),
+    m_pos(0.0, 0.0),
+    m_track(0.0),
+    m_sog(-1.0)
+{
+    load(path);
+
+    // Listen before returning so a gpsdclient can connect right away
+    listen(port);
+}
+
+florb::gpsreplay::~gpsreplay()
+{
+    if (m_thread)
+    {
+        exit(true);
+        m_thread->join();
+        delete m_thread;
+    }
+
+    if (m_sock >= 0)
+        close(m_sock);
+}
+
+void florb::gpsreplay::start()
+{
+    // Started separately so listeners can be attached before the first event
+    if (m_thread)
+        return;
+
+    m_thread = new boost::thread(boost::bind(&florb::gpsreplay::worker, this));
+    if (!m_thread)
+        throw std::runtime_error(_("GPS replay error"));
+}
+
+void florb::gpsreplay::load(const std::string& path)
+{
+    std::ifstream f(path.c_str());
+    if (!f.is_open())
+        throw std::runtime_error(_("Failed to open GPS log"));
+
+    record r;
+    r.t = 0.0;
+    r.mode = florb::gpsdclient::FIX_NONE;
+    r.track = 0.0;
+    r.speed = -1.0;
+
+    double toffs = 0.0;
+    std::string line;
+    while (std::getline(f, line))
+    {
+        if ((line.length() > 0) && (line[line.length()-1] == '\r'))
+            line.erase(line.length()-1);
+        if (line.length() == 0)
+            continue;
+
+        bool fix = false;
+        if (line[0] == '$')
+            fix = parse_nmea(line, r);
+        else if (line[0] == '{')
+            fix = parse_json(line, r);
+
+        if (!fix)
+            continue;
+
+        record rtmp(r);
+
+        // NMEA timestamps wrap around at midnight
+        if ((m_records.size() > 0) && ((rtmp.t+toffs) < (m_records.back().t-43200.0)))
+            toffs += 86400.0;
+        rtmp.t += toffs;
+
+        // Several sentences describing the same epoch make up one fix
+        if ((m_records.size() > 0) && (m_records.back().t == rtmp.t))
+            m_records.back() = rtmp;
+        else
+            m_records.push_back(rtmp);
+    }
+
+    if (m_records.size() == 0)
+        throw std::runtime_error(_("No fixes found in GPS log"));
+}
+
+bool florb::gpsreplay::parse_nmea(const std::string& line, record& r)
+{
+    std::string sentence(line.substr(1));
+
+    // Validate the checksum if there is one
+    std::size_t star = sentence.find('*');
+    if (star != std::string::npos)
+    {
+        unsigned int cs = 0;
+        for (std::size_t i=0;i<star;i++)
+            cs ^= (unsigned char)sentence[i];
+
+        if (strtoul(sentence.substr(star+1, 2).c_str(), NULL, 16) != cs)
+            return false;
+
+        sentence.erase(star);
+    }
+
+    std::vector<std::string> f(nmea_fields(sentence));
+    if ((f.size() < 3) || (f[0].length() != 5))
+        return false;
+
+    std::string type(f[0].substr(2));
+    bool ret = false;
+
+    for (;;)
+    {
+        // Fix type, no position of its own
+        if ((type == "GSA") && (f.size() > 2))
+        {
+            if (f[2] == "3")
+                r.mode = florb::gpsdclient::FIX_3D;
+            else if (f[2] == "2")
+                r.mode = florb::gpsdclient::FIX_2D;
+            else
+                r.mode = florb::gpsdclient::FIX_NONE;
+
+            break;
+        }
+
+        // Recommended minimum data
+        if ((type == "RMC") && (f.size() > 8))
+        {
+            if (!nmea_time(f[1], r.t))
+                break;
+
+            ret = true;
+
+            double lat, lon;
+            if ((f[2] != "A") ||
+                (!nmea_deg(f[3], f[4], lat)) ||
+                (!nmea_deg(f[5], f[6], lon)))
+            {
+                r.mode = florb::gpsdclient::FIX_NONE;
+                break;
+            }
+
+            r.pos = florb::point2d<double>(lon, lat);
+            if (f[8].length() > 0)
+                florb::utils::fromstr(f[8], r.track);
+
+            // Knots to m/s
+            double knots;
+            if ((f[7].length() > 0) && (florb::utils::fromstr(f[7], knots)))
+                r.speed = knots * 0.514444;
+            if (r.mode == florb::gpsdclient::FIX_NONE)
+                r.mode = florb::gpsdclient::FIX_2D;
+
+            break;
+        }
+
+        // Fix data
+        if ((type == "GGA") && (f.size() > 6))
+        {
+            if (!nmea_time(f[1], r.t))
+                break;
+
+            ret = true;
+
+            double lat, lon;
+            if ((f[6] == "0") ||
+                (!nmea_deg(f[2], f[3], lat)) ||
+                (!nmea_deg(f[4], f[5], lon)))
+            {
+                r.mode = florb::gpsdclient::FIX_NONE;
+                break;
+            }
+
+            r.pos = florb::point2d<double>(lon, lat);
+            if (r.mode == florb::gpsdclient::FIX_NONE)
+                r.mode = florb::gpsdclient::FIX_2D;
+
+            break;
+        }
+
+        break;
+    }
+
+    return ret;
+}
+
+bool florb::gpsreplay::parse_json(const std::string& line, record& r)
+{
+    std::string val;
+
+    // Only time-position-velocity reports are of interest
+    if ((!json_value(line, "class", val)) || (val != "TPV"))
+        return false;
+
+    // Timestamp, ISO8601 for recent gpsd versions, seconds for older ones
+    if (!json_value(line, "time", val))
+        return false;
+
+    if (line.find("\"time\":\"") != std::string::npos)
+    {
+        struct tm stm;
+        memset(&stm, 0, sizeof(stm));
+        const char *frac = strptime(val.c_str(), "%Y-%m-%dT%H:%M:%S", &stm);
+        if (!frac)
+            return false;
+
+        r.t = (double)timegm(&stm);
+
+        double f = 0.0;
+        if ((*frac == '.') && (florb::utils::fromstr(std::string("0") + std::string(frac).substr(0, strcspn(frac, "Z")), f)))
+            r.t += f;
+    }
+    else if (!florb::utils::fromstr(val, r.t))
+    {
+        return false;
+    }
+
+    int mode = 0;
+    if (json_value(line, "mode", val))
+        florb::utils::fromstr(val, mode);
+
+    double lat, lon;
+    if ((mode < 2) ||
+        (!json_value(line, "lat", val)) || (!florb::utils::fromstr(val, lat)) ||
+        (!json_value(line, "lon", val)) || (!florb::utils::fromstr(val, lon)))
+    {
+        r.mode = florb::gpsdclient::FIX_NONE;
+        return true;
+    }
+
+    r.mode = (mode == 3) ? florb::gpsdclient::FIX_3D : florb::gpsdclient::FIX_2D;
+    r.pos = florb::point2d<double>(lon, lat);
+
+    if (json_value(line, "track", val))
+        florb::utils::fromstr(val, r.track);
+
+    if (json_value(line, "speed", val))
+        florb::utils::fromstr(val, r.speed);
+
+    return true;
+}
+
+void florb::gpsreplay::listen(const std::string& port)
+{
+    int p = 0;
+    if ((!florb::utils::fromstr(port, p)) || (p <= 0) || (p > 65535))
+        throw std::runtime_error(_("Invalid GPS replay port"));
+
+    int rc = -1;
+    for (;;)
+    {
+        m_sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (m_sock < 0)
+            break;
+
+        int on = 1;
+        setsockopt(m_sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(p);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        if (bind(m_sock, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+            break;
+
+        if (::listen(m_sock, 1) != 0)
+            break;
+
+        rc = 0;
+        break;
+    }
+
+    if (rc != 0)
+    {
+        if (m_sock >= 0)
+            close(m_sock);
+        m_sock = -1;
+
+        throw std::runtime_error(_("GPS replay error"));
+    }
+}
+
+bool florb::gpsreplay::exit()
+{
+    m_mutex.lock();
+    bool ret = m_exit;
+    m_mutex.unlock();
+
+    return ret;
+}
+
+void florb::gpsreplay::exit(bool e)
+{
+    m_mutex.lock();
+    m_exit = e;
+    m_mutex.unlock();
+}
+
+bool florb::gpsreplay::done()
+{
+    m_mutex.lock();
+    bool ret = m_done;
+    m_mutex.unlock();
+
+    return ret;
+}
+
+void florb::gpsreplay::done(bool d)
+{
+    m_mutex.lock();
+    m_done = d;
+    m_mutex.unlock();
+}
+
+std::size_t florb::gpsreplay::fixes()
+{
+    m_mutex.lock();
+    std::size_t ret = m_fixes;
+    m_mutex.unlock();
+
+    return ret;
+}
+
+double florb::gpsreplay::rate()
+{
+    m_mutex.lock();
+    std::size_t n = m_fixes;
+    boost::posix_time::ptime start = m_start;
+    m_mutex.unlock();
+
+    if (start.is_not_a_date_time())
+        return 0.0;
+
+    double dt = (double)(boost::posix_time::microsec_clock::universal_time() - start).total_microseconds() / 1e6;
+    return (dt > 0.0) ? ((double)n / dt) : 0.0;
+}
+
+bool florb::gpsreplay::pace(double t0, double t, boost::posix_time::ptime start)
+{
+    if (m_speed <= SPEED_MAX)
+        return !exit();
+
+    boost::posix_time::ptime target = start +
+        boost::posix_time::microseconds((long)(((t - t0) / m_speed) * 1e6));
+
+    // Sleep in small steps so an exit request is handled timely
+    for (;;)
+    {
+        if (exit())
+            return false;
+
+        boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+        if (now >= target)
+            break;
+
+        boost::posix_time::time_duration d = target - now;
+        if (d > boost::posix_time::milliseconds(200))
+            d = boost::posix_time::milliseconds(200);
+
+        boost::this_thread::sleep(d);
+    }
+
+    return true;
+}
+
+void florb::gpsreplay::fire_event_gpsd(void)
+{
+    florb::gpsdclient::event_gpsd ge(m_connected, m_mode, m_pos, m_track, m_sog);
+    fire(&ge);
+}
+
+void florb::gpsreplay::deliver(const record& r)
+{
+    // Same change detection as gpsdclient::handle_set() so listeners see the
+    // same event stream a live gpsd connection would produce
+    bool ret = false;
+
+    if (m_mode != r.mode)
+    {
+        m_mode = r.mode;
+        if (m_mode == florb::gpsdclient::FIX_NONE)
+        {
+            m_pos = florb::point2d<double>(0.0, 0.0);
+            m_track = 0.0;
+            m_sog = -1.0;
+        }
+
+        ret = true;
+    }
+
+    if (m_mode != florb::gpsdclient::FIX_NONE)
+    {
+        if (!(m_pos == r.pos))
+        {
+            m_pos = r.pos;
+            ret = true;
+        }
+
+        if (m_track != r.track)
+        {
+            m_track = r.track;
+            ret = true;
+        }
+
+        if (m_sog != r.speed)
+        {
+            m_sog = r.speed;
+            ret = true;
+        }
+    }
+
+    if (ret)
+        fire_event_gpsd();
+}
+
+bool florb::gpsreplay::serve(int fd, const record& r)
+{
+    std::ostringstream oss;
+    oss.setf(std::ios::fixed, std::ios::floatfield);
+
+    int mode = 1;
+    if (r.mode == florb::gpsdclient::FIX_2D)
+        mode = 2;
+    else if (r.mode == florb::gpsdclient::FIX_3D)
+        mode = 3;
+
+    oss << "{\"class\":\"TPV\",\"device\":\"replay\",\"mode\":" << mode;
+    if (r.mode != florb::gpsdclient::FIX_NONE)
+    {
+        oss << std::setprecision(9);
+        oss << ",\"lat\":" << r.pos.y() << ",\"lon\":" << r.pos.x();
+        oss << std::setprecision(3);
+        oss << ",\"track\":" << r.track;
+        if (r.speed >= 0.0)
+            oss << ",\"speed\":" << r.speed;
+    }
+    oss << "}\r\n";
+
+    std::string s(oss.str());
+    return (send(fd, s.c_str(), s.length(), MSG_NOSIGNAL) == (ssize_t)s.length());
+}
+
+void florb::gpsreplay::worker(void)
+{
+    int fd = -1;
+
+    // gpsd stand-in, wait for a client to connect
+    if (m_sock >= 0)
+    {
+        for (;;)
+        {
+            if (exit())
+                break;
+
+            struct pollfd pfd;
+            pfd.fd = m_sock;
+            pfd.events = POLLIN;
+            if (poll(&pfd, 1, 200) <= 0)
+                continue;
+
+            fd = accept(m_sock, NULL, NULL);
+            if (fd >= 0)
+                break;
+        }
+
+        if (fd < 0)
+        {
+            done(true);
+            return;
+        }
+
+        // Greet the client like gpsd does and swallow its ?WATCH request
+        std::string greet("{\"class\":\"VERSION\",\"release\":\"florb-replay\",\"rev\":\"\",\"proto_major\":3,\"proto_minor\":11}\r\n");
+        send(fd, greet.c_str(), greet.length(), MSG_NOSIGNAL);
+
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 1000) > 0)
+        {
+            char buf[256];
+            if (recv(fd, buf, sizeof(buf), 0) < 0)
+            {
+                close(fd);
+                done(true);
+                return;
+            }
+        }
+    }
+    else
+    {
+        m_connected = true;
+        fire_event_gpsd();
+    }
+
+    boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+    m_mutex.lock();
+    m_start = start;
+    m_mutex.unlock();
+
+    std::vector<record>::iterator it;
+    for (it=m_records.begin();it!=m_records.end();++it)
+    {
+        if (!pace(m_records.front().t, (*it).t, start))
+            break;
+
+        if (fd >= 0)
+        {
+            if (!serve(fd, *it))
+                break;
+        }
+        else
+        {
+            deliver(*it);
+        }
+
+        m_mutex.lock();
+        m_fixes++;
+        m_mutex.unlock();
+    }
+
+    // End of the log, behave like a dropped gpsd connection
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    else
+    {
+        m_connected = false;
+        m_mode = florb::gpsdclient::FIX_NONE;
+        m_pos = florb::point2d<double>(0.0, 0.0);
+        m_track = 0.0;
+        m_sog = -1.0;
+        fire_event_gpsd();
+    }
+
+    done(true);
+}
+
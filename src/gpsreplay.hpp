@@ -0,0 +1,78 @@
+#ifndef GPSREPLAY_HPP
+#define GPSREPLAY_HPP
+
+#include <string>
+#include <vector>
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/interprocess/sync/interprocess_mutex.hpp>
+#include "event.hpp"
+#include "point.hpp"
+#include "gpsdclient.hpp"
+
+namespace florb
+{
+    // Replays a recorded NMEA log or gpsd JSON capture (gpspipe -r / -w). The
+    // recorded fixes are either fired as gpsdclient::event_gpsd events, just
+    // like a live gpsdclient would do, or served over a local TCP socket to
+    // act as a gpsd stand-in for a regular gpsdclient.
+    class gpsreplay : public event_generator
+    {
+        public:
+            gpsreplay(const std::string& path, double speed);
+            gpsreplay(const std::string& path, double speed, const std::string& port);
+            ~gpsreplay();
+
+            void start();
+            bool done();
+            std::size_t fixes();
+            double rate();
+
+            // Replay speed factor to replay as fast as possible
+            static const double SPEED_MAX;
+
+        private:
+            struct record {
+                double t;
+                int mode;
+                florb::point2d<double> pos;
+                double track;
+                double speed;
+            };
+
+            void load(const std::string& path);
+            bool parse_nmea(const std::string& line, record& r);
+            bool parse_json(const std::string& line, record& r);
+            void listen(const std::string& port);
+
+            bool exit();
+            void exit(bool e);
+            void done(bool d);
+            void worker(void);
+            bool pace(double t0, double t, boost::posix_time::ptime start);
+            void deliver(const record& r);
+            bool serve(int fd, const record& r);
+
+            void fire_event_gpsd(void);
+
+            std::vector<record> m_records;
+            boost::interprocess::interprocess_mutex m_mutex;
+            boost::thread *m_thread;
+            boost::posix_time::ptime m_start;
+
+            double m_speed;
+            int m_sock;
+            bool m_exit;
+            bool m_done;
+            std::size_t m_fixes;
+
+            bool m_connected;
+            int m_mode;
+            florb::point2d<double> m_pos;
+            double m_track;
+            double m_sog;
+    };
+};
+
+#endif // GPSREPLAY_HPP
+
@@ -0,0 +1,109 @@
+#include "histogram.hpp"
+
+const unsigned int florb::histogram::SUBBITS;
+const unsigned int florb::histogram::MAXBITS;
+const unsigned int florb::histogram::NBUCKETS;
+
+florb::histogram::histogram()
+{
+    reset();
+}
+
+void florb::histogram::reset()
+{
+    for (unsigned int i=0;i<NBUCKETS;i++)
+        m_buckets[i].store(0, std::memory_order_relaxed);
+
+    m_count.store(0, std::memory_order_relaxed);
+    m_sum.store(0, std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+}
+
+unsigned int florb::histogram::index(uint64_t v)
+{
+    // Values below 2^SUBBITS get a bucket of their own
+    if (v < (1ULL << SUBBITS))
+        return (unsigned int)v;
+
+    // Clamp values beyond the range to the last bucket
+    if (v >= (1ULL << MAXBITS))
+        return NBUCKETS-1;
+
+    // Position of the highest bit, the next SUBBITS bits select the
+    // sub-bucket
+    unsigned int msb = 63 - __builtin_clzll(v);
+    unsigned int sub = (unsigned int)(v >> (msb - SUBBITS)) & ((1U << SUBBITS) - 1);
+
+    return ((msb - SUBBITS + 1) << SUBBITS) + sub;
+}
+
+uint64_t florb::histogram::upper(unsigned int idx)
+{
+    if (idx < (1U << SUBBITS))
+        return idx;
+
+    unsigned int msb = (idx >> SUBBITS) + SUBBITS - 1;
+    uint64_t sub = idx & ((1U << SUBBITS) - 1);
+
+    return (((1ULL << SUBBITS) + sub + 1) << (msb - SUBBITS)) - 1;
+}
+
+void florb::histogram::record(uint64_t v)
+{
+    m_buckets[index(v)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(v, std::memory_order_relaxed);
+
+    uint64_t max = m_max.load(std::memory_order_relaxed);
+    while ((v > max) && (!m_max.compare_exchange_weak(max, v, std::memory_order_relaxed)));
+}
+
+uint64_t florb::histogram::count() const
+{
+    return m_count.load(std::memory_order_relaxed);
+}
+
+uint64_t florb::histogram::max() const
+{
+    return m_max.load(std::memory_order_relaxed);
+}
+
+double florb::histogram::mean() const
+{
+    uint64_t n = count();
+    if (n == 0)
+        return 0.0;
+
+    return (double)m_sum.load(std::memory_order_relaxed) / (double)n;
+}
+
+uint64_t florb::histogram::percentile(double p) const
+{
+    // Sum up the buckets instead of using m_count, a concurrent record()
+    // might have updated only one of them
+    uint64_t total = 0;
+    for (unsigned int i=0;i<NBUCKETS;i++)
+        total += m_buckets[i].load(std::memory_order_relaxed);
+
+    if (total == 0)
+        return 0;
+
+    p = (p < 0.0) ? 0.0 : ((p > 100.0) ? 100.0 : p);
+    uint64_t rank = (uint64_t)((p / 100.0) * (double)total + 0.5);
+    rank = (rank < 1) ? 1 : rank;
+
+    uint64_t seen = 0;
+    for (unsigned int i=0;i<NBUCKETS;i++)
+    {
+        seen += m_buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank)
+        {
+            uint64_t u = upper(i);
+            uint64_t m = max();
+            return ((m > 0) && (u > m)) ? m : u;
+        }
+    }
+
+    return max();
+}
+
@@ -0,0 +1,44 @@
+#ifndef HISTOGRAM_HPP
+#define HISTOGRAM_HPP
+
+#include <atomic>
+#include <cstdint>
+
+namespace florb
+{
+    // Latency histogram with logarithmic buckets in the style of HdrHistogram:
+    // Each power of two is split into 16 linear sub-buckets, which keeps the
+    // relative error below 6.25% from 1 to 2^40. Recording is lock-free and
+    // may happen from any thread, readers get an approximate snapshot.
+    class histogram
+    {
+        public:
+            histogram();
+
+            void record(uint64_t v);
+            void reset();
+
+            uint64_t count() const;
+            uint64_t max() const;
+            double mean() const;
+
+            // Highest value equivalent to the given percentile (0..100)
+            uint64_t percentile(double p) const;
+
+        private:
+            static const unsigned int SUBBITS = 4;
+            static const unsigned int MAXBITS = 40;
+            static const unsigned int NBUCKETS = (MAXBITS - SUBBITS + 1) << SUBBITS;
+
+            static unsigned int index(uint64_t v);
+            static uint64_t upper(unsigned int idx);
+
+            std::atomic<uint64_t> m_buckets[NBUCKETS];
+            std::atomic<uint64_t> m_count;
+            std::atomic<uint64_t> m_sum;
+            std::atomic<uint64_t> m_max;
+    };
+};
+
+#endif // HISTOGRAM_HPP
+
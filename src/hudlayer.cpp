@@ -0,0 +1,204 @@
+#include <sstream>
+#include <iomanip>
+#include "gfx.hpp"
+#include "hudlayer.hpp"
+
+#define HUD_X                   (10)
+#define HUD_Y                   (10)
+#define HUD_W                   (NFRAMES*2 + 8)
+#define HUD_LINE                (12)
+#define GRAPH_H                 (40)
+#define GRAPH_MS                (50.0)
+
+const std::size_t florb::hudlayer::NFRAMES;
+
+class florb::hudlayer::series
+{
+    public:
+        series(const char *name) :
+            m_name(name) {};
+
+        const char* name() const { return m_name; };
+        const std::deque<double>& samples() const { return m_samples; };
+
+        void add(double ms)
+        {
+            m_samples.push_back(ms);
+            if (m_samples.size() > NFRAMES)
+                m_samples.pop_front();
+        };
+
+        std::string summary() const
+        {
+            double sum = 0.0, max = 0.0;
+            std::deque<double>::const_iterator it;
+            for (it=m_samples.begin();it!=m_samples.end();++it)
+            {
+                sum += (*it);
+                max = ((*it) > max) ? (*it) : max;
+            }
+
+            std::ostringstream oss;
+            oss.setf(std::ios::fixed, std::ios::floatfield);
+            oss.precision(1);
+            oss << std::left << std::setw(11) << m_name << std::right <<
+                std::setw(6) << (m_samples.empty() ? 0.0 : m_samples.back()) <<
+                std::setw(6) << (m_samples.empty() ? 0.0 : sum / m_samples.size()) <<
+                std::setw(6) << max;
+
+            return oss.str();
+        };
+
+    private:
+        const char *m_name;
+        std::deque<double> m_samples;
+};
+
+florb::hudlayer::hudlayer() :
+    m_frames(new florb::hudlayer::series("frame")),
+    m_queued(0),
+    m_active(0),
+    m_dectiles(0),
+    m_decbytes(0),
+    m_offbytes(0),
+    m_replay(false),
+    m_replayfixes(0),
+    m_replayrate(0.0)
+{
+    name(std::string("HUD"));
+};
+
+florb::hudlayer::~hudlayer()
+{
+    std::vector<florb::hudlayer::series*>::iterator it;
+    for (it=m_layers.begin();it!=m_layers.end();++it)
+        delete (*it);
+
+    delete m_frames;
+};
+
+void florb::hudlayer::sample(const char *name, double ms)
+{
+    std::vector<florb::hudlayer::series*>::iterator it;
+    for (it=m_layers.begin();it!=m_layers.end();++it)
+    {
+        if ((*it)->name() == name)
+            break;
+    }
+
+    if (it == m_layers.end())
+    {
+        m_layers.push_back(new florb::hudlayer::series(name));
+        it = m_layers.end()-1;
+    }
+
+    (*it)->add(ms);
+}
+
+void florb::hudlayer::frame(double ms)
+{
+    m_frames->add(ms);
+}
+
+void florb::hudlayer::downloads(unsigned long queued, unsigned long active)
+{
+    m_queued = queued;
+    m_active = active;
+}
+
+void florb::hudlayer::decoded(std::size_t tiles, std::size_t bytes)
+{
+    m_dectiles = tiles;
+    m_decbytes = bytes;
+}
+
+void florb::hudlayer::offscreen(std::size_t bytes)
+{
+    m_offbytes = bytes;
+}
+
+void florb::hudlayer::gpsreplay(bool active, std::size_t fixes, double rate)
+{
+    m_replay = active;
+    m_replayfixes = fixes;
+    m_replayrate = rate;
+}
+
+bool florb::hudlayer::draw(const viewport &viewport, florb::drawable &os)
+{
+    if (!enabled())
+        return true;
+
+    int nlines = m_layers.size() + (m_replay ? 6 : 5);
+    int h = (nlines * HUD_LINE) + GRAPH_H + 12;
+
+    os.fgcolor(florb::color(0x202020));
+    os.fillrect(HUD_X, HUD_Y, HUD_W, h);
+
+    os.fontsize(10);
+    os.fgcolor(florb::color(0xffffff));
+
+    int y = HUD_Y + 4;
+    std::ostringstream hdr;
+    hdr << std::left << std::setw(11) << "ms" << std::right <<
+        std::setw(6) << "last" << std::setw(6) << "avg" << std::setw(6) << "max";
+    os.text(hdr.str(), HUD_X+4, y);
+    y += HUD_LINE;
+
+    os.text(m_frames->summary(), HUD_X+4, y);
+    y += HUD_LINE;
+
+    std::vector<florb::hudlayer::series*>::iterator it;
+    for (it=m_layers.begin();it!=m_layers.end();++it)
+    {
+        os.text((*it)->summary(), HUD_X+4, y);
+        y += HUD_LINE;
+    }
+
+    std::ostringstream oss;
+    oss << "tiles " << m_queued << " queued, " << m_active << " active";
+    os.text(oss.str(), HUD_X+4, y);
+    y += HUD_LINE;
+
+    std::ostringstream dec;
+    dec << "decoded " << m_dectiles << " tiles, " << (m_decbytes / (1024*1024)) << " MB";
+    os.text(dec.str(), HUD_X+4, y);
+    y += HUD_LINE;
+
+    std::ostringstream off;
+    off << "offscreen " << (m_offbytes / (1024*1024)) << " MB";
+    os.text(off.str(), HUD_X+4, y);
+    y += HUD_LINE;
+
+    if (m_replay)
+    {
+        std::ostringstream gps;
+        gps << "replay " << m_replayfixes << " fixes, " << std::fixed <<
+            std::setprecision(1) << m_replayrate << "/s";
+        os.text(gps.str(), HUD_X+4, y);
+        y += HUD_LINE;
+    }
+    y += 4;
+
+    // Frame time graph, one bar per frame, newest on the right. Bars are
+    // green within 60 fps, yellow within 30 fps and red beyond.
+    const std::deque<double>& f = m_frames->samples();
+    int x = HUD_X + 4 + (int)(NFRAMES - f.size())*2;
+    std::deque<double>::const_iterator fit;
+    for (fit=f.begin();fit!=f.end();++fit, x+=2)
+    {
+        int bh = (int)(((*fit) / GRAPH_MS) * GRAPH_H);
+        bh = (bh < 1) ? 1 : ((bh > GRAPH_H) ? GRAPH_H : bh);
+
+        if ((*fit) <= (1000.0/60.0))
+            os.fgcolor(florb::color(0x00c000));
+        else if ((*fit) <= (1000.0/30.0))
+            os.fgcolor(florb::color(0xe0c000));
+        else
+            os.fgcolor(florb::color(0xff2020));
+
+        os.fillrect(x, y + GRAPH_H - bh, 2, bh);
+    }
+
+    return true;
+};
@@ -0,0 +1,60 @@
+#ifndef HUDLAYER_HPP
+#define HUDLAYER_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include "layer.hpp"
+#include "viewport.hpp"
+
+namespace florb
+{
+    // Frame time overlay: Draw times of the last frames per layer and in
+    // total, plus the state of the tile downloader. The map widget feeds in
+    // the samples, the layer only keeps and draws them.
+    class hudlayer : public florb::layer
+    {
+        public:
+            hudlayer();
+            ~hudlayer();
+
+            // Draw time of a layer in the current frame, name must stay
+            // valid for the lifetime of the HUD
+            void sample(const char *name, double ms);
+
+            // Total time of the current frame, starts the next one
+            void frame(double ms);
+
+            void downloads(unsigned long queued, unsigned long active);
+
+            // Decoded tiles held in memory
+            void decoded(std::size_t tiles, std::size_t bytes);
+
+            // Size of the offscreen map buffer
+            void offscreen(std::size_t bytes);
+
+            // Fixes delivered by a GPS log replay and the rate per second,
+            // shown while active is true
+            void gpsreplay(bool active, std::size_t fixes, double rate);
+
+            bool draw(const florb::viewport &viewport, florb::drawable &os);
+
+        private:
+            static const std::size_t NFRAMES = 120;
+
+            class series;
+
+            std::vector<florb::hudlayer::series*> m_layers;
+            florb::hudlayer::series *m_frames;
+            unsigned long m_queued;
+            unsigned long m_active;
+            std::size_t m_dectiles;
+            std::size_t m_decbytes;
+            std::size_t m_offbytes;
+            bool m_replay;
+            std::size_t m_replayfixes;
+            double m_replayrate;
+    };
+};
+
+#endif // HUDLAYER_HPP
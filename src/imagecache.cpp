@@ -0,0 +1,182 @@
+#include <cstring>
+#include <vector>
+#include "utils.hpp"
+#include "imagecache.hpp"
+
+// Image data up to this size is hashed to find identical tiles, these are
+// small (sea, empty land, transparent overlay tiles)
+#define SHAREMAX                (4096)
+
+// A decoded image and the tiles using it
+class florb::imagecache::decoded
+{
+    public:
+        decoded(uint64_t hash, int type, void const * const buffer, int bufsize) :
+            m_hash(hash),
+            m_refs(0),
+            m_img(type, buffer, bufsize)
+        {
+            // Kept to tell hash collisions apart
+            if (hash != 0)
+                m_data.assign(
+                        reinterpret_cast<const char*>(buffer),
+                        reinterpret_cast<const char*>(buffer) + bufsize);
+        };
+
+        bool same(void const * const buffer, int bufsize) const
+        {
+            return ((int)m_data.size() == bufsize) &&
+                (memcmp(&(m_data[0]), buffer, bufsize) == 0);
+        };
+
+        uint64_t hash() const { return m_hash; };
+        unsigned int& refs() { return m_refs; };
+        florb::image& img() { return m_img; };
+
+    private:
+        uint64_t m_hash;
+        unsigned int m_refs;
+        std::vector<char> m_data;
+        florb::image m_img;
+};
+
+class florb::imagecache::entry
+{
+    public:
+        entry(uint64_t key, time_t expires, florb::imagecache::decoded *d) :
+            m_key(key),
+            m_expires(expires),
+            m_decoded(d) {};
+
+        uint64_t key() const { return m_key; };
+        time_t expires() const { return m_expires; };
+        void expires(time_t e) { m_expires = e; };
+        florb::imagecache::decoded* decoded() const { return m_decoded; };
+        florb::image& img() { return m_decoded->img(); };
+
+    private:
+        uint64_t m_key;
+        time_t m_expires;
+        florb::imagecache::decoded *m_decoded;
+};
+
+florb::imagecache::imagecache(std::size_t maxbytes) :
+    m_maxbytes(maxbytes),
+    m_bytes(0)
+{
+}
+
+florb::imagecache::~imagecache()
+{
+    clear();
+}
+
+florb::image* florb::imagecache::get(uint64_t key, time_t &expires)
+{
+    std::map<uint64_t, std::list<florb::imagecache::entry>::iterator>::iterator it = m_index.find(key);
+    if (it == m_index.end())
+        return NULL;
+
+    // Most recently used go to the front
+    m_entries.splice(m_entries.begin(), m_entries, it->second);
+
+    expires = it->second->expires();
+    return &(it->second->img());
+}
+
+florb::image* florb::imagecache::put(uint64_t key, time_t expires, int type, void const * const buffer, int bufsize)
+{
+    remove(key);
+
+    florb::imagecache::decoded *d = NULL;
+    uint64_t hash = 0;
+
+    // Use the image of an identical tile if there is one
+    if ((bufsize > 0) && (bufsize <= SHAREMAX))
+    {
+        hash = florb::utils::hash(buffer, bufsize);
+
+        std::map<uint64_t, florb::imagecache::decoded*>::iterator it = m_shared.find(hash);
+        if (it != m_shared.end())
+        {
+            if (it->second->same(buffer, bufsize))
+                d = it->second;
+            else
+                hash = 0;
+        }
+    }
+
+    if (!d)
+    {
+        d = new florb::imagecache::decoded(hash, type, buffer, bufsize);
+        if (d->img().w() == 0)
+        {
+            delete d;
+            return NULL;
+        }
+
+        if (hash != 0)
+            m_shared[hash] = d;
+        m_bytes += d->img().bytes();
+    }
+
+    d->refs()++;
+    m_entries.emplace_front(key, expires, d);
+    m_index[key] = m_entries.begin();
+
+    evict();
+
+    return &(d->img());
+}
+
+void florb::imagecache::refresh(uint64_t key, time_t expires)
+{
+    std::map<uint64_t, std::list<florb::imagecache::entry>::iterator>::iterator it = m_index.find(key);
+    if (it != m_index.end())
+        it->second->expires(expires);
+}
+
+void florb::imagecache::remove(uint64_t key)
+{
+    std::map<uint64_t, std::list<florb::imagecache::entry>::iterator>::iterator it = m_index.find(key);
+    if (it == m_index.end())
+        return;
+
+    release(it->second->decoded());
+    m_entries.erase(it->second);
+    m_index.erase(it);
+}
+
+void florb::imagecache::clear()
+{
+    std::list<florb::imagecache::entry>::iterator it;
+    for (it=m_entries.begin();it!=m_entries.end();++it)
+        release(it->decoded());
+
+    m_entries.clear();
+    m_index.clear();
+}
+
+void florb::imagecache::release(florb::imagecache::decoded *d)
+{
+    if (--(d->refs()) > 0)
+        return;
+
+    m_bytes -= d->img().bytes();
+    if (d->hash() != 0)
+        m_shared.erase(d->hash());
+    delete d;
+}
+
+void florb::imagecache::evict()
+{
+    // The most recent image always stays, even if it exceeds the limit on
+    // its own
+    while ((m_bytes > m_maxbytes) && (m_entries.size() > 1))
+    {
+        florb::imagecache::entry& e = m_entries.back();
+        release(e.decoded());
+        m_index.erase(e.key());
+        m_entries.pop_back();
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef IMAGECACHE_HPP
+#define IMAGECACHE_HPP
+
+#include <time.h>
+#include <cstdint>
+#include <list>
+#include <map>
+#include "gfx.hpp"
+
+namespace florb
+{
+    // Decoded tile images in memory, least recently used ones are dropped
+    // once the size limit is reached. The most recently added image is never
+    // dropped. Images returned by get() and put() stay
+    // valid until the next put(), remove() or clear(). Tiles with identical
+    // image data share one decoded image, which must not be modified.
+    class imagecache
+    {
+        public:
+            imagecache(std::size_t maxbytes);
+            ~imagecache();
+
+            // NULL if not cached
+            florb::image* get(uint64_t key, time_t &expires);
+
+            // Decode buffer into the cache, NULL if it does not decode
+            florb::image* put(uint64_t key, time_t expires, int type, void const * const buffer, int bufsize);
+
+            // New expiry of an image which is still up to date
+            void refresh(uint64_t key, time_t expires);
+
+            void remove(uint64_t key);
+            void clear();
+
+            std::size_t size() const { return m_entries.size(); };
+            std::size_t bytes() const { return m_bytes; };
+            std::size_t maxbytes() const { return m_maxbytes; };
+
+        private:
+            class entry;
+            class decoded;
+
+            void release(florb::imagecache::decoded *d);
+            void evict();
+
+            std::size_t m_maxbytes;
+            std::size_t m_bytes;
+            std::list<florb::imagecache::entry> m_entries;
+            std::map<uint64_t, std::list<florb::imagecache::entry>::iterator> m_index;
+            std::map<uint64_t, florb::imagecache::decoded*> m_shared;
+    };
+};
+
+#endif // IMAGECACHE_HPP
@@ -1,5 +1,4 @@
 #include <string>
-#include <FL/Fl.H>
 #include "layer.hpp"
 
 florb::layer::layer() :
@@ -19,7 +19,7 @@ namespace florb
             layer();
             virtual ~layer();
 
-            virtual bool draw(const florb::viewport &viewport, florb::canvas &c) = 0;
+            virtual bool draw(const florb::viewport &viewport, florb::drawable &c) = 0;
             const std::string& name() const;
             void enable(bool en);
 
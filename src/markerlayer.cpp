@@ -76,7 +76,7 @@ void florb::markerlayer::notify()
     fire(&e);
 }
 
-bool florb::markerlayer::draw(const viewport &viewport, florb::canvas &os)
+bool florb::markerlayer::draw(const viewport &viewport, florb::drawable &os)
 {
     florb::cfg_ui cfgui = florb::settings::get_instance()["ui"].as<florb::cfg_ui>();
 
@@ -1,6 +1,11 @@
+#include <algorithm>
 #include <cmath>
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
 #include "utils.hpp"
 #include "osmlayer.hpp"
+#include "trace.hpp"
+#include "bufferpool.hpp"
 
 #define ONE_WEEK                (7*24*60*60)
 #define ONE_DAY                 (1*24*60*60)
@@ -8,10 +13,16 @@
 #define TILE_W                  (256)
 #define TILE_H                  (256)
 #define DLQSIZE                 (100)
+#define FETCHLOG                (1024)
+#define FALLBACKLEVELS          (4)
+#define FALLBACKBUDGET          (8000)
+#define SUBDOMAINS              "abc"
+#define DLTHREADSMAX            (64)
 
 const std::string florb::osmlayer::wcard_x = "{x}";
 const std::string florb::osmlayer::wcard_y = "{y}";
 const std::string florb::osmlayer::wcard_z = "{z}";
+const std::string florb::osmlayer::wcard_s = "{s}";
 
 const char florb::osmlayer::tile_empty[] = \
 	"\x89\x50\x4E\x47\x0D\x0A\x1A\x0A\x00\x00\x00\x0D\x49\x48\x44\x52\x00\x00\x01\x00" \
@@ -52,6 +63,50 @@ class florb::osmlayer::tileinfo
         int m_y;
 };
 
+class florb::osmlayer::fetchinfo
+{
+    public:
+        fetchinfo(long httprc, uint64_t latency) :
+            m_httprc(httprc),
+            m_latency(latency) {};
+
+        long httprc() const { return m_httprc; };
+        uint64_t latency() const { return m_latency; };
+
+    private:
+        long m_httprc;
+        uint64_t m_latency;
+};
+
+uint64_t florb::osmlayer::tilekey(int z, int x, int y)
+{
+    return ((uint64_t)z << 58) | ((uint64_t)x << 29) | (uint64_t)y;
+}
+
+std::string florb::osmlayer::tileurl(const std::string& tmpl, int z, int x, int y)
+{
+    std::ostringstream sz, sx, sy;
+    sz << z;
+    sx << x;
+    sy << y;
+
+    std::string url(tmpl);
+    
+    std::size_t idx = url.find(florb::osmlayer::wcard_z);
+    if (idx != std::string::npos)
+        url.replace(idx, florb::osmlayer::wcard_z.length(), sz.str());
+
+    idx = url.find(florb::osmlayer::wcard_x);
+    if (idx != std::string::npos)
+        url.replace(idx, florb::osmlayer::wcard_x.length(), sx.str());
+
+    idx = url.find(florb::osmlayer::wcard_y);
+    if (idx != std::string::npos)
+        url.replace(idx, florb::osmlayer::wcard_y.length(), sy.str());
+
+    return url;
+}
+
 florb::osmlayer::osmlayer(
         const std::string& nm,  
         const std::string& url, 
@@ -66,7 +121,14 @@ florb::osmlayer::osmlayer(
     m_zmax(zmax),                   // Max. zoomlevel supported by server
     m_parallel(parallel),           // Number of simultaneous downloads
     m_type(imgtype),                // Tile image data type
-    m_dlenable(true)               // Allow tile downloading
+    m_rate(-1.0),                   // Host rate limits left as they are
+    m_burst(1),
+    m_parallelmin(0),               // Fixed number of parallel downloads
+    m_parallelmax(0),
+    m_dlenable(true),               // Allow tile downloading
+    m_ttotal(0),                    // Tiles drawn last time
+    m_tmissing(0),                  // Tiles missing last time
+    m_stats(&florb::tilestats::get(nm)) // Tile pipeline statistics
 {
     // Set map layer name
     name(m_name);
@@ -79,10 +141,18 @@ florb::osmlayer::osmlayer(
         throw e;
     }
 
+    m_cache->quota((uint64_t)cfgcache.quota() * 1024 * 1024);
+    florb::cache::totalquota((uint64_t)cfgcache.totalquota() * 1024 * 1024);
+    florb::cache::sync(cfgcache.sync());
+
+    // Create the cache of decoded tiles
+    m_memcache = new florb::imagecache((std::size_t)cfgcache.memory() * 1024 * 1024);
+
     // Create the requested number of download threads
     try {
         m_downloader = new florb::downloader(parallel);
     } catch (std::runtime_error& e) {
+        delete m_memcache;
         delete m_cache;
         throw e;
     }
@@ -90,6 +160,9 @@ florb::osmlayer::osmlayer(
     // Register event handlere
     register_event_handler<osmlayer, florb::downloader::event_complete>(this, &florb::osmlayer::evt_downloadcomplete);
     m_downloader->add_event_listener(this);
+
+    // Default subdomains for an URL with {s}
+    endpoints(std::vector<std::string>(), SUBDOMAINS);
 };
 
 florb::osmlayer::~osmlayer()
@@ -104,13 +177,91 @@ florb::osmlayer::~osmlayer()
         delete (*it);
     }
 
-    // Destroy the cache
+    // Destroy the caches
+    delete m_memcache;
     delete m_cache;
 };
 
 void florb::osmlayer::nice(long ms)
 {
-    m_downloader->nice(ms);
+    if (ms > 0)
+        m_downloader->rate(1000.0 / (double)ms, 1);
+    else
+        m_downloader->rate(0.0, 1);
+}
+
+void florb::osmlayer::ratelimit(double rate, unsigned int burst)
+{
+    m_rate = rate;
+    m_burst = burst;
+
+    std::vector<std::string>::iterator it;
+    for (it=m_hosts.begin();it!=m_hosts.end();++it)
+        florb::ratelimit::host(*it).rate(rate, burst);
+}
+
+void florb::osmlayer::concurrency(unsigned int min, unsigned int max)
+{
+    m_parallelmin = min;
+    m_parallelmax = max;
+
+    // Fixed number of threads, the shared controllers of the hosts stay
+    // as other layers set them up
+    if (max <= m_parallel)
+        return;
+
+    // Every host may get up to max requests at a time
+    std::size_t n = max * m_hosts.size();
+    m_downloader->threads((n < DLTHREADSMAX) ? n : DLTHREADSMAX);
+
+    std::vector<std::string>::iterator it;
+    for (it=m_hosts.begin();it!=m_hosts.end();++it)
+        florb::concurrency::host(*it).bounds(min, max);
+}
+
+void florb::osmlayer::mirrors(const std::vector<std::string>& urls, const std::string& subdomains)
+{
+    endpoints(urls, subdomains);
+
+    // Limits set before apply to the new hosts as well
+    if (m_rate >= 0.0)
+        ratelimit(m_rate, m_burst);
+    if (m_parallelmax > 0)
+        concurrency(m_parallelmin, m_parallelmax);
+}
+
+void florb::osmlayer::endpoints(const std::vector<std::string>& urls, const std::string& subdomains)
+{
+    std::vector<std::string> tmpls(1, m_url);
+    tmpls.insert(tmpls.end(), urls.begin(), urls.end());
+
+    m_endpoints.clear();
+    m_hosts.clear();
+
+    std::vector<std::string>::iterator it;
+    for (it=tmpls.begin();it!=tmpls.end();++it)
+    {
+        std::size_t idx = (*it).find(florb::osmlayer::wcard_s);
+        if ((idx == std::string::npos) || subdomains.empty())
+        {
+            m_endpoints.push_back(*it);
+            continue;
+        }
+
+        for (std::size_t i=0;i<subdomains.size();i++)
+        {
+            std::string ep(*it);
+            ep.replace(idx, florb::osmlayer::wcard_s.length(), 1, subdomains[i]);
+            m_endpoints.push_back(ep);
+        }
+    }
+
+    for (it=m_endpoints.begin();it!=m_endpoints.end();++it)
+    {
+        std::string host(florb::utils::urlhost(*it));
+        if (std::find(m_hosts.begin(), m_hosts.end(), host) == m_hosts.end())
+            m_hosts.push_back(host);
+    }
 }
 
 void florb::osmlayer::process_downloads()
@@ -119,6 +270,8 @@ void florb::osmlayer::process_downloads()
     if (!m_dlenable)
         return;
 
+    FLORB_TRACE("osmlayer::process_downloads", "tiles");
+
     bool ret = false; 
 
     // Cache all downloaded tiles
@@ -139,46 +292,147 @@ void florb::osmlayer::process_downloads()
             m_tileinfos.erase(it);
         }
 
-        time_t expires, now = time(NULL);
+        if (dtmp.attempts() > 1)
+            m_stats->count(florb::tilestats::DL_RETRIES, dtmp.attempts() - 1);
 
-        // Download failed for some reason, allow retry in 5 minutes
-        if (dtmp.buf().size() == 0)
+        m_stats->record(florb::tilestats::QUEUE_WAIT, dtmp.qwait());
+        m_stats->record(florb::tilestats::TRANSFER, dtmp.transfer());
+
+        // Remember the outcome for the tile state overlay, forget the oldest
+        // entries once the log is full
+        uint64_t key = tilekey(ti->z(), ti->x(), ti->y());
+        if (m_fetches.find(key) == m_fetches.end())
+            m_fetchorder.push_back(key);
+        m_fetches.erase(key);
+        m_fetches.insert(std::make_pair(key, florb::osmlayer::fetchinfo(dtmp.httprc(), dtmp.transfer())));
+        if (m_fetchorder.size() > FETCHLOG)
         {
-            expires = now + FIVE_MIN;
+            m_fetches.erase(m_fetchorder.front());
+            m_fetchorder.pop_front();
         }
-        else
+
+        // Use the expiry date from the HTTP header, default expiry of one
+        // week if the server sent none. Tiles which must be revalidated
+        // every time stay fresh for five minutes, otherwise every redraw
+        // and every prefetch pass would ask for them again.
+        time_t now = time(NULL);
+        time_t expires = dtmp.expires();
+        if (expires == 0)
+            expires = now + ONE_WEEK;
+        else if (expires < now + FIVE_MIN)
+            expires = now + FIVE_MIN;
+
+        bool notmodified = false;
+        bool transient = false;
+
+        // Not sent because all servers are considered down, ask again
+        // with the first probe
+        if (dtmp.blocked())
         {
-            // Erroneous HTTP status code, Retry in one day
-            if (dtmp.httprc() >= 400)
+            m_stats->count(florb::tilestats::DL_BLOCKED);
+            unsigned int cooldown = 0;
+            std::vector<std::string>::iterator it;
+            for (it=m_hosts.begin();it!=m_hosts.end();++it)
             {
-                expires = now + ONE_DAY;
-                dtmp.buf().resize(0);
-            }
-            // Use the expiry date from the HTTP header
-            else
-            {
-                expires = dtmp.expires();
-
-                // Default expiry of one week if we got no or an invalid expiry
-                // date
-                if (expires <= now)
-                    expires = now + ONE_WEEK;
+                unsigned int c = florb::circuitbreaker::host(*it).cooldown();
+                if ((it == m_hosts.begin()) || (c < cooldown))
+                    cooldown = c;
             }
+            expires = now + ((cooldown > 0) ? cooldown : 1);
+            transient = true;
+        }
+        // Tile unchanged on the server, the cached one is still good
+        else if (dtmp.httprc() == 304)
+        {
+            m_stats->count(florb::tilestats::DL_NOTMODIFIED);
+            notmodified = true;
+        }
+        // Too many requests, try again once the server allows it
+        else if ((dtmp.httprc() == 429) || (dtmp.httprc() == 503))
+        {
+            m_stats->count(florb::tilestats::DL_THROTTLED);
+            expires = now + ((dtmp.retryafter() > 0) ? dtmp.retryafter() : FIVE_MIN);
+            dtmp.buf().clear();
+            transient = true;
+        }
+        // Download or server failed even after retrying, allow retry in 5
+        // minutes
+        else if ((dtmp.buf().size() == 0) || (dtmp.httprc() >= 500))
+        {
+            m_stats->count(florb::tilestats::DL_FAILED);
+            expires = now + FIVE_MIN;
+            dtmp.buf().clear();
+            transient = true;
+        }
+        // Erroneous HTTP status code, Retry in one day
+        else if (dtmp.httprc() >= 400)
+        {
+            m_stats->count(florb::tilestats::DL_FAILED);
+            expires = now + ONE_DAY;
+            dtmp.buf().clear();
+        }
+        else
+        {
+            m_stats->count(florb::tilestats::DL_OK);
+            m_stats->count(florb::tilestats::DL_BYTES, dtmp.buf().size());
         }
 
         ret = true;
 
-        try {
-            m_cache->put(ti->z(), ti->x(), ti->y(), expires, dtmp.buf());
-        } catch (std::runtime_error& e) {
-            ret = false;
+        uint64_t t = florb::tilestats::now();
+        if (notmodified)
+        {
+            // Only the expiry changes, the tile on disk and in memory stays.
+            // A tile evicted in the meantime gets downloaded again.
+            if (m_cache->refresh(ti->z(), ti->x(), ti->y(), expires))
+                m_memcache->refresh(key, expires);
+        }
+        else if (transient && m_cache->refresh(ti->z(), ti->x(), ti->y(), expires))
+        {
+            // Keep showing the outdated tile rather than none until the
+            // server can be asked again
+            m_memcache->refresh(key, expires);
+        }
+        else
+        {
+            // The decoded version in memory is outdated now
+            m_memcache->remove(key);
+
+            m_cache->put(ti->z(), ti->x(), ti->y(), expires, std::move(dtmp.buf()), dtmp.etag(), dtmp.modified());
         }
+        m_stats->record(florb::tilestats::CACHE_PUT, florb::tilestats::now() - t);
+
+        // Whatever the cache did not take goes back for the next download
+        florb::bufferpool::put(dtmp.buf());
 
         delete ti;
     }
 
     if (ret) 
     {
+        // State of the concurrency control of our servers: totals of the
+        // limits, the slowest and the fastest response time
+        double limit = 0.0;
+        uint64_t inflight = 0, rtt = 0, rttmin = 0, down = 0;
+        std::vector<std::string>::iterator it;
+        for (it=m_hosts.begin();it!=m_hosts.end();++it)
+        {
+            florb::concurrency& c = florb::concurrency::host(*it);
+            limit += c.limit();
+            inflight += c.inflight();
+            rtt = std::max(rtt, c.rtt());
+            if ((c.rttmin() > 0) && ((rttmin == 0) || (c.rttmin() < rttmin)))
+                rttmin = c.rttmin();
+            if (florb::circuitbreaker::host(*it).state() != florb::circuitbreaker::CLOSED)
+                down++;
+        }
+
+        m_stats->set(florb::tilestats::DL_LIMIT, (uint64_t)limit);
+        m_stats->set(florb::tilestats::DL_INFLIGHT, inflight);
+        m_stats->set(florb::tilestats::DL_RTT, rtt);
+        m_stats->set(florb::tilestats::DL_RTT_MIN, rttmin);
+        m_stats->set(florb::tilestats::DL_HOSTS_DOWN, down);
+
         florb::osmlayer::event_notify e;
         fire(&e);
     }
@@ -214,7 +468,7 @@ void florb::osmlayer::cb_download(void *userdata)
 
 bool florb::osmlayer::evt_downloadcomplete(const florb::downloader::event_complete *e)
 {
-    Fl::awake(cb_download, this);
+    event_dispatch::awake(cb_download, this);
     return true;
 }
 
@@ -223,6 +477,20 @@ void florb::osmlayer::download_qtile(int z, int x, int y)
     if (!m_dlenable)
         return;
     if (m_downloader->qsize() > DLQSIZE)
+    {
+        m_stats->count(florb::tilestats::DROPPED);
+        return;
+    }
+
+    // All servers are considered down, stick to what is cached until the
+    // next probe
+    std::vector<std::string>::iterator hit;
+    for (hit=m_hosts.begin();hit!=m_hosts.end();++hit)
+    {
+        if (florb::circuitbreaker::host(*hit).cooldown() == 0)
+            break;
+    }
+    if (hit == m_hosts.end())
         return;
 
     // Check whether the requested tile is already being processed
@@ -236,32 +504,28 @@ void florb::osmlayer::download_qtile(int z, int x, int y)
     // Create the userdata component to be attached to the download
     florb::osmlayer::tileinfo *ti = new florb::osmlayer::tileinfo(z, x, y);
 
-    // Construct the download URL
-    std::ostringstream sz, sx, sy;
-    sz << z;
-    sx << x;
-    sy << y;
+    // Construct the download URLs, starting with the tile's preferred host
+    // so the same tile always comes from the same host while all are well
+    uint64_t key = tilekey(z, x, y);
+    std::size_t first = (std::size_t)(florb::utils::hash(&key, sizeof(key)) % m_endpoints.size());
 
-    std::string url(m_url);
-    
-    std::size_t idx = url.find(florb::osmlayer::wcard_z);
-    if (idx != std::string::npos)
-        url.replace(idx, florb::osmlayer::wcard_z.length(), sz.str());
+    std::vector<std::string> urls;
+    for (std::size_t i=0;i<m_endpoints.size();i++)
+        urls.push_back(tileurl(m_endpoints[(first + i) % m_endpoints.size()], z, x, y));
 
-    idx = url.find(florb::osmlayer::wcard_x);
-    if (idx != std::string::npos)
-        url.replace(idx, florb::osmlayer::wcard_x.length(), sx.str());
-
-    idx = url.find(florb::osmlayer::wcard_y);
-    if (idx != std::string::npos)
-        url.replace(idx, florb::osmlayer::wcard_y.length(), sy.str());
+    // Ask the server whether an expired tile has changed rather than
+    // downloading it again
+    std::string etag;
+    time_t modified;
+    m_cache->validators(z, x, y, etag, modified);
 
     // Try to queue this URL for downloading
-    bool ret = m_downloader->queue(url, ti);
+    bool ret = m_downloader->queue(urls, ti, etag, modified);
 
     // Item queued for downloading
     if (ret)
     {
+        m_stats->count(florb::tilestats::ENQUEUED);
         m_tileinfos.push_back(ti); 
     }
     // Item not added
@@ -269,16 +533,52 @@ void florb::osmlayer::download_qtile(int z, int x, int y)
         delete ti;
 }
 
-bool florb::osmlayer::draw(const viewport &vp, florb::canvas &os)
+void florb::osmlayer::tiles(std::vector<florb::osmlayer::tilestate>& t)
 {
+    t = m_drawn;
+
+    std::vector<florb::osmlayer::tilestate>::iterator it;
+    for (it=t.begin();it!=t.end();++it)
+    {
+        std::map<uint64_t, florb::osmlayer::fetchinfo>::iterator fit = 
+            m_fetches.find(tilekey((*it).z(), (*it).x(), (*it).y()));
+        if (fit != m_fetches.end())
+        {
+            (*it).httprc(fit->second.httprc());
+            (*it).latency(fit->second.latency());
+        }
+
+        // Tiles with a download pending are queued or in progress, finished
+        // downloads which have not been processed yet count as in progress
+        std::vector<florb::osmlayer::tileinfo*>::iterator tit;
+        for (tit=m_tileinfos.begin();tit!=m_tileinfos.end();++tit)
+        {
+            if (((*tit)->z() == (*it).z()) && ((*tit)->x() == (*it).x()) && ((*tit)->y() == (*it).y()))
+                break;
+        }
+
+        if (tit != m_tileinfos.end())
+        {
+            (*it).state((m_downloader->state(*tit) == florb::downloader::QUEUED) ?
+                    florb::osmlayer::tilestate::QUEUED :
+                    florb::osmlayer::tilestate::DOWNLOADING);
+        }
+    }
+}
+
+bool florb::osmlayer::draw(const viewport &vp, florb::drawable &os)
+{
+    m_drawn.clear();
+
     if ((vp.z() < m_zmin) || (vp.z() > m_zmax))
     {
         // Zoomlevel not supported by this tile layer
+        m_ttotal = m_tmissing = 0;
         return true;
     } 
 
     // Regular tile drawing
-    return drawvp(vp, &os, NULL, NULL);
+    return drawvp(vp, &os, &m_ttotal, &m_tmissing);
 }
 
 bool florb::osmlayer::download(const viewport &vp, double& coverage)
@@ -300,8 +600,122 @@ bool florb::osmlayer::download(const viewport &vp, double& coverage)
     return rc;
 }
 
-bool florb::osmlayer::drawvp(const viewport &vp, florb::canvas *c, unsigned long *ttotal, unsigned long *tnok)
+bool florb::osmlayer::prefetch(const viewport &vp, unsigned int timeout)
+{
+    // Blocking variant of the regular download cycle for use without an FLTK
+    // main loop: Queue everything missing for this viewport and cache the
+    // results until the viewport is complete or the timeout (seconds)
+    // expires. Failed downloads are cached as empty tiles, so this always
+    // terminates.
+    if ((vp.z() < m_zmin) || (vp.z() > m_zmax))
+        return true;
+
+    boost::posix_time::ptime deadline = 
+        boost::posix_time::microsec_clock::universal_time() + boost::posix_time::seconds(timeout);
+
+    for (;;)
+    {
+        process_downloads();
+
+        if (drawvp(vp, NULL, NULL, NULL))
+            return true;
+
+        if (boost::posix_time::microsec_clock::universal_time() > deadline)
+            return false;
+
+        boost::this_thread::sleep(boost::posix_time::milliseconds(20));
+    }
+}
+
+bool florb::osmlayer::preview(const viewport &vp, florb::drawable &os, uint64_t budget)
 {
+    FLORB_TRACE("osmlayer::preview", "tiles");
+
+    if ((vp.z() < m_zmin) || (vp.z() > m_zmax))
+        return true;
+
+    // Same tile walk as drawvp(), but only decoded tiles in memory are used
+    uint64_t deadline = florb::tilestats::now() + budget;
+    bool ret = true;
+
+    unsigned long tstartx = vp.x() / TILE_W;
+    unsigned long tstarty = vp.y() / TILE_H;
+    unsigned int dx = (unsigned int)(vp.x() % TILE_W);
+    unsigned int dy = (unsigned int)(vp.y() % TILE_H);
+
+    unsigned long px, py;
+    unsigned long tx, ty;
+
+    for (py=0, ty=tstarty; py<(vp.h()+dy); py+=TILE_W, ty++)
+    {
+       for (px=0, tx=tstartx; px<(vp.w()+dx); px+=TILE_H, tx++)
+       {
+          time_t expires;
+          florb::image *img = m_memcache->get(tilekey(vp.z(), tx, ty), expires);
+          if (img != NULL)
+          {
+              os.draw(*img, (int)px-(int)dx, (int)py-(int)dy);
+              continue;
+          }
+
+          ret = false;
+
+          // Scaling is the expensive part, skip it once the budget is used
+          // up
+          if (florb::tilestats::now() <= deadline)
+              fallback(vp.z(), tx, ty, os, (int)px-(int)dx, (int)py-(int)dy);
+       }
+    }
+
+    return ret;
+}
+
+bool florb::osmlayer::fallback(unsigned int z, unsigned long tx, unsigned long ty, florb::drawable &os, int x, int y)
+{
+    time_t expires;
+
+    // The matching part of a parent tile, scaled up
+    for (unsigned int k=1;(k<=FALLBACKLEVELS) && (k<=z);k++)
+    {
+        florb::image *parent = m_memcache->get(tilekey(z-k, tx >> k, ty >> k), expires);
+        if (parent == NULL)
+            continue;
+
+        int sw = parent->w() >> k;
+        int sh = parent->h() >> k;
+        int mask = (1 << k) - 1;
+
+        florb::image part(*parent, (int)(tx & mask)*sw, (int)(ty & mask)*sh, sw, sh, TILE_W, TILE_H, florb::image::SMOOTH);
+        os.draw(part, x, y);
+        return true;
+    }
+
+    // Whatever there is of the four child tiles, scaled down
+    if (z >= m_zmax)
+        return false;
+
+    bool ret = false;
+    for (unsigned int i=0;i<4;i++)
+    {
+        unsigned long cx = (tx << 1) + (i & 1);
+        unsigned long cy = (ty << 1) + (i >> 1);
+
+        florb::image *child = m_memcache->get(tilekey(z+1, cx, cy), expires);
+        if (child == NULL)
+            continue;
+
+        florb::image part(*child, 0, 0, child->w(), child->h(), TILE_W/2, TILE_H/2, florb::image::SMOOTH);
+        os.draw(part, x + (int)((i & 1)*(TILE_W/2)), y + (int)((i >> 1)*(TILE_H/2)));
+        ret = true;
+    }
+
+    return ret;
+}
+
+bool florb::osmlayer::drawvp(const viewport &vp, florb::drawable *c, unsigned long *ttotal, unsigned long *tnok)
+{
+    FLORB_TRACE("osmlayer::drawvp", "tiles");
+
     // Reset statistics
     if (ttotal != NULL) (*ttotal) = 0;
     if (tnok != NULL) (*tnok) = 0;
@@ -322,32 +736,92 @@ bool florb::osmlayer::drawvp(const viewport &vp, florb::canvas *c, unsigned long
     unsigned long px, py;
     unsigned long tx, ty;
 
+    time_t now = time(NULL);
+    uint64_t deadline = florb::tilestats::now() + FALLBACKBUDGET;
+
     for (py=0, ty=tstarty; py<(vp.h()+dy); py+=TILE_W, ty++)
     {
        for (px=0, tx=tstartx; px<(vp.w()+dx); px+=TILE_H, tx++)
        {
-          // Get the tile
           int rc;
-          try {
-              if (c == NULL)
-                  rc = m_cache->exists(vp.z(), tx, ty);  
-              else
-                  rc = m_cache->get(vp.z(), tx, ty, m_imgbuf);
-          } catch (std::runtime_error& e) {
-              rc = florb::cache::NOTFOUND;
-          }
-          
-          // Draw the tile if we either have a valid or expired version of it...
+          time_t expires;
+          florb::image *img = NULL;
+
+          // Decoded tiles in memory come first when drawing
           if (c != NULL)
+              img = m_memcache->get(tilekey(vp.z(), tx, ty), expires);
+
+          if (img != NULL)
           {
-              if ((rc != florb::cache::NOTFOUND) && 
-                  (m_imgbuf.size() != 0))
+              rc = (now > expires) ? florb::cache::EXPIRED : florb::cache::FOUND;
+              m_stats->count(florb::tilestats::MEM_HITS);
+              m_drawn.push_back(florb::osmlayer::tilestate(vp.z(), tx, ty, 
+                          (rc == florb::cache::FOUND) ? 
+                          florb::osmlayer::tilestate::MEMORY : 
+                          florb::osmlayer::tilestate::EXPIRED));
+          }
+          else
+          {
+              // Get the tile from the disk cache
+              uint64_t t = florb::tilestats::now();
+              try {
+                  if (c == NULL)
+                      rc = m_cache->exists(vp.z(), tx, ty);  
+                  else
+                      rc = m_cache->get(vp.z(), tx, ty, m_imgbuf, expires);
+              } catch (std::runtime_error& e) {
+                  rc = florb::cache::NOTFOUND;
+              }
+
+              // Decode the tile into memory if we either have a valid or
+              // expired version of it...
+              if (c != NULL)
               {
-                  florb::image img(m_type, (unsigned char*)(&m_imgbuf[0]), m_imgbuf.size());
-                  c->draw(img, (int)px-(int)dx, (int)py-(int)dy);
+                  uint64_t tnow = florb::tilestats::now();
+                  m_stats->record(florb::tilestats::CACHE_GET, tnow - t);
+                  m_stats->count(
+                          (rc == florb::cache::FOUND) ? florb::tilestats::HITS : 
+                          (rc == florb::cache::EXPIRED) ? florb::tilestats::EXPIRED :
+                          florb::tilestats::MISSES);
+
+                  // Failed downloads are cached as empty tiles
+                  int state = florb::osmlayer::tilestate::MISSING;
+                  if ((rc != florb::cache::NOTFOUND) && (m_imgbuf.size() == 0))
+                      state = florb::osmlayer::tilestate::FAILED;
+                  else if (rc == florb::cache::FOUND)
+                      state = florb::osmlayer::tilestate::CACHED;
+                  else if (rc == florb::cache::EXPIRED)
+                      state = florb::osmlayer::tilestate::EXPIRED;
+                  m_drawn.push_back(florb::osmlayer::tilestate(vp.z(), tx, ty, state));
+
+                  if ((rc != florb::cache::NOTFOUND) && 
+                      (m_imgbuf.size() != 0))
+                  {
+                      img = m_memcache->put(tilekey(vp.z(), tx, ty), 
+                              expires,
+                              m_type, (unsigned char*)(&m_imgbuf[0]), m_imgbuf.size());
+                      m_stats->record(florb::tilestats::DECODE, florb::tilestats::now() - tnow);
+
+                      if (img == NULL)
+                          m_stats->count(florb::tilestats::DECODE_ERRORS);
+                  }
               }
           }
 
+          // ...and draw it
+          if (img != NULL)
+          {
+              uint64_t t = florb::tilestats::now();
+              c->draw(*img, (int)px-(int)dx, (int)py-(int)dy);
+              m_stats->record(florb::tilestats::BLIT, florb::tilestats::now() - t);
+          }
+          // ...or stand in with tiles of the adjacent zoom levels until the
+          // real one arrives
+          else if ((c != NULL) && (florb::tilestats::now() <= deadline))
+          {
+              fallback(vp.z(), tx, ty, *c, (int)px-(int)dx, (int)py-(int)dy);
+          }
+
           // Tile not in cache or expired, schedule for downloading
           if ((rc == florb::cache::EXPIRED) || 
               (rc == florb::cache::NOTFOUND))
@@ -2,12 +2,16 @@
 #define OSMLAYER_HPP
 
 #include <vector>
+#include <map>
+#include <deque>
 #include "layer.hpp"
 #include "viewport.hpp"
 #include "downloader.hpp"
 #include "cache.hpp"
+#include "imagecache.hpp"
 #include "gfx.hpp"
 #include "settings.hpp"
+#include "tilestats.hpp"
 
 namespace florb
 {
@@ -22,17 +26,62 @@ namespace florb
                     unsigned int parallel,
                     int imgtype);
             ~osmlayer();
-            bool draw(const florb::viewport &vp, florb::canvas &c);
+            bool draw(const florb::viewport &vp, florb::drawable &c);
             bool download(const florb::viewport& vp, double& coverage);
+            bool prefetch(const florb::viewport& vp, unsigned int timeout);
+
+            // Draw only what can be drawn from decoded tiles in memory, with
+            // scaled tiles of the adjacent zoom levels in place of missing
+            // ones as long as the budget (microseconds) lasts. No disk or network access, returns
+            // whether all tiles were available.
+            bool preview(const florb::viewport& vp, florb::drawable &os, uint64_t budget);
+            // At most one request every ms milliseconds from this layer
             void nice(long ms);
 
+            // Requests per second and burst size allowed to the tile
+            // server, shared by all layers using the same host
+            void ratelimit(double rate, unsigned int burst);
+
+            // Let the number of parallel requests to the tile server adapt
+            // between min and max, shared by all layers using the same
+            // host. A max not above the thread count given to the
+            // constructor keeps that fixed and leaves the shared limit
+            // alone.
+            void concurrency(unsigned int min, unsigned int max);
+
+            // Further URLs serving the same tiles, and the values {s} in any
+            // of the URLs stands for, one character each. Every tile has a
+            // preferred host, other hosts take over if it is busy or down.
+            void mirrors(const std::vector<std::string>& urls, const std::string& subdomains);
+
             int zoom_min() { return m_zmin; };
             int zoom_max() { return m_zmax; };
             void dlenable(bool e);
 
+            // Number of tiles in the viewport and the number of tiles which
+            // were missing or expired during the last draw() call
+            unsigned long tiles_total() { return m_ttotal; };
+            unsigned long tiles_missing() { return m_tmissing; };
+
+            // Downloads waiting for a thread and in progress
+            unsigned long downloads_queued() { return m_downloader->qsize(); };
+            unsigned long downloads_active() { return m_downloader->active(); };
+
+            // Number and size of the decoded tiles in memory
+            std::size_t decoded_tiles() { return m_memcache->size(); };
+            std::size_t decoded_bytes() { return m_memcache->bytes(); };
+
+            // Tile pipeline counters and latencies of this layer
+            const florb::tilestats& stats() { return *m_stats; };
+
+            // State of each tile drawn during the last draw() call
+            class tilestate;
+            void tiles(std::vector<florb::osmlayer::tilestate>& t);
+
             static const std::string wcard_x;
             static const std::string wcard_y;
             static const std::string wcard_z;
+            static const std::string wcard_s;
 
             class event_notify;
 
@@ -40,6 +89,14 @@ namespace florb
             static const char tile_empty[];
 
             class tileinfo;
+            class fetchinfo;
+
+            static uint64_t tilekey(int z, int x, int y);
+            static std::string tileurl(const std::string& tmpl, int z, int x, int y);
+
+            // Expand the URL templates into m_endpoints and m_hosts, the
+            // shared per-host state is not touched
+            void endpoints(const std::vector<std::string>& urls, const std::string& subdomains);
 
             std::string m_name;
             std::string m_url;
@@ -48,20 +105,85 @@ namespace florb
             unsigned int m_parallel;
             int m_type;
 
+            // URL templates with the subdomains filled in, and their hosts
+            std::vector<std::string> m_endpoints;
+            std::vector<std::string> m_hosts;
+
+            double m_rate;
+            unsigned int m_burst;
+            unsigned int m_parallelmin;
+            unsigned int m_parallelmax;
+
             florb::cache *m_cache;
+            florb::imagecache *m_memcache;
             std::vector<char> m_imgbuf;
             std::vector<florb::osmlayer::tileinfo*> m_tileinfos;
             florb::downloader* m_downloader;
             bool m_dlenable;
+            unsigned long m_ttotal;
+            unsigned long m_tmissing;
+            florb::tilestats *m_stats;
+
+            // Debugging bookkeeping: Cache state of the tiles drawn last and
+            // the outcome of the most recent downloads
+            std::vector<florb::osmlayer::tilestate> m_drawn;
+            std::map<uint64_t, florb::osmlayer::fetchinfo> m_fetches;
+            std::deque<uint64_t> m_fetchorder;
 
             static void cb_download(void *userdata);
             void process_downloads();
 
-            bool drawvp(const florb::viewport &viewport, florb::canvas *c, unsigned long *ttotal, unsigned long *tnok);
+            bool drawvp(const florb::viewport &viewport, florb::drawable *c, unsigned long *ttotal, unsigned long *tnok);
+            bool fallback(unsigned int z, unsigned long tx, unsigned long ty, florb::drawable &os, int x, int y);
             void download_qtile(int z, int x, int y);
             bool evt_downloadcomplete(const florb::downloader::event_complete *e);
     };
 
+    class osmlayer::tilestate
+    {
+        public:
+            tilestate(int z, int x, int y, int state) :
+                m_z(z),
+                m_x(x),
+                m_y(y),
+                m_state(state),
+                m_httprc(0),
+                m_latency(0) {};
+
+            int z() const { return m_z; };
+            int x() const { return m_x; };
+            int y() const { return m_y; };
+
+            int state() const { return m_state; };
+            void state(int s) { m_state = s; };
+
+            // HTTP status and duration (microseconds) of the last download
+            // of this tile, 0 if it has not been downloaded in this session
+            long httprc() const { return m_httprc; };
+            void httprc(long rc) { m_httprc = rc; };
+            uint64_t latency() const { return m_latency; };
+            void latency(uint64_t us) { m_latency = us; };
+
+            enum
+            {
+                MEMORY,             // Valid decoded tile in memory
+                CACHED,             // Valid tile from the disk cache
+                EXPIRED,            // Expired tile from the disk cache
+                MISSING,            // No tile and no download pending
+                QUEUED,             // Waiting for a download thread
+                DOWNLOADING,        // Download in progress
+                FAILED              // Download failed, see httprc()
+            };
+
+        private:
+            int m_z;
+            int m_x;
+            int m_y;
+            int m_state;
+            long m_httprc;
+            uint64_t m_latency;
+    };
+
     class osmlayer::event_notify : public event_base
     {
         public:
@@ -0,0 +1,109 @@
+#include <map>
+#include <chrono>
+#include "ratelimit.hpp"
+
+namespace
+{
+    // Host buckets, created under the mutex and never removed
+    boost::interprocess::interprocess_mutex s_mutex;
+    std::map<std::string, florb::ratelimit*> s_hosts;
+}
+
+florb::ratelimit::ratelimit() :
+    m_rate(0.0),
+    m_burst(1),
+    m_next(0.0)
+{
+}
+
+void florb::ratelimit::rate(double r, unsigned int burst)
+{
+    m_mutex.lock();
+    m_rate = (r > 0.0) ? r : 0.0;
+    m_burst = (burst > 0) ? burst : 1;
+    m_mutex.unlock();
+}
+
+double florb::ratelimit::rate()
+{
+    m_mutex.lock();
+    double ret = m_rate;
+    m_mutex.unlock();
+
+    return ret;
+}
+
+unsigned int florb::ratelimit::burst()
+{
+    m_mutex.lock();
+    unsigned int ret = m_burst;
+    m_mutex.unlock();
+
+    return ret;
+}
+
+uint64_t florb::ratelimit::take()
+{
+    double t = (double)now();
+
+    m_mutex.lock();
+
+    // A full bucket lets burst requests through at once, so the next slot
+    // may lie up to burst-1 intervals in the future without waiting
+    double interval = (m_rate > 0.0) ? (1e6 / m_rate) : 0.0;
+    double tolerance = (double)(m_burst - 1) * interval;
+
+    if (m_next < t)
+        m_next = t;
+
+    double wait = m_next - tolerance - t;
+    m_next += interval;
+
+    m_mutex.unlock();
+
+    return (wait > 0.0) ? (uint64_t)wait : 0;
+}
+
+void florb::ratelimit::pause(uint64_t us)
+{
+    double t = (double)now();
+
+    m_mutex.lock();
+
+    double interval = (m_rate > 0.0) ? (1e6 / m_rate) : 0.0;
+    double tolerance = (double)(m_burst - 1) * interval;
+
+    // Empty bucket at the end of the pause
+    double next = t + (double)us + tolerance;
+    if (m_next < next)
+        m_next = next;
+
+    m_mutex.unlock();
+}
+
+florb::ratelimit& florb::ratelimit::host(const std::string& name)
+{
+    s_mutex.lock();
+
+    florb::ratelimit *ret;
+    std::map<std::string, florb::ratelimit*>::iterator it = s_hosts.find(name);
+    if (it != s_hosts.end())
+    {
+        ret = it->second;
+    }
+    else
+    {
+        ret = new florb::ratelimit();
+        s_hosts[name] = ret;
+    }
+
+    s_mutex.unlock();
+
+    return *ret;
+}
+
+uint64_t florb::ratelimit::now()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
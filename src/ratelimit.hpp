@@ -0,0 +1,53 @@
+#ifndef RATELIMIT_HPP
+#define RATELIMIT_HPP
+
+#include <cstdint>
+#include <string>
+#include <boost/interprocess/sync/interprocess_mutex.hpp>
+
+namespace florb
+{
+    // Token bucket limiting the request rate to a tile server. The bucket
+    // holds up to burst requests and refills at rate requests per second.
+    class ratelimit
+    {
+        public:
+            ratelimit();
+
+            // Requests per second and burst size, a rate of 0 disables the
+            // limit
+            void rate(double r, unsigned int burst);
+            double rate();
+            unsigned int burst();
+
+            // Take a token, returns the number of microseconds to wait
+            // before sending the request. Tokens are reserved, concurrent
+            // callers get consecutive slots.
+            uint64_t take();
+
+            // No requests for the next us microseconds, e.g. because the
+            // server answered 429. Afterwards the rate ramps up from zero.
+            void pause(uint64_t us);
+
+            // Bucket of the given host, shared by all downloaders of the
+            // process. Created on first use without a limit.
+            static florb::ratelimit& host(const std::string& name);
+
+        private:
+            ratelimit(const ratelimit&);
+            ratelimit& operator=(const ratelimit&);
+
+            static uint64_t now();
+
+            boost::interprocess::interprocess_mutex m_mutex;
+            double m_rate;
+            unsigned int m_burst;
+
+            // Earliest time the next token becomes available if the bucket
+            // was empty, in microseconds of now()
+            double m_next;
+    };
+};
+
+#endif // RATELIMIT_HPP
+
@@ -0,0 +1,396 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <cstdlib>
+#include <clocale>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <curl/curl.h>
+#include "settings.hpp"
+#include "utils.hpp"
+#include "viewport.hpp"
+#include "bitmap.hpp"
+#include "osmlayer.hpp"
+#include "tracklayer.hpp"
+#include "markerlayer.hpp"
+#include "scalelayer.hpp"
+
+// One image to be rendered
+struct job
+{
+    job() :
+        havebbox(false),
+        z(-1),
+        w(800),
+        h(600),
+        timeout(60),
+        scale(true) {};
+
+    std::string out;
+    std::string gpx;
+    bool havebbox;
+    florb::point2d<double> bbox1;
+    florb::point2d<double> bbox2;
+    int z;
+    unsigned int w;
+    unsigned int h;
+    std::vector< florb::point2d<double> > markers;
+    std::string server;
+    unsigned int timeout;
+    bool scale;
+};
+
+static void usage()
+{
+    std::cerr <<
+        "Usage: florb-render [options] -o FILE\n"
+        "       florb-render -f JOBFILE [-j N]\n"
+        "\n"
+        "  -o FILE                  Output PNG file\n"
+        "  -b LON1,LAT1,LON2,LAT2   Area to render\n"
+        "  -g FILE                  GPX track to draw, also the area if -b is missing\n"
+        "  -z ZOOM                  Zoom level, default: closest at which the area fits\n"
+        "  -W PIXELS                Image width (800)\n"
+        "  -H PIXELS                Image height (600)\n"
+        "  -m LON,LAT               Draw a marker, may be repeated\n"
+        "  -s NAME                  Tile server from the configuration, default: first\n"
+        "  -t SECONDS               Maximum time to wait for tiles (60)\n"
+        "  -n                       Do not draw the scale\n"
+        "  -f JOBFILE               Render one image per line of options, - for stdin\n"
+        "  -j N                     Number of images rendered in parallel (1)\n";
+}
+
+static bool parse_coords(const std::string& s, std::vector<double>& out, std::size_t n)
+{
+    std::vector<std::string> v(florb::utils::str_split(s, ","));
+    if (v.size() != n)
+        return false;
+
+    out.clear();
+    for (std::size_t i=0;i<n;i++)
+    {
+        double d;
+        if (!florb::utils::fromstr(v[i], d))
+            return false;
+        out.push_back(d);
+    }
+
+    return true;
+}
+
+// Parse the options of a single job. Batch options (-f, -j) are returned
+// separately, they are not allowed in job files.
+static void parse(const std::vector<std::string>& args, job& j, std::string* jobfile, unsigned int* parallel)
+{
+    for (std::size_t i=0;i<args.size();i++)
+    {
+        const std::string& a = args[i];
+        bool flag = (a == "-n");
+
+        if ((!flag) && ((i+1) >= args.size()))
+            throw std::runtime_error(std::string(_("Missing argument for option ")) + a);
+
+        std::vector<double> c;
+        bool ok = true;
+
+        if (a == "-n")
+            j.scale = false;
+        else if (a == "-o")
+            j.out = args[++i];
+        else if (a == "-g")
+            j.gpx = args[++i];
+        else if (a == "-s")
+            j.server = args[++i];
+        else if (a == "-b")
+        {
+            if (!parse_coords(args[++i], c, 4))
+                throw std::runtime_error(_("Invalid bounding box"));
+            j.bbox1 = florb::point2d<double>(c[0], c[1]);
+            j.bbox2 = florb::point2d<double>(c[2], c[3]);
+            j.havebbox = true;
+        }
+        else if (a == "-m")
+        {
+            if (!parse_coords(args[++i], c, 2))
+                throw std::runtime_error(_("Invalid marker position"));
+            j.markers.push_back(florb::point2d<double>(c[0], c[1]));
+        }
+        else if (a == "-z")
+            ok = florb::utils::fromstr(args[++i], j.z);
+        else if (a == "-W")
+            ok = florb::utils::fromstr(args[++i], j.w);
+        else if (a == "-H")
+            ok = florb::utils::fromstr(args[++i], j.h);
+        else if (a == "-t")
+            ok = florb::utils::fromstr(args[++i], j.timeout);
+        else if ((a == "-f") && (jobfile != NULL))
+            *jobfile = args[++i];
+        else if ((a == "-j") && (parallel != NULL))
+            ok = florb::utils::fromstr(args[++i], *parallel);
+        else
+            throw std::runtime_error(std::string(_("Invalid option ")) + a);
+
+        if (!ok)
+            throw std::runtime_error(std::string(_("Invalid argument for option ")) + a);
+    }
+}
+
+static void check(const job& j)
+{
+    if (j.out.empty())
+        throw std::runtime_error(_("No output file given"));
+    if ((!j.havebbox) && (j.gpx.empty()))
+        throw std::runtime_error(_("Either a bounding box or a GPX file is required"));
+    if ((j.w == 0) || (j.h == 0))
+        throw std::runtime_error(_("Invalid image size"));
+    if ((j.z > florb::viewport::ZMAX) || (j.z < -1))
+        throw std::runtime_error(_("Invalid zoom level"));
+}
+
+static florb::cfg_tileserver tileserver(const std::string& name)
+{
+    std::vector<florb::cfg_tileserver> v =
+        florb::settings::get_instance()["tileservers"].as< std::vector<florb::cfg_tileserver> >();
+
+    std::vector<florb::cfg_tileserver>::iterator it;
+    for (it=v.begin();it!=v.end();++it)
+    {
+        if ((name.empty()) || ((*it).name() == name))
+            return (*it);
+    }
+
+    throw std::runtime_error(std::string(_("Unknown tile server ")) + name);
+}
+
+static void render(const job& j)
+{
+    florb::cfg_tileserver ts(tileserver(j.server));
+
+    // Track layer, the track might define the area as well
+    florb::tracklayer trk;
+    if (!j.gpx.empty())
+        trk.load_track(j.gpx);
+
+    florb::point2d<double> pmin, pmax;
+    if (j.havebbox)
+    {
+        florb::point2d<double> p1(florb::utils::wsg842merc(j.bbox1));
+        florb::point2d<double> p2(florb::utils::wsg842merc(j.bbox2));
+        pmin = florb::point2d<double>(std::min(p1.x(), p2.x()), std::min(p1.y(), p2.y()));
+        pmax = florb::point2d<double>(std::max(p1.x(), p2.x()), std::max(p1.y(), p2.y()));
+    }
+    else if (!trk.extent(pmin, pmax))
+        throw std::runtime_error(_("GPX file contains no trackpoints"));
+
+    // Closest zoom level at which the area fits the image
+    unsigned int z = (unsigned int)j.z;
+    if (j.z < 0)
+    {
+        for (z=ts.zmax();z>ts.zmin();z--)
+        {
+            florb::point2d<unsigned long> px1(florb::utils::merc2px(z, pmin));
+            florb::point2d<unsigned long> px2(florb::utils::merc2px(z, pmax));
+            if (((px2.x()-px1.x()) < j.w) && ((px2.y()-px1.y()) < j.h))
+                break;
+        }
+    }
+
+    // Center the viewport over the area
+    florb::point2d<unsigned long> px1(florb::utils::merc2px(z, pmin));
+    florb::point2d<unsigned long> px2(florb::utils::merc2px(z, pmax));
+    unsigned long dim = florb::utils::dim(z);
+    unsigned long cx = (px1.x()+px2.x())/2, cy = (px1.y()+px2.y())/2;
+    unsigned long w = (j.w < dim) ? j.w : dim;
+    unsigned long h = (j.h < dim) ? j.h : dim;
+    unsigned long x = (cx > (w/2)) ? (cx - (w/2)) : 0;
+    unsigned long y = (cy > (h/2)) ? (cy - (h/2)) : 0;
+    x = ((x + w) > dim) ? (dim - w) : x;
+    y = ((y + h) > dim) ? (dim - h) : y;
+
+    florb::viewport vp(x, y, z, w, h);
+
+    // Fetch all tiles
+    florb::osmlayer osm(ts.name(), ts.url(), ts.zmin(), ts.zmax(), ts.parallel(), ts.type());
+    osm.mirrors(ts.mirrors(), ts.subdomains());
+    osm.ratelimit(ts.rate(), ts.burst());
+    osm.concurrency(ts.parallel(), ts.parallelmax());
+    if (!osm.prefetch(vp, j.timeout))
+        std::cerr << j.out << ": " << _("Not all tiles could be downloaded") << std::endl;
+
+    florb::markerlayer mrk;
+    std::vector< florb::point2d<double> >::const_iterator it;
+    for (it=j.markers.begin();it!=j.markers.end();++it)
+        mrk.add(florb::utils::wsg842merc(*it));
+
+    florb::scalelayer scl;
+
+    // Draw everything in the same order as the map widget does
+    florb::bitmap bm(j.w, j.h);
+    bm.fgcolor(florb::color(0xc06e6e));
+    bm.fillrect(0, 0, bm.w(), bm.h());
+
+    osm.draw(vp, bm);
+    if (j.scale)
+        scl.draw(vp, bm);
+    trk.draw(vp, bm);
+    mrk.draw(vp, bm);
+
+    bm.save_png(j.out);
+}
+
+static bool render_safe(const job& j)
+{
+    try {
+        render(j);
+    } catch (std::exception& e) {
+        std::cerr << j.out << ": " << e.what() << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+static void load_jobs(const std::string& path, std::vector<job>& jobs)
+{
+    std::ifstream f;
+    std::istream *in = &std::cin;
+    if (path != "-")
+    {
+        f.open(path.c_str());
+        if (!f.is_open())
+            throw std::runtime_error(std::string(_("Failed to open job file ")) + path);
+        in = &f;
+    }
+
+    std::string line;
+    while (std::getline(*in, line))
+    {
+        // Split at whitespace, skip empty lines and comments
+        std::istringstream iss(line);
+        std::vector<std::string> args;
+        std::string a;
+        while (iss >> a)
+            args.push_back(a);
+
+        if ((args.size() == 0) || (args[0][0] == '#'))
+            continue;
+
+        job j;
+        parse(args, j, NULL, NULL);
+        check(j);
+        jobs.push_back(j);
+    }
+}
+
+// Every worker is a separate process with its own settings, layers and
+// downloaders. The layers are not meant to be shared between threads and the
+// tile cache is safe to use from several processes.
+static unsigned int render_parallel(const std::vector<job>& jobs, unsigned int parallel)
+{
+    std::vector<pid_t> workers;
+
+    for (unsigned int w=0;w<parallel;w++)
+    {
+        pid_t pid = fork();
+        if (pid < 0)
+            break;
+
+        if (pid == 0)
+        {
+            int failed = 0;
+            for (std::size_t i=w;i<jobs.size();i+=parallel)
+            {
+                if (!render_safe(jobs[i]))
+                    failed = 1;
+            }
+
+            // Skip static destructors, the parent saves the settings
+            curl_global_cleanup();
+            _exit(failed);
+        }
+
+        workers.push_back(pid);
+    }
+
+    if (workers.size() != parallel)
+        std::cerr << _("Failed to start all render processes") << std::endl;
+
+    unsigned int failed = (workers.size() == parallel) ? 0 : 1;
+    std::vector<pid_t>::iterator it;
+    for (it=workers.begin();it!=workers.end();++it)
+    {
+        int status;
+        if ((waitpid(*it, &status, 0) < 0) || (!WIFEXITED(status)) || (WEXITSTATUS(status) != 0))
+            failed++;
+    }
+
+    return failed;
+}
+
+int main(int argc, char* argv[])
+{
+    // Setup gettext
+    setlocale(LC_ALL, "");
+    bindtextdomain("florb", LOCALEDIR);
+    textdomain("florb");
+
+    std::vector<std::string> args(argv+1, argv+argc);
+    if (args.size() == 0)
+    {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    job j;
+    std::string jobfile;
+    unsigned int parallel = 1;
+    std::vector<job> jobs;
+
+    try {
+        parse(args, j, &jobfile, &parallel);
+
+        if (jobfile.empty())
+        {
+            check(j);
+            jobs.push_back(j);
+        }
+        else
+            load_jobs(jobfile, jobs);
+
+        // Load the settings before any worker is started
+        florb::settings::get_instance();
+    } catch (std::exception& e) {
+        std::cerr << "florb-render: " << e.what() << std::endl;
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    if (parallel < 1)
+        parallel = 1;
+    if (parallel > jobs.size())
+        parallel = jobs.size();
+
+    curl_global_init(CURL_GLOBAL_ALL);
+
+    unsigned int failed = 0;
+    if (parallel == 1)
+    {
+        std::vector<job>::iterator it;
+        for (it=jobs.begin();it!=jobs.end();++it)
+        {
+            if (!render_safe(*it))
+                failed++;
+        }
+    }
+    else
+        failed = render_parallel(jobs, parallel);
+
+    curl_global_cleanup();
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
@@ -16,7 +16,7 @@ florb::scalelayer::~scalelayer()
 {
 };
 
-bool florb::scalelayer::draw(const viewport &viewport, florb::canvas &os)
+bool florb::scalelayer::draw(const viewport &viewport, florb::drawable &os)
 {
     // Calculate coordinate in the center of the viewport
     florb::point2d<unsigned long> ppx(viewport.x() + (viewport.w()/2), viewport.y() + (viewport.h()/2));
@@ -0,0 +1,81 @@
+#ifndef SEQLOCK_HPP
+#define SEQLOCK_HPP
+
+#include <atomic>
+#include <cstring>
+#include <type_traits>
+
+namespace florb
+{
+    // Sequence lock for small, trivially copyable values. There may be only
+    // one writer at a time. Readers never block the writer and always get a
+    // consistent copy, they just retry if a write happened in the meantime.
+    template <class T>
+    class seqlock
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "seqlock value must be trivially copyable");
+
+        public:
+            seqlock() :
+                m_seq(0)
+            {
+                store(T());
+            };
+            explicit seqlock(const T& v) :
+                m_seq(0)
+            {
+                store(v);
+            };
+
+            void store(const T& v)
+            {
+                unsigned long words[NWORDS] = {0};
+                memcpy(words, &v, sizeof(T));
+
+                // Odd sequence number: write in progress
+                unsigned int seq = m_seq.load(std::memory_order_relaxed);
+                m_seq.store(seq+1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+
+                for (std::size_t i=0;i<NWORDS;i++)
+                    m_data[i].store(words[i], std::memory_order_relaxed);
+
+                m_seq.store(seq+2, std::memory_order_release);
+            };
+
+            T load() const
+            {
+                unsigned long words[NWORDS];
+                unsigned int s1, s2;
+
+                do {
+                    s1 = m_seq.load(std::memory_order_acquire);
+
+                    for (std::size_t i=0;i<NWORDS;i++)
+                        words[i] = m_data[i].load(std::memory_order_relaxed);
+
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    s2 = m_seq.load(std::memory_order_relaxed);
+                } while ((s1 & 1) || (s1 != s2));
+
+                T ret;
+                memcpy(&ret, words, sizeof(T));
+                return ret;
+            };
+
+            // Number of completed writes
+            unsigned int version() const
+            {
+                return m_seq.load(std::memory_order_acquire) >> 1;
+            };
+
+        private:
+            static const std::size_t NWORDS = (sizeof(T) + sizeof(unsigned long) - 1) / sizeof(unsigned long);
+
+            std::atomic<unsigned int> m_seq;
+            std::atomic<unsigned long> m_data[NWORDS];
+    };
+};
+
+#endif // SEQLOCK_HPP
+
@@ -54,5 +54,9 @@ void florb::settings::defaults(const std::string& path)
     // Units default configuration
     florb::cfg_units cfgunits = m_rootnode["units"].as<florb::cfg_units>();
     m_rootnode["units"] = cfgunits;
+
+    // Statistics default configuration
+    florb::cfg_stats cfgstats = m_rootnode["stats"].as<florb::cfg_stats>();
+    m_rootnode["stats"] = cfgstats;
 }
 
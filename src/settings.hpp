@@ -2,6 +2,7 @@
 #define SETTINGS_HPP
 
 #include <string>
+#include <vector>
 #include <yaml-cpp/yaml.h>
 #include "gfx.hpp"
 #include "utils.hpp"
@@ -18,6 +19,10 @@ namespace florb
                     m_zmin(0),
                     m_zmax(18),
                     m_parallel(2),
+                    m_parallelmax(0),
+                    m_rate(0.0),
+                    m_burst(1),
+                    m_subdomains("abc"),
                     m_type(florb::image::PNG) {};
 
             const std::string& name() const { return m_name; }
@@ -35,6 +40,27 @@ namespace florb
             unsigned int parallel() const { return m_parallel; }
             void parallel(unsigned int p) { m_parallel = p; }
 
+            // Upper bound for adapting the number of parallel downloads at
+            // runtime, parallel is the lower bound. 0 keeps it fixed.
+            unsigned int parallelmax() const { return m_parallelmax; }
+            void parallelmax(unsigned int p) { m_parallelmax = p; }
+
+            // Requests per second allowed by the server, 0 for no limit,
+            // and the number of requests which may go out at once
+            double rate() const { return m_rate; }
+            void rate(double r) { m_rate = r; }
+
+            unsigned int burst() const { return m_burst; }
+            void burst(unsigned int b) { m_burst = b; }
+
+            // Values for {s} in the URL, one character each
+            const std::string& subdomains() const { return m_subdomains; }
+            void subdomains(const std::string& s) { m_subdomains = s; }
+
+            // Further URLs serving the same tiles
+            const std::vector<std::string>& mirrors() const { return m_mirrors; }
+            void mirrors(const std::vector<std::string>& m) { m_mirrors = m; }
+
             unsigned int type() const { return m_type; }
             void type(unsigned int t) { m_type = t; }
 
@@ -44,6 +70,11 @@ namespace florb
             unsigned int m_zmin;
             unsigned int m_zmax;
             unsigned int m_parallel;
+            unsigned int m_parallelmax;
+            double m_rate;
+            unsigned int m_burst;
+            std::string m_subdomains;
+            std::vector<std::string> m_mirrors;
             int m_type;
     };
 
@@ -54,7 +85,8 @@ namespace florb
             cfg_gpsd() :
                 m_enabled(false),
                 m_host("localhost"),
-                m_port("2947") {};
+                m_port("2947"),
+                m_replayspeed(1.0) {};
 
             bool enabled() const { return m_enabled; };
             void enabled(bool e) { m_enabled = e; };
@@ -65,10 +97,24 @@ namespace florb
             const std::string& port() const { return m_port; };
             void port(const std::string& p) { m_port = p; };
 
+            // Replay a NMEA / gpsd JSON log instead of connecting to gpsd
+            const std::string& replay() const { return m_replay; };
+            void replay(const std::string& r) { m_replay = r; };
+
+            double replayspeed() const { return m_replayspeed; };
+            void replayspeed(double s) { m_replayspeed = s; };
+
+            // Serve the replay on this local port as a gpsd stand-in
+            const std::string& replayport() const { return m_replayport; };
+            void replayport(const std::string& p) { m_replayport = p; };
+
         private:
             bool m_enabled;
             std::string m_host;
             std::string m_port;
+            std::string m_replay;
+            double m_replayspeed;
+            std::string m_replayport;
     };
 
     // Cache configuration class
@@ -76,13 +122,63 @@ namespace florb
     {
         public:
             cfg_cache() :
-                m_location(florb::utils::appdir() + "/tiles") {};
+                m_location(florb::utils::appdir() + "/tiles"),
+                m_memory(64),
+                m_quota(0),
+                m_totalquota(4096),
+                m_sync(false) {};
 
             const std::string& location() const { return m_location; }
             void location(const std::string& location) { m_location = location; }
 
+            // Megabytes of decoded tiles kept in memory per map layer
+            unsigned int memory() const { return m_memory; }
+            void memory(unsigned int m) { m_memory = m; }
+
+            // Megabytes of tiles on disk per map and in total, 0 for no
+            // limit
+            unsigned int quota() const { return m_quota; }
+            void quota(unsigned int q) { m_quota = q; }
+            unsigned int totalquota() const { return m_totalquota; }
+            void totalquota(unsigned int q) { m_totalquota = q; }
+
+            // Sync tiles to disk as they are written
+            bool sync() const { return m_sync; }
+            void sync(bool s) { m_sync = s; }
+
         private:    
             std::string m_location; 
+            unsigned int m_memory;
+            unsigned int m_quota;
+            unsigned int m_totalquota;
+            bool m_sync;
+    };
+
+    // Diagnostics configuration class
+    class cfg_stats
+    {
+        public:
+            cfg_stats() :
+                m_file(""),
+                m_interval(10),
+                m_trace(florb::utils::appdir() + "/trace.json") {};
+
+            // Dump the statistics to this file, nothing is written if empty
+            const std::string& file() const { return m_file; }
+            void file(const std::string& f) { m_file = f; }
+
+            // Seconds between two dumps
+            unsigned int interval() const { return m_interval; }
+            void interval(unsigned int i) { m_interval = i; }
+
+            // Timeline traces are written to this file
+            const std::string& trace() const { return m_trace; }
+            void trace(const std::string& t) { m_trace = t; }
+
+        private:
+            std::string m_file;
+            unsigned int m_interval;
+            std::string m_trace;
     };
 
     // UI configuration class
@@ -95,7 +191,11 @@ namespace florb
                 m_trackcolor(florb::color(0xff,0,0)),
                 m_selectioncolor(florb::color(0xff,0,0xff)),
                 m_gpscursorcolor(florb::color(0xff,0,0xff)),
-                m_tracklinewidth(2) {};
+                m_tracklinewidth(2),
+                m_gpscursorfps(25),
+                m_maxfps(60),
+                m_overscan(256),
+                m_zoomtime(250) {};
 
             florb::color markercolor() const { return m_markercolor; }
             void markercolor(florb::color c) { m_markercolor = c; }
@@ -115,6 +215,24 @@ namespace florb
             unsigned int tracklinewidth() const { return m_tracklinewidth; }
             void tracklinewidth(unsigned int w) { m_tracklinewidth = w; }
 
+            // Maximum rate of interpolated GPS cursor updates, 0 to only
+            // move the cursor when a new fix arrives
+            unsigned int gpscursorfps() const { return m_gpscursorfps; }
+            void gpscursorfps(unsigned int f) { m_gpscursorfps = f; }
+
+            // Maximum rate of map redraws, 0 for no limit
+            unsigned int maxfps() const { return m_maxfps; }
+            void maxfps(unsigned int f) { m_maxfps = f; }
+
+            // Margin (pixels per side) rendered around the visible map, 0
+            // to disable
+            unsigned int overscan() const { return m_overscan; }
+            void overscan(unsigned int o) { m_overscan = o; }
+
+            // Duration (milliseconds) of animated zoom, 0 to disable
+            unsigned int zoomtime() const { return m_zoomtime; }
+            void zoomtime(unsigned int t) { m_zoomtime = t; }
+
         private:
 
             florb::color m_markercolor;
@@ -123,6 +241,10 @@ namespace florb
             florb::color m_selectioncolor;
             florb::color m_gpscursorcolor;
             unsigned int m_tracklinewidth;
+            unsigned int m_gpscursorfps;
+            unsigned int m_maxfps;
+            unsigned int m_overscan;
+            unsigned int m_zoomtime;
 
     };
 
@@ -202,6 +324,12 @@ namespace YAML {
                 node["zmin"] = rhs.zmin();
                 node["zmax"] = rhs.zmax();
                 node["parallel"] = rhs.parallel();
+                node["parallelmax"] = rhs.parallelmax();
+                node["rate"] = rhs.rate();
+                node["burst"] = rhs.burst();
+                node["subdomains"] = rhs.subdomains();
+                if (!rhs.mirrors().empty())
+                    node["mirrors"] = rhs.mirrors();
 
                 node["type"] = "PNG";
                 if      (rhs.type() == florb::image::PNG)
@@ -232,6 +360,21 @@ namespace YAML {
                 if (node["parallel"])
                     rhs.parallel(node["parallel"].as<int>());
 
+                if (node["parallelmax"])
+                    rhs.parallelmax(node["parallelmax"].as<unsigned int>());
+
+                if (node["rate"])
+                    rhs.rate(node["rate"].as<double>());
+
+                if (node["burst"])
+                    rhs.burst(node["burst"].as<unsigned int>());
+
+                if (node["subdomains"])
+                    rhs.subdomains(node["subdomains"].as<std::string>());
+
+                if (node["mirrors"])
+                    rhs.mirrors(node["mirrors"].as< std::vector<std::string> >());
+
                 if (node["type"])
                 {
                     rhs.type(florb::image::PNG);
@@ -251,6 +394,10 @@ namespace YAML {
             static Node encode(const florb::cfg_cache& rhs) {
                 Node node;
                 node["location"] = rhs.location();
+                node["memory"] = rhs.memory();
+                node["quota"] = rhs.quota();
+                node["totalquota"] = rhs.totalquota();
+                node["sync"] = rhs.sync();
                 return node;
             }
 
@@ -262,6 +409,46 @@ namespace YAML {
                 if (node["location"])
                     rhs.location(node["location"].as<std::string>());
 
+                if (node["memory"])
+                    rhs.memory(node["memory"].as<unsigned int>());
+
+                if (node["quota"])
+                    rhs.quota(node["quota"].as<unsigned int>());
+
+                if (node["totalquota"])
+                    rhs.totalquota(node["totalquota"].as<unsigned int>());
+
+                if (node["sync"])
+                    rhs.sync(node["sync"].as<bool>());
+
+                return true;
+            }
+        };
+
+    template<>
+        struct convert<florb::cfg_stats> {
+            static Node encode(const florb::cfg_stats& rhs) {
+                Node node;
+                node["file"] = rhs.file();
+                node["interval"] = rhs.interval();
+                node["trace"] = rhs.trace();
+                return node;
+            }
+
+            static bool decode(const Node& node, florb::cfg_stats& rhs) 
+            {
+                if((!node.IsMap()) || (node.size() == 0))
+                    return true;
+
+                if (node["file"])
+                    rhs.file(node["file"].as<std::string>());
+
+                if (node["interval"])
+                    rhs.interval(node["interval"].as<unsigned int>());
+
+                if (node["trace"])
+                    rhs.trace(node["trace"].as<std::string>());
+
                 return true;
             }
         };
@@ -314,6 +501,9 @@ namespace YAML {
                 node["enabled"] = rhs.enabled();
                 node["host"] = rhs.host();
                 node["port"] = rhs.port();
+                node["replay"] = rhs.replay();
+                node["replayspeed"] = rhs.replayspeed();
+                node["replayport"] = rhs.replayport();
                 return node;
             }
 
@@ -331,6 +521,15 @@ namespace YAML {
                 if (node["port"])
                     rhs.port(node["port"].as<std::string>());
 
+                if (node["replay"])
+                    rhs.replay(node["replay"].as<std::string>());
+
+                if (node["replayspeed"])
+                    rhs.replayspeed(node["replayspeed"].as<double>());
+
+                if (node["replayport"])
+                    rhs.replayport(node["replayport"].as<std::string>());
+
                 return true;
             }
         };
@@ -345,6 +544,10 @@ namespace YAML {
                 node["selectioncolor"] = rhs.selectioncolor().rgb();
                 node["gpscursorcolor"] = rhs.gpscursorcolor().rgb();
                 node["tracklinewidth"] = rhs.tracklinewidth();
+                node["gpscursorfps"] = rhs.gpscursorfps();
+                node["maxfps"] = rhs.maxfps();
+                node["overscan"] = rhs.overscan();
+                node["zoomtime"] = rhs.zoomtime();
                 return node;
             }
 
@@ -374,6 +577,18 @@ namespace YAML {
                 if (node["tracklinewidth"])
                     rhs.tracklinewidth(node["tracklinewidth"].as<unsigned int>());
 
+                if (node["gpscursorfps"])
+                    rhs.gpscursorfps(node["gpscursorfps"].as<unsigned int>());
+
+                if (node["maxfps"])
+                    rhs.maxfps(node["maxfps"].as<unsigned int>());
+
+                if (node["overscan"])
+                    rhs.overscan(node["overscan"].as<unsigned int>());
+
+                if (node["zoomtime"])
+                    rhs.zoomtime(node["zoomtime"].as<unsigned int>());
+
                 return true;
             }
         };
@@ -0,0 +1,107 @@
+#include <sstream>
+#include "gfx.hpp"
+#include "tiledebuglayer.hpp"
+
+#define TILE_W                  (256)
+#define TILE_H                  (256)
+
+florb::tiledebuglayer::tiledebuglayer() :
+    m_source(NULL)
+{
+    name(std::string("Tile debug"));
+};
+
+florb::tiledebuglayer::~tiledebuglayer()
+{
+};
+
+void florb::tiledebuglayer::source(florb::osmlayer *l)
+{
+    m_source = l;
+}
+
+florb::color florb::tiledebuglayer::statecolor(int state)
+{
+    switch (state)
+    {
+        case florb::osmlayer::tilestate::MEMORY:
+            return florb::color(0x60ff60);
+        case florb::osmlayer::tilestate::CACHED:
+            return florb::color(0x00b000);
+        case florb::osmlayer::tilestate::EXPIRED:
+            return florb::color(0xe0b000);
+        case florb::osmlayer::tilestate::QUEUED:
+            return florb::color(0x3070ff);
+        case florb::osmlayer::tilestate::DOWNLOADING:
+            return florb::color(0x00c0c0);
+        case florb::osmlayer::tilestate::FAILED:
+            return florb::color(0xff0000);
+        default:
+            return florb::color(0x808080);
+    }
+}
+
+std::string florb::tiledebuglayer::statename(int state)
+{
+    switch (state)
+    {
+        case florb::osmlayer::tilestate::MEMORY:
+            return "memory";
+        case florb::osmlayer::tilestate::CACHED:
+            return "cached";
+        case florb::osmlayer::tilestate::EXPIRED:
+            return "expired";
+        case florb::osmlayer::tilestate::QUEUED:
+            return "queued";
+        case florb::osmlayer::tilestate::DOWNLOADING:
+            return "downloading";
+        case florb::osmlayer::tilestate::FAILED:
+            return "failed";
+        default:
+            return "missing";
+    }
+}
+
+bool florb::tiledebuglayer::draw(const viewport &viewport, florb::drawable &os)
+{
+    if (!enabled())
+        return true;
+
+    // The source layer might have been replaced since it was set
+    if ((!m_source) || (!is_instance(m_source)))
+        return true;
+
+    m_source->tiles(m_tiles);
+    os.fontsize(10);
+
+    std::vector<florb::osmlayer::tilestate>::iterator it;
+    for (it=m_tiles.begin();it!=m_tiles.end();++it)
+    {
+        if ((*it).z() != (int)viewport.z())
+            continue;
+
+        int px = (int)((long)(*it).x()*TILE_W - (long)viewport.x());
+        int py = (int)((long)(*it).y()*TILE_H - (long)viewport.y());
+
+        // Two pixel wide outline, inset so neighbouring tiles stay apart
+        os.fgcolor(statecolor((*it).state()));
+        os.rect(px+1, py+1, TILE_W-2, TILE_H-2);
+        os.rect(px+2, py+2, TILE_W-4, TILE_H-4);
+
+        std::ostringstream l1, l2;
+        l1 << (*it).z() << "/" << (*it).x() << "/" << (*it).y();
+        l2 << statename((*it).state());
+        if ((*it).httprc() != 0)
+            l2 << " " << (*it).httprc();
+        if ((*it).latency() != 0)
+            l2 << " " << ((*it).latency()+500)/1000 << "ms";
+
+        // Label on a solid background in the state colour
+        os.fillrect(px+2, py+2, 120, 28);
+        os.fgcolor(florb::color(0xffffff));
+        os.text(l1.str(), px+6, py+5);
+        os.text(l2.str(), px+6, py+17);
+    }
+
+    return true;
+};
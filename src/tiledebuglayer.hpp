@@ -0,0 +1,31 @@
+#ifndef TILEDEBUGLAYER_HPP
+#define TILEDEBUGLAYER_HPP
+
+#include "layer.hpp"
+#include "viewport.hpp"
+#include "osmlayer.hpp"
+
+namespace florb
+{
+    // Draws the tile grid of a tile layer, each tile outlined in the colour
+    // of its cache or download state and labelled with its z/x/y and the
+    // result of its last download.
+    class tiledebuglayer : public florb::layer
+    {
+        public:
+            tiledebuglayer();
+            ~tiledebuglayer();
+
+            void source(florb::osmlayer *l);
+            bool draw(const florb::viewport &viewport, florb::drawable &os);
+
+        private:
+            static florb::color statecolor(int state);
+            static std::string statename(int state);
+
+            florb::osmlayer *m_source;
+            std::vector<florb::osmlayer::tilestate> m_tiles;
+    };
+};
+
+#endif // TILEDEBUGLAYER_HPP
@@ -0,0 +1,241 @@
+#include <map>
+#include <fstream>
+#include <cstdio>
+#include <chrono>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/interprocess/sync/interprocess_mutex.hpp>
+#include "tilestats.hpp"
+
+namespace
+{
+    const char *counter_names[] = {
+        "enqueued", "dropped", "dl_ok", "dl_failed", "dl_bytes",
+        "dl_notmodified", "dl_throttled", "dl_retries", "dl_blocked",
+        "mem_hits", "hits", "expired", "misses", "decode_errors"
+    };
+
+    const char *gauge_names[] = {
+        "dl_limit", "dl_inflight", "dl_rtt_us", "dl_rtt_min_us", "dl_hosts_down"
+    };
+
+    const char *stage_names[] = {
+        "queue_wait", "transfer", "cache_get", "cache_put", "decode", "blit"
+    };
+
+    // Layer registry and the dump thread. Instances are created under the
+    // mutex and never removed, so the hot path never has to lock.
+    boost::interprocess::interprocess_mutex s_mutex;
+    std::map<std::string, florb::tilestats*> s_registry;
+
+    boost::thread *s_dumper = NULL;
+    std::string s_dumppath;
+
+    void dumper(unsigned int interval)
+    {
+        try {
+            for (;;)
+            {
+                boost::this_thread::sleep(boost::posix_time::seconds(interval));
+                florb::tilestats::dump(s_dumppath);
+            }
+        } catch (boost::thread_interrupted&) {
+        }
+    }
+}
+
+florb::tilestats::tilestats()
+{
+    reset();
+}
+
+void florb::tilestats::reset()
+{
+    for (int i=0;i<NCOUNTERS;i++)
+        m_counters[i].store(0, std::memory_order_relaxed);
+
+    for (int i=0;i<NGAUGES;i++)
+        m_gauges[i].store(0, std::memory_order_relaxed);
+
+    for (int i=0;i<NSTAGES;i++)
+        m_latency[i].reset();
+}
+
+void florb::tilestats::count(counter c, uint64_t n)
+{
+    m_counters[c].fetch_add(n, std::memory_order_relaxed);
+}
+
+void florb::tilestats::record(stage s, uint64_t us)
+{
+    m_latency[s].record(us);
+}
+
+void florb::tilestats::set(gauge g, uint64_t v)
+{
+    m_gauges[g].store(v, std::memory_order_relaxed);
+}
+
+uint64_t florb::tilestats::value(counter c) const
+{
+    return m_counters[c].load(std::memory_order_relaxed);
+}
+
+uint64_t florb::tilestats::value(gauge g) const
+{
+    return m_gauges[g].load(std::memory_order_relaxed);
+}
+
+const florb::histogram& florb::tilestats::latency(stage s) const
+{
+    return m_latency[s];
+}
+
+const char* florb::tilestats::name(counter c)
+{
+    return counter_names[c];
+}
+
+const char* florb::tilestats::name(gauge g)
+{
+    return gauge_names[g];
+}
+
+const char* florb::tilestats::name(stage s)
+{
+    return stage_names[s];
+}
+
+uint64_t florb::tilestats::now()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+florb::tilestats& florb::tilestats::get(const std::string& layer)
+{
+    s_mutex.lock();
+
+    florb::tilestats *ret;
+    std::map<std::string, florb::tilestats*>::iterator it = s_registry.find(layer);
+    if (it != s_registry.end())
+    {
+        ret = it->second;
+    }
+    else
+    {
+        ret = new florb::tilestats();
+        s_registry[layer] = ret;
+    }
+
+    s_mutex.unlock();
+
+    return *ret;
+}
+
+std::vector<std::string> florb::tilestats::layers()
+{
+    std::vector<std::string> ret;
+
+    s_mutex.lock();
+    std::map<std::string, florb::tilestats*>::iterator it;
+    for (it=s_registry.begin();it!=s_registry.end();++it)
+        ret.push_back(it->first);
+    s_mutex.unlock();
+
+    return ret;
+}
+
+void florb::tilestats::dump(std::ostream& os)
+{
+    std::vector<std::string> names = layers();
+
+    os << "{\"layers\": {";
+    for (size_t l=0;l<names.size();l++)
+    {
+        const florb::tilestats& ts = get(names[l]);
+
+        // Layer names come from the configuration, escape the characters
+        // which would break the JSON document
+        std::string esc;
+        for (size_t i=0;i<names[l].size();i++)
+        {
+            if ((names[l][i] == '"') || (names[l][i] == '\\'))
+                esc += '\\';
+            esc += names[l][i];
+        }
+
+        os << ((l > 0) ? ",\n" : "\n") << "  \"" << esc << "\": {\n";
+
+        os << "    \"counters\": {";
+        for (int i=0;i<NCOUNTERS;i++)
+        {
+            os << ((i > 0) ? ", " : "") << "\"" << name((counter)i) << "\": " << ts.value((counter)i);
+        }
+        os << "},\n";
+
+        os << "    \"gauges\": {";
+        for (int i=0;i<NGAUGES;i++)
+        {
+            os << ((i > 0) ? ", " : "") << "\"" << name((gauge)i) << "\": " << ts.value((gauge)i);
+        }
+        os << "},\n";
+
+        os << "    \"latency_us\": {";
+        for (int i=0;i<NSTAGES;i++)
+        {
+            const florb::histogram& h = ts.latency((stage)i);
+            os << ((i > 0) ? "," : "") << "\n      \"" << name((stage)i) << "\": {" <<
+                "\"count\": " << h.count() << ", " <<
+                "\"mean\": " << (uint64_t)h.mean() << ", " <<
+                "\"p50\": " << h.percentile(50.0) << ", " <<
+                "\"p90\": " << h.percentile(90.0) << ", " <<
+                "\"p99\": " << h.percentile(99.0) << ", " <<
+                "\"max\": " << h.max() << "}";
+        }
+        os << "\n    }\n  }";
+    }
+    os << "\n}}\n";
+}
+
+void florb::tilestats::dump(const std::string& path)
+{
+    // Write to a temporary file first so readers never see a partial dump
+    std::string tmp(path + ".tmp");
+    std::ofstream fout(tmp.c_str(), std::ios::out | std::ios::trunc);
+    if (!fout)
+        return;
+
+    dump(fout);
+    fout.close();
+
+    if (!fout || (std::rename(tmp.c_str(), path.c_str()) != 0))
+        std::remove(tmp.c_str());
+}
+
+void florb::tilestats::dump_start(const std::string& path, unsigned int interval)
+{
+    dump_stop();
+
+    if (interval == 0)
+        interval = 1;
+
+    s_dumppath = path;
+    s_dumper = new boost::thread(boost::bind(dumper, interval));
+}
+
+void florb::tilestats::dump_stop()
+{
+    if (!s_dumper)
+        return;
+
+    s_dumper->interrupt();
+    s_dumper->join();
+    delete s_dumper;
+    s_dumper = NULL;
+
+    // Final dump with the numbers up to now
+    dump(s_dumppath);
+}
+
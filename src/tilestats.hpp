@@ -0,0 +1,102 @@
+#ifndef TILESTATS_HPP
+#define TILESTATS_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <ostream>
+#include "histogram.hpp"
+
+namespace florb
+{
+    // Counters and per-stage latency histograms (microseconds) of the tile
+    // pipeline of a single tile layer. Instances live in a process-wide
+    // registry and are never destroyed, so pointers stay valid even after the
+    // layer is gone.
+    class tilestats
+    {
+        public:
+            enum counter
+            {
+                ENQUEUED,           // Tiles queued for downloading
+                DROPPED,            // Tiles not queued, download queue full
+                DL_OK,              // Successful downloads
+                DL_FAILED,          // Failed downloads (transport or HTTP)
+                DL_BYTES,           // Bytes downloaded
+                DL_NOTMODIFIED,     // Expired tiles the server reported unchanged
+                DL_THROTTLED,       // Downloads refused with 429 or 503
+                DL_RETRIES,         // Requests sent again after a failure
+                DL_BLOCKED,         // Downloads not sent, server considered down
+                MEM_HITS,           // Decoded tiles found in memory
+                HITS,               // Cache lookups with a valid tile
+                EXPIRED,            // Cache lookups with an expired tile
+                MISSES,             // Cache lookups without a tile
+                DECODE_ERRORS,      // Tiles which failed to decode
+                NCOUNTERS
+            };
+
+            // Current values rather than totals
+            enum gauge
+            {
+                DL_LIMIT,           // Requests allowed in flight to the server
+                DL_INFLIGHT,        // Requests in flight to the server
+                DL_RTT,             // Smoothed time to the first byte
+                DL_RTT_MIN,         // Lowest recent time to the first byte
+                DL_HOSTS_DOWN,      // Servers with an open circuit breaker
+                NGAUGES
+            };
+
+            enum stage
+            {
+                QUEUE_WAIT,         // Time in the download queue
+                TRANSFER,           // Network transfer
+                CACHE_GET,          // Cache lookup including the read
+                CACHE_PUT,          // Cache write
+                DECODE,             // Image decoding
+                BLIT,               // Drawing the decoded tile
+                NSTAGES
+            };
+
+            void count(counter c, uint64_t n = 1);
+            void record(stage s, uint64_t us);
+            void set(gauge g, uint64_t v);
+            void reset();
+
+            uint64_t value(counter c) const;
+            uint64_t value(gauge g) const;
+            const florb::histogram& latency(stage s) const;
+
+            static const char* name(counter c);
+            static const char* name(gauge g);
+            static const char* name(stage s);
+
+            // Statistics for the named layer, created on first use
+            static florb::tilestats& get(const std::string& layer);
+            static std::vector<std::string> layers();
+
+            // Write all statistics as JSON, dump(path) replaces the file
+            // atomically
+            static void dump(std::ostream& os);
+            static void dump(const std::string& path);
+
+            // Dump to path every interval seconds from a background thread
+            static void dump_start(const std::string& path, unsigned int interval);
+            static void dump_stop();
+
+            // Monotonic clock in microseconds
+            static uint64_t now();
+
+        private:
+            tilestats();
+            tilestats(const tilestats&);
+            tilestats& operator=(const tilestats&);
+
+            std::atomic<uint64_t> m_counters[NCOUNTERS];
+            std::atomic<uint64_t> m_gauges[NGAUGES];
+            florb::histogram m_latency[NSTAGES];
+    };
+};
+
+#endif // TILESTATS_HPP
+
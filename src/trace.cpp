@@ -0,0 +1,218 @@
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <chrono>
+#include <unistd.h>
+#include <boost/interprocess/sync/interprocess_mutex.hpp>
+#include "trace.hpp"
+
+std::atomic<bool> florb::trace::m_enabled(false);
+
+// Single producer ring buffer, only the owning thread writes. A reader
+// copies the events and afterwards drops those which might have been
+// overwritten in the meantime.
+class florb::trace::ring
+{
+    public:
+        static const uint64_t SIZE = 8192;
+
+        struct event
+        {
+            const char *name;
+            const char *cat;
+            uint64_t ts;
+            uint64_t dur;
+        };
+
+        ring(unsigned int tid) :
+            m_tid(tid),
+            m_head(0),
+            m_tail(0) {};
+
+        void push(const char *name, const char *cat, uint64_t start, uint64_t end)
+        {
+            uint64_t h = m_head.load(std::memory_order_relaxed);
+
+            event& e = m_events[h % SIZE];
+            e.name = name;
+            e.cat = cat;
+            e.ts = start;
+            e.dur = end - start;
+
+            m_head.store(h+1, std::memory_order_release);
+        }
+
+        void copy(std::vector<event>& out)
+        {
+            uint64_t h1 = m_head.load(std::memory_order_acquire);
+            uint64_t first = (h1 > SIZE) ? (h1 - SIZE) : 0;
+            uint64_t tail = m_tail.load(std::memory_order_relaxed);
+            first = (tail > first) ? tail : first;
+
+            std::vector<event> tmp;
+            for (uint64_t i=first;i<h1;i++)
+                tmp.push_back(m_events[i % SIZE]);
+
+            // The writer may have wrapped around while copying
+            uint64_t h2 = m_head.load(std::memory_order_acquire);
+            uint64_t valid = (h2 >= SIZE) ? (h2 - SIZE + 1) : 0;
+
+            for (uint64_t i=first;i<h1;i++)
+            {
+                if (i >= valid)
+                    out.push_back(tmp[i-first]);
+            }
+        }
+
+        void clear() { m_tail.store(m_head.load(std::memory_order_acquire), std::memory_order_relaxed); }
+
+        unsigned int tid() const { return m_tid; };
+        const std::string& name() const { return m_name; };
+        void name(const std::string& n) { m_name = n; };
+
+    private:
+        unsigned int m_tid;
+        std::string m_name;
+        std::atomic<uint64_t> m_head;
+        std::atomic<uint64_t> m_tail;
+        event m_events[SIZE];
+};
+
+const uint64_t florb::trace::ring::SIZE;
+
+namespace
+{
+    // Rings of all threads which ever recorded an event. Rings outlive their
+    // threads so events of finished download threads still make it into the
+    // dump.
+    boost::interprocess::interprocess_mutex s_mutex;
+    std::vector<florb::trace::ring*> s_rings;
+    thread_local florb::trace::ring *t_ring = NULL;
+    thread_local std::string t_name;
+
+    std::string escape(const std::string& s)
+    {
+        std::string ret;
+        for (size_t i=0;i<s.size();i++)
+        {
+            if ((s[i] == '"') || (s[i] == '\\'))
+                ret += '\\';
+            ret += s[i];
+        }
+
+        return ret;
+    }
+}
+
+void florb::trace::enable(bool en)
+{
+    m_enabled.store(en, std::memory_order_relaxed);
+}
+
+uint64_t florb::trace::now()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+florb::trace::ring* florb::trace::thread_ring()
+{
+    if (t_ring)
+        return t_ring;
+
+    s_mutex.lock();
+    t_ring = new florb::trace::ring(s_rings.size()+1);
+    t_ring->name(t_name);
+    s_rings.push_back(t_ring);
+    s_mutex.unlock();
+
+    return t_ring;
+}
+
+void florb::trace::thread_name(const std::string& name)
+{
+    // Picked up when the ring is created
+    if (!t_ring)
+    {
+        t_name = name;
+        return;
+    }
+
+    s_mutex.lock();
+    t_ring->name(name);
+    s_mutex.unlock();
+}
+
+void florb::trace::record(const char *name, const char *cat, uint64_t start, uint64_t end)
+{
+    thread_ring()->push(name, cat, start, end);
+}
+
+void florb::trace::clear()
+{
+    s_mutex.lock();
+    std::vector<florb::trace::ring*>::iterator it;
+    for (it=s_rings.begin();it!=s_rings.end();++it)
+        (*it)->clear();
+    s_mutex.unlock();
+}
+
+void florb::trace::dump(std::ostream& os)
+{
+    int pid = (int)getpid();
+    bool first = true;
+
+    os << "{\"traceEvents\": [";
+
+    s_mutex.lock();
+
+    std::vector<florb::trace::ring*>::iterator it;
+    for (it=s_rings.begin();it!=s_rings.end();++it)
+    {
+        std::string tname((*it)->name());
+        if (tname.empty())
+        {
+            std::ostringstream oss;
+            oss << "thread " << (*it)->tid();
+            tname = oss.str();
+        }
+
+        os << (first ? "\n" : ",\n") <<
+            "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << pid <<
+            ", \"tid\": " << (*it)->tid() <<
+            ", \"args\": {\"name\": \"" << escape(tname) << "\"}}";
+        first = false;
+
+        std::vector<florb::trace::ring::event> events;
+        (*it)->copy(events);
+
+        std::vector<florb::trace::ring::event>::iterator eit;
+        for (eit=events.begin();eit!=events.end();++eit)
+        {
+            os << ",\n{\"name\": \"" << (*eit).name << "\", \"cat\": \"" << (*eit).cat <<
+                "\", \"ph\": \"X\", \"ts\": " << (*eit).ts << ", \"dur\": " << (*eit).dur <<
+                ", \"pid\": " << pid << ", \"tid\": " << (*it)->tid() << "}";
+        }
+    }
+
+    s_mutex.unlock();
+
+    os << "\n], \"displayTimeUnit\": \"ms\"}\n";
+}
+
+void florb::trace::dump(const std::string& path)
+{
+    // Write to a temporary file first so readers never see a partial dump
+    std::string tmp(path + ".tmp");
+    std::ofstream fout(tmp.c_str(), std::ios::out | std::ios::trunc);
+    if (!fout)
+        return;
+
+    dump(fout);
+    fout.close();
+
+    if (!fout || (std::rename(tmp.c_str(), path.c_str()) != 0))
+        std::remove(tmp.c_str());
+}
+
@@ -0,0 +1,77 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <ostream>
+
+// Record the enclosing scope as a trace event. Name and category must be
+// string literals, only the pointers are stored.
+#define FLORB_TRACE_CAT2(a, b) a##b
+#define FLORB_TRACE_CAT(a, b) FLORB_TRACE_CAT2(a, b)
+#define FLORB_TRACE(name, cat) \
+    florb::trace::scope FLORB_TRACE_CAT(florb_trace_, __LINE__)(name, cat)
+
+namespace florb
+{
+    // Timeline of scoped events across all threads, written as Chrome trace
+    // JSON (chrome://tracing, Perfetto). Each thread records into a ring
+    // buffer of its own which is allocated when the thread records its first
+    // event, so a disabled trace costs one relaxed load per scope.
+    class trace
+    {
+        public:
+            static void enable(bool en);
+            static bool enabled() { return m_enabled.load(std::memory_order_relaxed); };
+
+            // Name the calling thread in the trace, does not allocate a ring
+            // buffer by itself
+            static void thread_name(const std::string& name);
+
+            // Drop all events recorded so far
+            static void clear();
+
+            // Write the events recorded so far, dump(path) replaces the file
+            // atomically
+            static void dump(std::ostream& os);
+            static void dump(const std::string& path);
+
+            // Monotonic clock in microseconds
+            static uint64_t now();
+
+            class scope
+            {
+                public:
+                    scope(const char *name, const char *cat) :
+                        m_name(name),
+                        m_cat(cat),
+                        m_start(enabled() ? now() : 0) {};
+                    ~scope()
+                    {
+                        if (m_start != 0)
+                            record(m_name, m_cat, m_start, now());
+                    };
+
+                private:
+                    scope(const scope&);
+                    scope& operator=(const scope&);
+
+                    const char *m_name;
+                    const char *m_cat;
+                    uint64_t m_start;
+            };
+
+            // Per-thread event buffer
+            class ring;
+
+        private:
+            static void record(const char *name, const char *cat, uint64_t start, uint64_t end);
+            static ring* thread_ring();
+
+            static std::atomic<bool> m_enabled;
+    };
+};
+
+#endif // TRACE_HPP
+
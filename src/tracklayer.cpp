@@ -1,14 +1,13 @@
 #include <cmath>
 #include <sstream>
 #include <algorithm>
-#include <FL/x.H>
-#include <FL/fl_draw.H>
 #include <clocale>
 #include "utils.hpp"
 #include "version.hpp"
 #include "settings.hpp"
 #include "point.hpp"
 #include "tracklayer.hpp"
+#include "trace.hpp"
 
 const std::string florb::tracklayer::trackname = "New GPX track";
 
@@ -283,6 +282,8 @@ void florb::tracklayer::add_trackpoint(const florb::point2d<double>& p)
 
 void florb::tracklayer::load_track(const std::string &path)
 {
+    FLORB_TRACE("tracklayer::load_track", "gpx");
+
     // Load the XML
     tinyxml2::XMLDocument doc;
     if (doc.LoadFile(path.c_str()) != tinyxml2::XML_SUCCESS)
@@ -324,6 +325,8 @@ void florb::tracklayer::load_track(const std::string &path)
 
 void florb::tracklayer::save_track(const std::string &path)
 {
+    FLORB_TRACE("tracklayer::save_track", "gpx");
+
     // TinyXML's number parsing is locale dependent, set to "C" and restore
     // later
     char *poldlc;
@@ -436,6 +439,26 @@ double florb::tracklayer::trip()
     return m_trip;
 }
 
+bool florb::tracklayer::extent(florb::point2d<double>& pmerc_min, florb::point2d<double>& pmerc_max)
+{
+    if (m_trkpts.size() == 0)
+        return false;
+
+    pmerc_min = florb::point2d<double>(m_trkpts[0].lon, m_trkpts[0].lat);
+    pmerc_max = pmerc_min;
+
+    std::vector<florb::tracklayer::gpx_trkpt>::iterator it;
+    for (it=m_trkpts.begin();it!=m_trkpts.end();++it) 
+    {
+        if ((*it).lon < pmerc_min.x()) pmerc_min[0] = (*it).lon;
+        if ((*it).lat < pmerc_min.y()) pmerc_min[1] = (*it).lat;
+        if ((*it).lon > pmerc_max.x()) pmerc_max[0] = (*it).lon;
+        if ((*it).lat > pmerc_max.y()) pmerc_max[1] = (*it).lat;
+    }
+
+    return true;
+}
+
 void florb::tracklayer::showwpmarkers(bool s)
 {
     // Set flag and request update
@@ -582,7 +605,7 @@ bool florb::tracklayer::handle_evt_key(const florb::layer::event_key* evt)
     return ret;
 }
 
-bool florb::tracklayer::draw(const viewport &vp, florb::canvas &os)
+bool florb::tracklayer::draw(const viewport &vp, florb::drawable &os)
 {
     if (m_trkpts.size() == 0)
         return true;
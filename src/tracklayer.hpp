@@ -25,7 +25,7 @@ namespace florb {
             bool handle_evt_mouse(const florb::layer::event_mouse* evt);
             bool handle_evt_key(const florb::layer::event_key* evt);
 
-            bool draw(const florb::viewport& vp, florb::canvas& os);
+            bool draw(const florb::viewport& vp, florb::drawable& os);
             void load_track(const std::string &path);
             void save_track(const std::string &path);
             void clear_track();
@@ -39,6 +39,9 @@ namespace florb {
             double trip();
             void showwpmarkers(bool s);
 
+            // Bounding box of all trackpoints in mercator coordinates
+            bool extent(florb::point2d<double>& pmerc_min, florb::point2d<double>& pmerc_max);
+
         private:
             static const unsigned int wp_hotspot = 6;
             static const std::string trackname;
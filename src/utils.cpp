@@ -7,11 +7,8 @@
 #include <cstdlib>
 #include <fstream>
 #include <cfenv>
-#include <X11/xpm.h>
 #include <iomanip>
-#include <FL/x.H>
 #include "utils.hpp"
-#include "florb.xpm"
 
 #define CLIPLEFT   (1)  // 0001
 #define CLIPRIGHT  (2)  // 0010
@@ -217,14 +214,6 @@ void florb::utils::touch(const std::string& path)
 	f.close();
 }
 
-void florb::utils::set_window_icon(Fl_Window *w)
-{
-    fl_open_display();
-    Pixmap p, mask;
-    XpmCreatePixmapFromData(fl_display, DefaultRootWindow(fl_display), const_cast<char**>(florb_xpm), &p, &mask, NULL);
-    w->icon((char *)p);
-}
-
 std::vector<std::string> florb::utils::str_split(const std::string& str, const std::string& delimiter)
 {
     std::size_t offs = 0, p1 = 0, p2 = std::string::npos;
@@ -273,6 +262,37 @@ void florb::utils::str_replace(std::string& str, const std::string& s, const std
     }
 }
 
+uint64_t florb::utils::hash(const void *data, std::size_t len)
+{
+    const unsigned char *p = reinterpret_cast<const unsigned char*>(data);
+
+    uint64_t ret = 14695981039346656037ULL;
+    for (std::size_t i=0;i<len;i++)
+    {
+        ret ^= p[i];
+        ret *= 1099511628211ULL;
+    }
+
+    return ret;
+}
+
+std::string florb::utils::urlhost(const std::string& url)
+{
+    std::size_t start = url.find("://");
+    start = (start == std::string::npos) ? 0 : start + 3;
+
+    std::size_t end = url.find_first_of("/?#", start);
+    if (end == std::string::npos)
+        end = url.size();
+
+    // Strip user credentials
+    std::size_t at = url.rfind('@', end);
+    if ((at != std::string::npos) && (at >= start))
+        start = at + 1;
+
+    return url.substr(start, end - start);
+}
+
 // Cohen–Sutherland clipping algorithm
 bool florb::utils::clipline(
         florb::point2d<double> &p1, 
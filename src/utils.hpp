@@ -2,10 +2,10 @@
 #define UTILS_HPP
 
 #include <ctime>
+#include <cstdint>
 #include <vector>
 #include <sstream>
 #include <libintl.h>
-#include <FL/Fl_Window.H>
 #include <boost/lexical_cast.hpp>
 #include "point.hpp"
 
@@ -38,6 +38,12 @@ namespace florb
             static std::size_t str_count(const std::string& str, const std::string& token);
             static void str_replace(std::string& str, const std::string& s, const std::string& r);
 
+            // 64-bit FNV-1a hash
+            static uint64_t hash(const void *data, std::size_t len);
+
+            // Host and port part of an URL
+            static std::string urlhost(const std::string& url);
+
             template <class T>
                 static bool fromstr(const std::string& s, T& out)
                 {
@@ -59,8 +65,6 @@ namespace florb
             static std::string filestem(const std::string& path);
             static std::string extension(const std::string& path);
             static void touch(const std::string& path);
-
-            static void set_window_icon(Fl_Window *w);
         private:
     };
 
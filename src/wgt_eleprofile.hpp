@@ -5,7 +5,7 @@
 #include <FL/Fl_Widget.H>
 #include <FL/fl_draw.H>
 #include "event.hpp"
-#include "gfx.hpp"
+#include "flgfx.hpp"
 
 class wgt_eleprofile : public Fl_Widget, public event_generator
 {
@@ -2,9 +2,11 @@
 #include <iostream>
 #include <FL/fl_draw.H>
 #include <FL/x.H>
+#include <FL/fl_ask.H>
 #include "settings.hpp"
 #include "wgt_map.hpp"
 #include "utils.hpp"
+#include "trace.hpp"
 
 florb::wgt_map::wgt_map(int x, int y, int w, int h, const char *label) : 
     Fl_Widget(x, y, w, h, label),
@@ -15,15 +17,38 @@ florb::wgt_map::wgt_map(int x, int y, int w, int h, const char *label) :
     m_markerlayer(NULL),
     m_gpsdlayer(NULL),
     m_areaselectlayer(NULL),
+    m_tiledebuglayer(NULL),
+    m_tiledebug(false),
+    m_hudlayer(NULL),
+    m_hud(false),
+    m_scheduler(florb::settings::get_instance()["ui"].as<florb::cfg_ui>().maxfps()),
     m_mousepos(0, 0),
     m_viewport(w, h),
     m_viewport_off(0, 0),
     m_offscreen(w, h),
+    m_overscan(florb::settings::get_instance()["ui"].as<florb::cfg_ui>().overscan()),
+    m_overscanned(false),
+    m_zoomtime(florb::settings::get_instance()["ui"].as<florb::cfg_ui>().zoomtime()),
+    m_zooming(false),
+    m_zoomframe(NULL),
+    m_zoomdz(0),
+    m_zoomx(0),
+    m_zoomy(0),
+    m_zoomstart(0.0),
+    m_zoomfilter(florb::image::SMOOTH),
     m_lockcursor(false),
     m_recordtrack(false),
     m_dragging(false),
-    m_dirty(false)
+    m_dirty(false),
+    m_cursorinterval(0.0),
+    m_cursortimer(false),
+    m_cursordrawn(false),
+    m_cursorpx(0, 0),
+    m_cursortrack(0)
 {
+    if (m_overscan > OVERSCANMAX)
+        m_overscan = OVERSCANMAX;
+
     // Register event handlers for layer events
     register_event_handler<florb::wgt_map, florb::gpsdlayer::event_status>(this, &florb::wgt_map::gpsd_evt_status);
     register_event_handler<florb::wgt_map, florb::gpsdlayer::event_motion>(this, &florb::wgt_map::gpsd_evt_motion);
@@ -75,14 +100,45 @@ florb::wgt_map::wgt_map(int x, int y, int w, int h, const char *label) :
     m_areaselectlayer->add_event_listener(this);
     add_event_listener(m_areaselectlayer);
 
+    // Add a tile debugging layer, off until toggled
+    try {
+        m_tiledebuglayer = new florb::tiledebuglayer();
+    } catch (...) {
+        m_tiledebuglayer = NULL;
+        throw std::runtime_error(_("Tile debug error"));
+    }
+
+    m_tiledebuglayer->enable(false);
+
+    // Add the frame time HUD, off until toggled
+    try {
+        m_hudlayer = new florb::hudlayer();
+    } catch (...) {
+        m_hudlayer = NULL;
+        throw std::runtime_error(_("HUD error"));
+    }
+
+    m_hudlayer->enable(false);
+
     // Add a gpsdlayer
     m_gpsdlayer = new florb::gpsdlayer();
     m_gpsdlayer->add_event_listener(this);
+    gpsd_cursorfps(florb::settings::get_instance()["ui"].as<florb::cfg_ui>().gpscursorfps());
 
-    // Connect to gpsd if configured
+    // Connect to gpsd if configured. A replay log which is missing or
+    // without fixes leaves GPS disconnected.
     florb::cfg_gpsd cfggpsd = florb::settings::get_instance()["gpsd"].as<florb::cfg_gpsd>();
     if (cfggpsd.enabled())
-        gpsd_connect(cfggpsd.host(), cfggpsd.port());
+    {
+        try {
+            if (cfggpsd.replay().empty())
+                gpsd_connect(cfggpsd.host(), cfggpsd.port());
+            else
+                gpsd_replay(cfggpsd.replay(), cfggpsd.replayspeed(), cfggpsd.replayport());
+        } catch (std::runtime_error& e) {
+            fl_alert("%s", e.what());
+        }
+    }
 
     // Restore previous viewport
     florb::cfg_viewport cfgvp = florb::settings::get_instance()["viewport"].as<florb::cfg_viewport>();
@@ -95,6 +151,15 @@ florb::wgt_map::wgt_map(int x, int y, int w, int h, const char *label) :
 
 florb::wgt_map::~wgt_map()
 {
+    // No more cursor updates and frames
+    Fl::remove_timeout(cb_cursor, this);
+    Fl::remove_timeout(cb_frame, this);
+    Fl::remove_idle(cb_overscan, this);
+    zoom_stop();
+
+    // Write a trace still being recorded
+    trace(false);
+
     // Save viewport configuration
     florb::cfg_viewport cfgvp = florb::settings::get_instance()["viewport"].as<florb::cfg_viewport>();
     cfgvp.z(m_viewport.z());
@@ -127,6 +192,12 @@ florb::wgt_map::~wgt_map()
 
     if (m_areaselectlayer)
         delete m_areaselectlayer;
+
+    if (m_tiledebuglayer)
+        delete m_tiledebuglayer;
+
+    if (m_hudlayer)
+        delete m_hudlayer;
 }
 
 void florb::wgt_map::goto_pos(const florb::point2d<double> &pwsg84)
@@ -264,7 +335,7 @@ std::string florb::wgt_map::gpx_trackname()
 
 bool florb::wgt_map::gpsd_connected()
 {
-    return m_gpsdlayer->connected();
+    return m_gpsdlayer->snapshot().connected;
 }
 
 void florb::wgt_map::gpsd_connect(const std::string& host, const std::string& port)
@@ -278,6 +349,17 @@ void florb::wgt_map::gpsd_connect(const std::string& host, const std::string& po
     }
 }
 
+void florb::wgt_map::gpsd_replay(const std::string& path, double speed, const std::string& port)
+{
+    gpsd_disconnect();
+
+    try {
+        m_gpsdlayer->replay(path, speed, port);
+    } catch (std::runtime_error& e) {
+        throw e;
+    }
+}
+
 void florb::wgt_map::gpsd_disconnect()
 {
     // Disconnect
@@ -301,18 +383,19 @@ void florb::wgt_map::gpsd_lock(bool start)
         goto_cursor();
 }
 
+void florb::wgt_map::gpsd_cursorfps(unsigned int fps)
+{
+    // Without a frame rate the cursor only moves when a new fix arrives
+    m_cursorinterval = (fps > 0) ? (1.0 / (double)fps) : 0.0;
+    m_gpsdlayer->interpolate(fps > 0);
+}
+
 int florb::wgt_map::gpsd_mode()
 {
-    return m_gpsdlayer->mode();
+    return m_gpsdlayer->snapshot().mode;
 }
 
-void florb::wgt_map::basemap(
-                const std::string& name, 
-                const std::string& url, 
-                unsigned int zmin, 
-                unsigned int zmax, 
-                unsigned int parallel,
-                int imgtype)
+void florb::wgt_map::basemap(const florb::cfg_tileserver& ts)
 {
     // Destroy the orig
     if (m_basemap)
@@ -324,38 +407,39 @@ void florb::wgt_map::basemap(
 
     // Create a new basemap layer
     try {
-        m_basemap = new florb::osmlayer(name, url, zmin, zmax, parallel, imgtype);
+        m_basemap = new florb::osmlayer(ts.name(), ts.url(), ts.zmin(), ts.zmax(), ts.parallel(), ts.type());
     } catch (std::runtime_error& e) {
         m_basemap = NULL;
         throw e;
     }
 
+    m_basemap->mirrors(ts.mirrors(), ts.subdomains());
+    m_basemap->ratelimit(ts.rate(), ts.burst());
+    m_basemap->concurrency(ts.parallel(), ts.parallelmax());
     m_basemap->add_event_listener(this);
     add_event_listener(m_basemap);
+    m_tiledebuglayer->source(m_basemap);
 
     // Invalidate map buffer
     m_viewport_off.w(0);
     refresh();
 }
 
-void florb::wgt_map::overlay(
-                const std::string& name, 
-                const std::string& url, 
-                unsigned int zmin, 
-                unsigned int zmax, 
-                unsigned int parallel,
-                int imgtype)
+void florb::wgt_map::overlay(const florb::cfg_tileserver& ts)
 {
     clear_overlay();
 
     // Create a new overlay layer
     try {
-        m_overlay = new florb::osmlayer(name, url, zmin, zmax, parallel, imgtype);
+        m_overlay = new florb::osmlayer(ts.name(), ts.url(), ts.zmin(), ts.zmax(), ts.parallel(), ts.type());
     } catch (std::runtime_error& e) {
         m_overlay = NULL;
         throw e;
     }
 
+    m_overlay->mirrors(ts.mirrors(), ts.subdomains());
+    m_overlay->ratelimit(ts.rate(), ts.burst());
+    m_overlay->concurrency(ts.parallel(), ts.parallelmax());
     m_overlay->add_event_listener(this);
     add_event_listener(m_overlay);
 
@@ -386,6 +470,8 @@ unsigned int florb::wgt_map::zoom()
 
 void florb::wgt_map::zoom(unsigned int z)
 {
+    zoom_stop();
+
     // Set tne new zoomlevel
     m_viewport.z(z, m_viewport.w()/2, m_viewport.h()/2);
    
@@ -395,15 +481,17 @@ void florb::wgt_map::zoom(unsigned int z)
 
 void florb::wgt_map::goto_cursor()
 {
+    florb::gpsdlayer::state s(m_gpsdlayer->snapshot());
+
     // GPSd not connected
-    if (!gpsd_connected())
+    if (!s.connected)
         return;
 
     // No valid fix
-    if (!m_gpsdlayer->valid())
+    if (!s.valid)
         return;
 
-    goto_pos(m_gpsdlayer->pos());
+    goto_pos(s.pos());
 }
 
 florb::point2d<double> florb::wgt_map::mousepos()
@@ -439,11 +527,81 @@ florb::point2d<double> florb::wgt_map::mousepos()
             florb::utils::px2wsg84(m_viewport.z(), florb::point2d<unsigned long>(m_viewport.x()+px, m_viewport.y()+py)));
 }
 
-void florb::wgt_map::refresh()
+void florb::wgt_map::refresh(unsigned int what)
 {
+    // Collect the invalidation, the first one since the last frame schedules
+    // the next frame. Everything else arriving until then is merged into it.
+    if (m_scheduler.invalidate(what))
+        Fl::add_timeout(m_scheduler.wait(florb::gpsdlayer::now()), cb_frame, this);
+}
+
+void florb::wgt_map::cb_frame(void* userdata)
+{
+    florb::wgt_map *wgt = static_cast<florb::wgt_map*>(userdata);
+
+    // Anything but a viewport change needs a new map image
+    unsigned int what = wgt->m_scheduler.frame(florb::gpsdlayer::now());
+    if (what & florb::framescheduler::LAYERS)
+        wgt->dirty(true);
+
     // Quote from the doc: The public method Fl_Widget::redraw() simply does
     // Fl_Widget::damage(FL_DAMAGE_ALL)
-    redraw();
+    wgt->redraw();
+}
+
+void florb::wgt_map::maxfps(unsigned int fps)
+{
+    m_scheduler.maxfps(fps);
+}
+
+bool florb::wgt_map::cursor_px(double when, florb::point2d<long>& px, int& track)
+{
+    florb::point2d<double> pos;
+    double t;
+    if (!m_gpsdlayer->predict(when, pos, t))
+        return false;
+
+    florb::point2d<unsigned long> pxabs(florb::utils::wsg842px(m_viewport.z(), pos));
+    px = florb::point2d<long>((long)pxabs.x() - (long)m_viewport.x(), (long)pxabs.y() - (long)m_viewport.y());
+    track = (int)t;
+
+    return true;
+}
+
+void florb::wgt_map::cursor_damage()
+{
+    // Redraw the cursor right away and keep animating it in between fixes
+    damage(FL_DAMAGE_USER1);
+
+    if ((m_cursorinterval > 0.0) && (!m_cursortimer))
+    {
+        Fl::add_timeout(m_cursorinterval, cb_cursor, this);
+        m_cursortimer = true;
+    }
+}
+
+void florb::wgt_map::cb_cursor(void* userdata)
+{
+    florb::wgt_map *wgt = static_cast<florb::wgt_map*>(userdata);
+    wgt->m_cursortimer = false;
+
+    // Only redraw if the cursor actually moved or turned on screen
+    florb::point2d<long> px;
+    int track = 0;
+    bool visible = wgt->cursor_px(florb::gpsdlayer::now(), px, track);
+
+    if ((visible != wgt->m_cursordrawn) || 
+        (visible && ((!(px == wgt->m_cursorpx)) || (track != wgt->m_cursortrack))))
+        wgt->damage(FL_DAMAGE_USER1);
+
+    // Keep going for as long as the motion model predicts movement
+    florb::gpsdlayer::state s(wgt->m_gpsdlayer->snapshot());
+    if ((!s.valid) || (s.t <= 0.0) || 
+        ((florb::gpsdlayer::now() - s.t) > florb::gpsdlayer::HORIZON))
+        return;
+
+    Fl::repeat_timeout(wgt->m_cursorinterval, cb_cursor, userdata);
+    wgt->m_cursortimer = true;
 }
 
 void florb::wgt_map::dragging(bool d)
@@ -499,17 +657,17 @@ bool florb::wgt_map::vp_inside(const florb::point2d<int>& pos)
 
 bool florb::wgt_map::gpsd_evt_motion(const florb::gpsdlayer::event_motion *e)
 {
-    dirty(true);
-
-    // Track recording on, add current position
+    // Track recording on, add current position. This changes the track and
+    // thus leads to a full redraw.
     if (m_recordtrack)
         m_tracklayer->add_trackpoint(e->pos());
     
     // Center the viewport over the current position
     if (m_lockcursor)
         goto_cursor();
-    else 
-        refresh();
+
+    // The cursor is not part of the map image, so just redraw the cursor
+    cursor_damage();
 
     // Notify any listeners about the change
     event_notify en;
@@ -520,8 +678,7 @@ bool florb::wgt_map::gpsd_evt_motion(const florb::gpsdlayer::event_motion *e)
 
 bool florb::wgt_map::gpsd_evt_status(const florb::gpsdlayer::event_status *e)
 {
-    dirty(true);
-    refresh();
+    cursor_damage();
     event_notify en;
     fire(&en);
     return true;
@@ -529,15 +686,13 @@ bool florb::wgt_map::gpsd_evt_status(const florb::gpsdlayer::event_status *e)
 
 bool florb::wgt_map::osm_evt_notify(const florb::osmlayer::event_notify *e)
 {
-    dirty(true);
-    refresh();
+    refresh(florb::framescheduler::TILES);
     return true;
 }
 
 bool florb::wgt_map::gpx_evt_notify(const florb::tracklayer::event_notify *e)
 {
-    dirty(true);
-    refresh();
+    refresh(florb::framescheduler::TRACKS);
 
     // Make sure the trip display is updated
     event_notify en;
@@ -548,8 +703,7 @@ bool florb::wgt_map::gpx_evt_notify(const florb::tracklayer::event_notify *e)
 
 bool florb::wgt_map::marker_evt_notify(const markerlayer::event_notify *e)
 {
-    dirty(true);
-    refresh();
+    refresh(florb::framescheduler::MARKERS);
     return true;
 }
 
@@ -570,8 +724,7 @@ bool florb::wgt_map::areaselect_evt_done(const florb::areaselectlayer::event_don
 
 bool florb::wgt_map::areaselect_evt_notify(const florb::areaselectlayer::event_notify *e)
 {
-    dirty(true);
-    refresh();
+    refresh(florb::framescheduler::SELECTION);
     return true;
 }
 
@@ -665,6 +818,8 @@ int florb::wgt_map::handle_drag(int event)
     // Move the viewport
     if (Fl::event_state(FL_BUTTON3) != 0)
     {
+        zoom_stop();
+
         // Calculate the delta with the last mouse position and save the
         // current mouse position
         int dx = m_mousepos.x() - (Fl::event_x()-x());
@@ -730,8 +885,20 @@ int florb::wgt_map::handle_mousewheel(int event)
     if ((Fl::event_y() - y()) > dpy)
         py = Fl::event_y() - y() - dpy;
 
+    // Zooming in scales up the current frame, so keep a copy of it
+    zoom_stop();
+    unsigned int z = m_viewport.z();
+    florb::image *frame = ((m_zoomtime > 0) && (Fl::event_dy() < 0)) ? snapshot() : NULL;
+
     // Zoom the viewport with (px,py) as origin
     m_viewport.z(m_viewport.z()-Fl::event_dy(), px, py);
+
+    // Animate the transition
+    int dz = (int)m_viewport.z() - (int)z;
+    if ((m_zoomtime > 0) && (dz != 0) && ((dz < 0) || (frame != NULL)))
+        zoom_start(frame, dz, px, py);
+    else
+        delete frame;
     
     // Refresh and notify
     refresh();
@@ -741,11 +908,69 @@ int florb::wgt_map::handle_mousewheel(int event)
     return 1;
 }
 
+bool florb::wgt_map::tiledebug()
+{
+    return m_tiledebug;
+}
+
+void florb::wgt_map::tiledebug(bool en)
+{
+    m_tiledebug = en;
+    m_tiledebuglayer->enable(en);
+
+    refresh(florb::framescheduler::DEBUG);
+}
+
+bool florb::wgt_map::hud()
+{
+    return m_hud;
+}
+
+void florb::wgt_map::hud(bool en)
+{
+    m_hud = en;
+    m_hudlayer->enable(en);
+
+    refresh(florb::framescheduler::DEBUG);
+}
+
+void florb::wgt_map::trace(bool en)
+{
+    if (en == florb::trace::enabled())
+        return;
+
+    if (en)
+    {
+        florb::trace::clear();
+        florb::trace::enable(true);
+    }
+    else
+    {
+        florb::trace::enable(false);
+        florb::trace::dump(florb::settings::get_instance()["stats"].as<florb::cfg_stats>().trace());
+    }
+}
+
 int florb::wgt_map::handle_keyboard(int event)
 {
     int ret = 0;
 
-    if (std::string(Fl::event_text()) == "-")
+    if (Fl::event_key(FL_F+12))
+    {
+        tiledebug(!tiledebug());
+        ret = 1;
+    }
+    else if (Fl::event_key(FL_F+10))
+    {
+        hud(!hud());
+        ret = 1;
+    }
+    else if (Fl::event_key(FL_F+11))
+    {
+        trace(!florb::trace::enabled());
+        ret = 1;
+    }
+    else if (std::string(Fl::event_text()) == "-")
     {
         if (m_viewport.z() != 0)
         {
@@ -872,23 +1097,92 @@ int florb::wgt_map::handle(int event)
 
 void florb::wgt_map::draw() 
 {
-    // Make sure redraw() has been called previously
+    FLORB_TRACE("wgt_map::draw", "draw");
+
+    // Only the GPS cursor needs an update. Restore the area it covered from
+    // the offscreen buffer and draw it at the new position, the map layers
+    // are left alone.
     if ((damage() & FL_DAMAGE_ALL) == 0) 
+    {
+        if ((damage() & FL_DAMAGE_USER1) == 0)
+            return;
+
+        // The cursor has no place in a zoom transition
+        if (m_zooming)
+            return;
+
+        int dpx_wgt = 0, dpy_wgt = 0;
+        if (w() > (int)m_viewport.w())
+            dpx_wgt = (w() - (int)m_viewport.w())/2;
+        if (h() > (int)m_viewport.h())
+            dpy_wgt = (h() - (int)m_viewport.h())/2;
+
+        double t = florb::gpsdlayer::now();
+        florb::point2d<long> px;
+        int track;
+        bool visible = cursor_px(t, px, track);
+
+        // Bounding box of the previous and the current cursor
+        long x1 = 0, y1 = 0, x2 = -1, y2 = -1;
+        if (m_cursordrawn)
+        {
+            x1 = m_cursorpx.x(); x2 = m_cursorpx.x();
+            y1 = m_cursorpx.y(); y2 = m_cursorpx.y();
+        }
+        if (visible)
+        {
+            if (!m_cursordrawn)
+            {
+                x1 = px.x(); x2 = px.x();
+                y1 = px.y(); y2 = px.y();
+            }
+
+            x1 = (px.x() < x1) ? px.x() : x1;
+            x2 = (px.x() > x2) ? px.x() : x2;
+            y1 = (px.y() < y1) ? px.y() : y1;
+            y2 = (px.y() > y2) ? px.y() : y2;
+        }
+        if ((x2 < x1) || (y2 < y1))
+            return;
+
+        fl_push_clip(
+                x()+dpx_wgt+(int)x1-CURSORRADIUS, 
+                y()+dpy_wgt+(int)y1-CURSORRADIUS, 
+                (int)(x2-x1)+(2*CURSORRADIUS)+1, 
+                (int)(y2-y1)+(2*CURSORRADIUS)+1);
+        blit();
+        draw_fixed(0);
+        draw_cursor(t);
+        fl_pop_clip();
+
         return;
+    }
+
+    uint64_t tframe = m_hud ? florb::trace::now() : 0;
 
     // Resize the viewport to the current widget size before drawing
     m_viewport.w((unsigned long)w());
     m_viewport.h((unsigned long)h());
 
-    // Current offscreen viewport != viewport, regenerate
-    if (m_viewport_off != m_viewport)
+    // Viewport moved beyond what the offscreen buffer holds, regenerate.
+    // Anything within the overscan margin is a plain blit.
+    if (!covers(m_viewport_off, m_viewport))
         dirty(true);
 
-    // Map is dirty, force redraw
-    if (dirty() && !dragging())
+    // Map is being dragged, draw a preview from what is in memory. The map
+    // stays dirty so the full frame follows once the mouse is released.
+    if (dirty() && dragging())
+    {
+        if (!covers(m_viewport_off, m_viewport))
+            draw_preview();
+    }
+    // Map is dirty, force redraw of the visible part. The overscan margin
+    // follows in idle time once this is complete.
+    else if (dirty())
     {
         m_viewport_off = m_viewport; 
         m_offscreen.resize(m_viewport_off.w(), m_viewport_off.h());
+        m_overscanned = false;
 
         m_offscreen.fgcolor(florb::color(0xc06e6e));
         m_offscreen.fillrect(0,0, m_offscreen.w(), m_offscreen.h());
@@ -898,52 +1192,354 @@ void florb::wgt_map::draw()
         // Draw the basemap
         if (m_basemap)
         {
-            if (!m_basemap->draw(m_viewport_off, m_offscreen))
+            if (!draw_layer(m_basemap, "basemap"))
                 dirty(true);
         }
 
         // Draw the overlay
         if (m_overlay)
         {
-            if (!m_overlay->draw(m_viewport_off, m_offscreen))
+            if (!draw_layer(m_overlay, "overlay"))
                 dirty(true);
         }
 
-        // Draw the scale
-        if (!m_scale->draw(m_viewport_off, m_offscreen))
+        // Draw the tile states of the basemap
+        if (!draw_layer(m_tiledebuglayer, "tiledebug"))
             dirty(true);
 
         // Draw the gpx layer
-        if (!m_tracklayer->draw(m_viewport_off, m_offscreen))
+        if (!draw_layer(m_tracklayer, "tracks"))
             dirty(true);
 
         // Draw the marker layer
-        if (!m_markerlayer->draw(m_viewport_off, m_offscreen))
-            dirty(true);
-
-        // Draw the gpsd layer
-        if (!m_gpsdlayer->draw(m_viewport_off, m_offscreen))
+        if (!draw_layer(m_markerlayer, "markers"))
             dirty(true);
 
         // Draw the areaselect layer
-        if (!m_areaselectlayer->draw(m_viewport_off, m_offscreen))
+        if (!draw_layer(m_areaselectlayer, "areaselect"))
             dirty(true);
+
+        if (!dirty() && (m_overscan > 0) && !Fl::has_idle(cb_overscan, this))
+            Fl::add_idle(cb_overscan, this);
     }
 
-    // Calculate delta viewport / viewport_off
-    int dpx_src = 0, dpy_src = 0, dpx_dst = 0, dpy_dst = 0, dpx_wgt = 0, dpy_wgt = 0;
-    
-    if (m_viewport_off.x() > m_viewport.x())
-        dpx_dst = m_viewport_off.x() - m_viewport.x();
-    else
-        dpx_src = m_viewport.x() - m_viewport_off.x();
+    // Zoom transitions scale a frame onto the screen instead
+    if (!m_zooming || !draw_zoom())
+        blit();
+
+    // Scale and HUD stay in place on the screen, the GPS cursor goes on top
+    // of everything else
+    draw_fixed(tframe);
+    if (!m_zooming)
+        draw_cursor(florb::gpsdlayer::now());
+}
 
-    if (m_viewport_off.y() > m_viewport.y())
-        dpy_dst = m_viewport_off.y() - m_viewport.y();
+bool florb::wgt_map::draw_zoom()
+{
+    FLORB_TRACE("wgt_map::draw_zoom", "draw");
+
+    double t = (florb::gpsdlayer::now() - m_zoomstart) / (m_zoomtime / 1000.0);
+    if (t >= 1.0)
+    {
+        zoom_stop();
+        return false;
+    }
+
+    // Ease in and out. The scale changes geometrically so the speed looks
+    // the same throughout.
+    double e = t * t * (3.0 - (2.0 * t));
+    double f = (m_zoomdz > 0) ? 
+        std::pow(2.0, m_zoomdz * e) : 
+        std::pow(2.0, -m_zoomdz * (1.0 - e));
+
+    // Zooming in scales up the last frame of the previous level, zooming
+    // out scales down the frame of the new level as its tiles come in
+    florb::image *current = NULL;
+    florb::image *frame = m_zoomframe;
+    if (m_zoomdz < 0)
+        frame = current = snapshot();
+
+    if (frame == NULL)
+    {
+        zoom_stop();
+        return false;
+    }
+
+    // Region of the frame which fills the screen, (m_zoomx, m_zoomy) stays
+    // in place
+    int sw = (int)(frame->w() / f);
+    int sh = (int)(frame->h() / f);
+    sw = (sw < 1) ? 1 : sw;
+    sh = (sh < 1) ? 1 : sh;
+
+    int sx = m_zoomx - (int)(m_zoomx / f);
+    int sy = m_zoomy - (int)(m_zoomy / f);
+    sx = (sx < 0) ? 0 : ((sx + sw > frame->w()) ? frame->w() - sw : sx);
+    sy = (sy < 0) ? 0 : ((sy + sh > frame->h()) ? frame->h() - sh : sy);
+
+    // Drop to nearest neighbour for the rest of the transition once smooth
+    // scaling takes too long for the frame rate
+    uint64_t tscale = florb::trace::now();
+    florb::image scaled(*frame, sx, sy, sw, sh, frame->w(), frame->h(), m_zoomfilter);
+    if ((florb::trace::now() - tscale) > ZOOMBUDGET)
+        m_zoomfilter = florb::image::NEAREST;
+
+    delete current;
+
+    int dpx_wgt = 0, dpy_wgt = 0;
+    if (w() > (int)m_viewport.w())
+        dpx_wgt = (w() - (int)m_viewport.w())/2;
+    if (h() > (int)m_viewport.h())
+        dpy_wgt = (h() - (int)m_viewport.h())/2;
+
+    fl_rectf(x(), y(), w(), h(), 80, 80, 80);
+
+    florb::screen scr(x()+dpx_wgt, y()+dpy_wgt, m_viewport.w(), m_viewport.h());
+    fl_push_clip(x(), y(), w(), h());
+    scr.draw(scaled, 0, 0);
+    fl_pop_clip();
+
+    // Next step of the transition
+    refresh();
+
+    return true;
+}
+
+florb::image* florb::wgt_map::snapshot()
+{
+    if (!covers(m_viewport_off, m_viewport))
+        return NULL;
+
+    int w = (int)m_viewport.w();
+    int h = (int)m_viewport.h();
+    std::vector<unsigned char> px(w*h*3);
+
+    fl_begin_offscreen(m_offscreen.buf());
+    fl_read_image(&px[0], 
+            (int)(m_viewport.x() - m_viewport_off.x()), 
+            (int)(m_viewport.y() - m_viewport_off.y()), 
+            w, h);
+    fl_end_offscreen();
+
+    return new florb::image(w, h, 3, &px[0]);
+}
+
+void florb::wgt_map::zoom_start(florb::image *frame, int dz, int px, int py)
+{
+    m_zooming = true;
+    m_zoomframe = frame;
+    m_zoomdz = dz;
+    m_zoomx = px;
+    m_zoomy = py;
+    m_zoomstart = florb::gpsdlayer::now();
+    m_zoomfilter = florb::image::SMOOTH;
+}
+
+void florb::wgt_map::zoom_stop()
+{
+    m_zooming = false;
+
+    if (m_zoomframe)
+    {
+        delete m_zoomframe;
+        m_zoomframe = NULL;
+    }
+}
+
+void florb::wgt_map::zoomtime(unsigned int ms)
+{
+    zoom_stop();
+    m_zoomtime = ms;
+}
+
+void florb::wgt_map::draw_preview()
+{
+    FLORB_TRACE("wgt_map::draw_preview", "draw");
+
+    // Preview the overscan margin too, short drags within it are blits then
+    m_viewport_off = overscan_viewport(); 
+    m_offscreen.resize(m_viewport_off.w(), m_viewport_off.h());
+    m_overscanned = false;
+
+    m_offscreen.fgcolor(florb::color(0xc06e6e));
+    m_offscreen.fillrect(0,0, m_offscreen.w(), m_offscreen.h());
+
+    // Map layers from decoded tiles only, no disk or network access
+    if (m_basemap)
+        m_basemap->preview(m_viewport_off, m_offscreen, PREVIEWBUDGET);
+    if (m_overlay)
+        m_overlay->preview(m_viewport_off, m_offscreen, PREVIEWBUDGET);
+
+    // Everything else is cheap enough to be drawn as usual
+    draw_layer(m_tracklayer, "tracks");
+    draw_layer(m_markerlayer, "markers");
+    draw_layer(m_areaselectlayer, "areaselect");
+}
+
+void florb::wgt_map::draw_fixed(uint64_t tframe)
+{
+    int dpx_wgt = 0, dpy_wgt = 0;
+    if (w() > (int)m_viewport.w())
+        dpx_wgt = (w() - (int)m_viewport.w())/2;
+    if (h() > (int)m_viewport.h())
+        dpy_wgt = (h() - (int)m_viewport.h())/2;
+
+    florb::screen scr(x()+dpx_wgt, y()+dpy_wgt, m_viewport.w(), m_viewport.h());
+
+    fl_push_clip(x(), y(), w(), h());
+
+    // Draw the scale
+    if (tframe != 0)
+    {
+        uint64_t t = florb::trace::now();
+        m_scale->draw(m_viewport, scr);
+        m_hudlayer->sample("scale", (florb::trace::now() - t) / 1000.0);
+    }
     else
-        dpy_src = m_viewport.y() - m_viewport_off.y();
+    {
+        m_scale->draw(m_viewport, scr);
+    }
+
+    // Draw the frame time HUD on top, including this frame but not the HUD
+    // itself. Partial redraws for the GPS cursor do not count as a frame.
+    if (m_hud)
+    {
+        unsigned long queued = 0, active = 0;
+        std::size_t tiles = 0, bytes = 0;
+        if (m_basemap)
+        {
+            queued += m_basemap->downloads_queued();
+            active += m_basemap->downloads_active();
+            tiles += m_basemap->decoded_tiles();
+            bytes += m_basemap->decoded_bytes();
+        }
+        if (m_overlay)
+        {
+            queued += m_overlay->downloads_queued();
+            active += m_overlay->downloads_active();
+            tiles += m_overlay->decoded_tiles();
+            bytes += m_overlay->decoded_bytes();
+        }
+
+        if (tframe != 0)
+            m_hudlayer->frame((florb::trace::now() - tframe) / 1000.0);
+        m_hudlayer->downloads(queued, active);
+        m_hudlayer->decoded(tiles, bytes);
+        m_hudlayer->offscreen(offscreen_bytes());
+
+        std::size_t fixes = 0;
+        double rate = 0.0;
+        bool replay = m_gpsdlayer->replaystats(fixes, rate);
+        m_hudlayer->gpsreplay(replay, fixes, rate);
+        m_hudlayer->draw(m_viewport, scr);
+    }
+
+    fl_pop_clip();
+}
+
+bool florb::wgt_map::draw_layer(florb::layer *l, const char *name)
+{
+    FLORB_TRACE(name, "draw");
+
+    if (!m_hud)
+        return l->draw(m_viewport_off, m_offscreen);
+
+    uint64_t t = florb::trace::now();
+    bool ret = l->draw(m_viewport_off, m_offscreen);
+    m_hudlayer->sample(name, (florb::trace::now() - t) / 1000.0);
+
+    return ret;
+}
+
+void florb::wgt_map::cb_overscan(void* userdata)
+{
+    florb::wgt_map *wgt = reinterpret_cast<florb::wgt_map*>(userdata);
+
+    Fl::remove_idle(cb_overscan, userdata);
+
+    // Only extend a complete frame of the current viewport, anything else
+    // gets redrawn anyway
+    if (wgt->dirty() || wgt->dragging() || wgt->m_zooming || wgt->m_overscanned)
+        return;
+    if (wgt->m_viewport_off != wgt->m_viewport)
+        return;
+
+    FLORB_TRACE("wgt_map::overscan", "draw");
+
+    // Render the visible part again along with the margin, all of it comes
+    // from memory by now. Nothing changes on screen, so there is no redraw.
+    wgt->m_viewport_off = wgt->overscan_viewport();
+    wgt->m_offscreen.resize(wgt->m_viewport_off.w(), wgt->m_viewport_off.h());
+    wgt->m_overscanned = true;
+
+    wgt->m_offscreen.fgcolor(florb::color(0xc06e6e));
+    wgt->m_offscreen.fillrect(0,0, wgt->m_offscreen.w(), wgt->m_offscreen.h());
+
+    // Tiles missing in the margin get downloaded, their arrival redraws the
+    // map which in turn schedules the next overscan pass
+    florb::layer *layers[] = {
+        wgt->m_basemap, wgt->m_overlay, wgt->m_tiledebuglayer, 
+        wgt->m_tracklayer, wgt->m_markerlayer, wgt->m_areaselectlayer };
+
+    for (std::size_t i=0;i<(sizeof(layers)/sizeof(layers[0]));i++)
+    {
+        if (layers[i])
+            layers[i]->draw(wgt->m_viewport_off, wgt->m_offscreen);
+    }
+}
+
+florb::viewport florb::wgt_map::overscan_viewport()
+{
+    unsigned long dim = florb::utils::dim(m_viewport.z());
+    unsigned long x1 = (m_viewport.x() > m_overscan) ? m_viewport.x() - m_overscan : 0;
+    unsigned long y1 = (m_viewport.y() > m_overscan) ? m_viewport.y() - m_overscan : 0;
+    unsigned long x2 = m_viewport.x() + m_viewport.w() + m_overscan;
+    unsigned long y2 = m_viewport.y() + m_viewport.h() + m_overscan;
+
+    x2 = (x2 > dim) ? dim : x2;
+    y2 = (y2 > dim) ? dim : y2;
+
+    return florb::viewport(x1, y1, m_viewport.z(), x2-x1, y2-y1);
+}
+
+bool florb::wgt_map::covers(const florb::viewport& outer, const florb::viewport& inner)
+{
+    if ((outer.z() != inner.z()) || (outer.w() == 0) || (outer.h() == 0))
+        return false;
+
+    return 
+        (inner.x() >= outer.x()) &&
+        (inner.y() >= outer.y()) &&
+        ((inner.x() + inner.w()) <= (outer.x() + outer.w())) &&
+        ((inner.y() + inner.h()) <= (outer.y() + outer.h()));
+}
+
+void florb::wgt_map::overscan(unsigned int px)
+{
+    m_overscan = (px > OVERSCANMAX) ? OVERSCANMAX : px;
+
+    // Drop the current margin, a new one is rendered with the next frame
+    m_viewport_off.w(0);
+    refresh();
+}
+
+std::size_t florb::wgt_map::offscreen_bytes()
+{
+    return (std::size_t)m_offscreen.w() * m_offscreen.h() * 4;
+}
+
+void florb::wgt_map::blit()
+{
+    // Part of the viewport covered by the offscreen buffer
+    unsigned long x1 = (m_viewport_off.x() > m_viewport.x()) ? m_viewport_off.x() : m_viewport.x();
+    unsigned long y1 = (m_viewport_off.y() > m_viewport.y()) ? m_viewport_off.y() : m_viewport.y();
+    unsigned long x2 = m_viewport_off.x() + m_viewport_off.w();
+    unsigned long y2 = m_viewport_off.y() + m_viewport_off.h();
+    x2 = ((m_viewport.x() + m_viewport.w()) < x2) ? m_viewport.x() + m_viewport.w() : x2;
+    y2 = ((m_viewport.y() + m_viewport.h()) < y2) ? m_viewport.y() + m_viewport.h() : y2;
 
     // Additional delta if viewport smaller than map widget 
+    int dpx_wgt = 0, dpy_wgt = 0;
     if (w() > (int)m_viewport.w())
         dpx_wgt = (w() - (int)m_viewport.w())/2;
     if (h() > (int)m_viewport.h())
@@ -953,14 +1549,35 @@ void florb::wgt_map::draw()
     // to be generated.
     fl_rectf(x(), y(), w(), h(), 80, 80, 80);
 
+    if ((x2 <= x1) || (y2 <= y1) || (m_viewport_off.z() != m_viewport.z()))
+        return;
+
     // Draw offscreen onto widget
     fl_copy_offscreen(
-            x()+dpx_dst+dpx_wgt, 
-            y()+dpy_dst+dpy_wgt, 
-            m_viewport_off.w()-((dpx_dst>dpx_src) ? dpx_dst : dpx_src), 
-            m_viewport_off.h()-((dpy_dst>dpy_src) ? dpy_dst : dpy_src), 
+            x()+dpx_wgt+(int)(x1-m_viewport.x()), 
+            y()+dpy_wgt+(int)(y1-m_viewport.y()), 
+            (int)(x2-x1), 
+            (int)(y2-y1), 
             m_offscreen.buf(), 
-            dpx_src, 
-            dpy_src);
+            (int)(x1-m_viewport_off.x()), 
+            (int)(y1-m_viewport_off.y()));
 }
 
+void florb::wgt_map::draw_cursor(double t)
+{
+    m_cursordrawn = cursor_px(t, m_cursorpx, m_cursortrack);
+    if (!m_cursordrawn)
+        return;
+
+    int dpx_wgt = 0, dpy_wgt = 0;
+    if (w() > (int)m_viewport.w())
+        dpx_wgt = (w() - (int)m_viewport.w())/2;
+    if (h() > (int)m_viewport.h())
+        dpy_wgt = (h() - (int)m_viewport.h())/2;
+
+    florb::screen scr(x()+dpx_wgt, y()+dpy_wgt, m_viewport.w(), m_viewport.h());
+
+    fl_push_clip(x(), y(), w(), h());
+    m_gpsdlayer->draw_cursor(m_viewport, scr, t);
+    fl_pop_clip();
+}
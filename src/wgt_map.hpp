@@ -14,7 +14,10 @@
 #include "scalelayer.hpp"
 #include "gpsdlayer.hpp"
 #include "areaselectlayer.hpp"
-#include "gfx.hpp"
+#include "tiledebuglayer.hpp"
+#include "hudlayer.hpp"
+#include "framescheduler.hpp"
+#include "flgfx.hpp"
 
 namespace florb
 {
@@ -28,28 +31,18 @@ namespace florb
             int handle(int event);
 
             // Map and overlay configuration
-            void basemap(
-                    const std::string& name, 
-                    const std::string& url, 
-                    unsigned int zmin, 
-                    unsigned int zmax, 
-                    unsigned int parallel,
-                    int imgtype);
-            void overlay(
-                    const std::string& name, 
-                    const std::string& url, 
-                    unsigned int zmin, 
-                    unsigned int zmax, 
-                    unsigned int parallel,
-                    int imgtype);
+            void basemap(const florb::cfg_tileserver& ts);
+            void overlay(const florb::cfg_tileserver& ts);
             void clear_overlay();
 
             // GPSd configuration
             bool gpsd_connected();
             void gpsd_connect(const std::string& host, const std::string& port);
+            void gpsd_replay(const std::string& path, double speed, const std::string& port);
             void gpsd_disconnect();
             void gpsd_lock(bool start);
             void gpsd_record(bool start);
+            void gpsd_cursorfps(unsigned int fps);
             int gpsd_mode();
 
             // GPX configuration
@@ -64,6 +57,20 @@ namespace florb
             void gpx_showwpmarkers(bool s);
             std::string gpx_trackname();
 
+            // Maximum rate of map redraws, 0 for no limit
+            void maxfps(unsigned int fps);
+
+            // Margin (pixels per side) rendered around the visible map in
+            // idle time so short pans are plain blits, 0 to disable
+            void overscan(unsigned int px);
+
+            // Duration (milliseconds) of animated mouse wheel zoom, 0 to
+            // switch levels at once
+            void zoomtime(unsigned int ms);
+
+            // Current size of the offscreen map buffer
+            std::size_t offscreen_bytes();
+
             // Viewport control
             unsigned int zoom();
             void zoom(unsigned int z);
@@ -80,6 +87,18 @@ namespace florb
             void select_area(const std::string& caption);
             void select_clear();
 
+            // Tile state overlay for the basemap, toggled with F12
+            bool tiledebug();
+            void tiledebug(bool en);
+
+            // Frame time overlay, toggled with F10
+            bool hud();
+            void hud(bool en);
+
+            // Start recording a timeline trace or stop and write it to the
+            // configured file, toggled with F11
+            void trace(bool en);
+
             // Event classes
             class event_notify;
             class event_endselect;
@@ -87,12 +106,43 @@ namespace florb
             // Pixel delta for keyborad map motion commands
             static const int PXMOTION = 15;
 
+            // Distance from the GPS cursor center covering all of the cursor
+            static const int CURSORRADIUS = 20;
+
+            // Upper limit of the overscan margin (pixels per side), keeps the
+            // offscreen buffer at a few times the widget size at most
+            static const unsigned int OVERSCANMAX = 1024;
+
+            // Time (microseconds) smooth scaling of a zoom transition frame
+            // may take before falling back to nearest neighbour
+            static const uint64_t ZOOMBUDGET = 10000;
+
+            // Time (microseconds) a preview frame may spend on scaling up
+            // parent tiles while dragging
+            static const uint64_t PREVIEWBUDGET = 8000;
+
             // Utility methods
-            void refresh();
+            void refresh(unsigned int what = florb::framescheduler::VIEWPORT);
+            static void cb_frame(void* userdata);
             bool dragging();
             void dragging(bool d);
             bool dirty();
             void dirty(bool d);
+            void blit();
+            bool draw_layer(florb::layer *l, const char *name);
+            void draw_preview();
+            void draw_fixed(uint64_t tframe);
+            static void cb_overscan(void* userdata);
+            florb::viewport overscan_viewport();
+            static bool covers(const florb::viewport& outer, const florb::viewport& inner);
+            bool draw_zoom();
+            florb::image* snapshot();
+            void zoom_start(florb::image *frame, int dz, int px, int py);
+            void zoom_stop();
+            void draw_cursor(double t);
+            bool cursor_px(double t, florb::point2d<long>& px, int& track);
+            void cursor_damage();
+            static void cb_cursor(void* userdata);
 
             // Widget event handling routines
             int handle_move(int event);
@@ -131,17 +181,41 @@ namespace florb
             florb::markerlayer *m_markerlayer;
             florb::gpsdlayer *m_gpsdlayer;
             florb::areaselectlayer *m_areaselectlayer;
+            florb::tiledebuglayer *m_tiledebuglayer;
+            bool m_tiledebug;
+            florb::hudlayer *m_hudlayer;
+            bool m_hud;
+            florb::framescheduler m_scheduler;
 
             florb::point2d<int> m_mousepos;
             viewport m_viewport;
             viewport m_viewport_off;
             florb::canvas m_offscreen;
+            unsigned int m_overscan;
+            bool m_overscanned;
+
+            // Zoom transition, scales one frame from start to end level
+            unsigned int m_zoomtime;
+            bool m_zooming;
+            florb::image *m_zoomframe;
+            int m_zoomdz;
+            int m_zoomx;
+            int m_zoomy;
+            double m_zoomstart;
+            int m_zoomfilter;
 
             bool m_lockcursor;
             bool m_recordtrack;
             bool m_dragging;
             bool m_dirty;
 
+            // Interpolated GPS cursor, drawn on top of the offscreen buffer
+            double m_cursorinterval;
+            bool m_cursortimer;
+            bool m_cursordrawn;
+            florb::point2d<long> m_cursorpx;
+            int m_cursortrack;
+
         protected:
             void draw();
     };